@@ -0,0 +1,234 @@
+#include "async_io.hpp"
+#include "thread_pool_backend.hpp"
+
+#ifdef __linux__
+#include "io_uring_linux.hpp"
+#endif
+
+#include <new>
+
+#ifndef _WIN32
+#include <errno.h>
+#endif
+
+using namespace thin_io;
+
+#ifdef _WIN32
+// Not pulling in Windows.h for these
+static constexpr int64_t operation_cancelled = 995; // ERROR_OPERATION_ABORTED
+static constexpr int64_t operation_timed_out = 1460; // ERROR_TIMEOUT
+#else
+static constexpr int64_t operation_cancelled = ECANCELED;
+static constexpr int64_t operation_timed_out = ETIMEDOUT;
+#endif
+
+bool io_result::cancelled() const noexcept
+{
+	return value == -operation_cancelled;
+}
+
+bool io_result::timed_out() const noexcept
+{
+	return value == -operation_timed_out;
+}
+
+io_result io_result::cancelled_result() noexcept
+{
+	return io_result{.value = -operation_cancelled};
+}
+
+io_result io_result::timed_out_result() noexcept
+{
+	return io_result{.value = -operation_timed_out};
+}
+
+void detail::execute_blocking(io_request& r) noexcept
+{
+	const auto failure = []() -> int64_t {
+		const auto ec = static_cast<int64_t>(file::error_code());
+		return ec != 0 ? -ec : -1;
+	};
+	const auto transferred = [&](std::optional<uint64_t> n) -> int64_t {
+		return n ? static_cast<int64_t>(*n) : failure();
+	};
+
+	const bool overridePriority = !r.priority.is_default() && (r.op == io_op::Read || r.op == io_op::Write);
+	const io_priority previousOverride = overridePriority ? file::override_thread_priority(r.priority) : io_priority{};
+
+	switch (r.op) {
+	case io_op::Read:
+		r.result.value = transferred(r.target->pread(r.buffer, r.size, r.offset));
+		break;
+	case io_op::Write:
+		r.result.value = transferred(r.target->pwrite(r.buffer, r.size, r.offset));
+		break;
+	case io_op::Fsync:
+		r.result.value = r.target->fsync() ? 0 : failure();
+		break;
+	case io_op::Fdatasync:
+		r.result.value = r.target->fdatasync() ? 0 : failure();
+		break;
+	case io_op::Open:
+		// open() doesn't close the file that was open there, like attach() does on io_uring
+		if (r.target->is_open() && !r.target->close())
+			r.result.value = failure();
+		else
+			r.result.value = r.target->open(r.path, r.openMode, r.cacheMode) ? 0 : failure();
+		break;
+	}
+
+	if (overridePriority)
+		file::override_thread_priority(previousOverride);
+}
+
+detail::buffer_pool::buffer_pool(size_t count, size_t bufferSize) noexcept :
+	_bufferSize{bufferSize}
+{
+	static constexpr std::align_val_t alignment{4096}; // Good for O_DIRECT, too
+	_regions.reserve(count);
+	_free.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		void* data = ::operator new(bufferSize, alignment, std::nothrow);
+		if (!data)
+			break;
+
+		_regions.push_back(io_buffer_region{.data = data, .size = bufferSize});
+		_free.push_back(count - 1 - i); // Hand out the low indices first
+	}
+
+	if (_regions.size() != count)
+		_free.clear();
+}
+
+detail::buffer_pool::~buffer_pool() noexcept
+{
+	for (const auto& region : _regions)
+		::operator delete(region.data, std::align_val_t{4096});
+}
+
+std::optional<size_t> detail::buffer_pool::acquire() noexcept
+{
+	std::lock_guard lock{_mutex};
+	if (_free.empty())
+		return {};
+
+	const size_t index = _free.back();
+	_free.pop_back();
+	return index;
+}
+
+void detail::buffer_pool::release(size_t index) noexcept
+{
+	std::lock_guard lock{_mutex};
+	_free.push_back(index);
+}
+
+io_context::io_context(unsigned queueDepth) noexcept :
+	io_context{io_context_options{.queue_depth = queueDepth}}
+{
+}
+
+io_context::io_context(const io_context_options& options) noexcept
+{
+#ifdef __linux__
+	if (options.allow_io_uring)
+	{
+		_backend = detail::make_io_uring_backend(options);
+		if (_backend)
+			_backendType = io_backend_type::IoUring;
+	}
+#endif
+
+	if (!_backend)
+	{
+		_backend = detail::make_thread_pool_backend(options.pool_threads, options.completion_notification);
+		_backendType = io_backend_type::ThreadPool;
+	}
+}
+
+io_context::~io_context() noexcept = default;
+
+cancel_handle io_context::submit(io_request& request) noexcept
+{
+	_pending.fetch_add(1, std::memory_order_acq_rel);
+	_backend->submit(request);
+	return cancel_handle{*this, request};
+}
+
+void io_context::cancel(io_request& request) noexcept
+{
+	_backend->cancel(request);
+}
+
+registered_file io_context::register_file(file& f) noexcept
+{
+	return registered_file{*this, f, _backend->register_file(f)};
+}
+
+bool io_context::register_buffers(size_t count, size_t size) noexcept
+{
+	if (_buffers || count == 0 || size == 0)
+		return false;
+
+	auto pool = std::make_unique<detail::buffer_pool>(count, size);
+	if (pool->regions().size() != count)
+		return false;
+
+	pool->registered = _backend->register_buffers(pool->regions());
+	_buffers = std::move(pool);
+	return true;
+}
+
+std::optional<io_buffer> io_context::acquire_buffer() noexcept
+{
+	if (!_buffers)
+		return {};
+
+	const auto index = _buffers->acquire();
+	if (!index)
+		return {};
+
+	return io_buffer{*_buffers, *index};
+}
+
+void io_context::run() noexcept
+{
+	while (!_stopped.load(std::memory_order_acquire) && pending() != 0)
+		reap(true);
+
+	_stopped.store(false, std::memory_order_release);
+}
+
+size_t io_context::run_one() noexcept
+{
+	return pending() != 0 ? reap(true) : 0;
+}
+
+size_t io_context::poll() noexcept
+{
+	return reap(false);
+}
+
+notification_handle_type io_context::notification_handle() const noexcept
+{
+	return _backend->notification_handle();
+}
+
+void io_context::stop() noexcept
+{
+	_stopped.store(true, std::memory_order_release);
+	_backend->wake();
+}
+
+void io_context::wake() noexcept
+{
+	_backend->wake();
+}
+
+size_t io_context::reap(bool wait) noexcept
+{
+	const size_t n = _backend->reap(wait);
+	_pending.fetch_sub(n, std::memory_order_acq_rel);
+	return n;
+}
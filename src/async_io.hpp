@@ -0,0 +1,602 @@
+#pragma once
+#include "file.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <concepts>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdint.h>
+#include <stop_token>
+#include <vector>
+
+namespace thin_io {
+
+enum class io_backend_type {IoUring, ThreadPool};
+
+// An eventfd / pipe read end on POSIX, an event on Windows, see io_context::notification_handle()
+using notification_handle_type = file_impl::native_handle_type;
+
+struct io_result {
+	int64_t value = 0; // Bytes transferred (0 for fsync / open), or the negated OS error code
+
+	[[nodiscard]] inline bool ok() const noexcept { return value >= 0; }
+	[[nodiscard]] inline uint64_t bytes() const noexcept { return ok() ? static_cast<uint64_t>(value) : 0; }
+	// The same kind of code as file::error_code(), 0 if there was no error
+	[[nodiscard]] inline decltype(file::error_code()) error() const noexcept {
+		return ok() ? 0 : static_cast<decltype(file::error_code())>(-value);
+	}
+	[[nodiscard]] bool cancelled() const noexcept;
+	// The request's timeout expired first
+	[[nodiscard]] bool timed_out() const noexcept;
+
+	[[nodiscard]] static io_result cancelled_result() noexcept;
+	[[nodiscard]] static io_result timed_out_result() noexcept;
+};
+
+enum class io_op : uint8_t {Read, Write, Fsync, Fdatasync, Open};
+
+class io_buffer;
+class io_context;
+
+// One asynchronous operation. Must stay alive and unmoved until its completion handler has been called.
+struct io_request {
+	io_op op = io_op::Read;
+	file* target = nullptr; // For Open: the object that receives the newly opened file
+	void* buffer = nullptr;
+	uint64_t size = 0;
+	uint64_t offset = 0;
+
+	// Open only
+	const char* path = nullptr;
+	file::open_mode openMode = file::open_mode::Read;
+	file::sys_cache_mode cacheMode = file::sys_cache_mode::CachingEnabled;
+
+	// Registered resources (io_uring only, ignored by the thread pool backend), -1 if not used.
+	// See registered_file and io_buffer.
+	int fixed_file = -1;
+	int fixed_buffer = -1; // buffer must point inside this registered buffer
+
+	// Counted from submission, 0 for no limit. When the operation does not complete in time it is cancelled and fails with
+	// io_result::timed_out(). io_uring: a linked timeout, the operation is aborted in the kernel; when the ring is backed up
+	// the request fails with EBUSY, where one without a timeout would be executed synchronously.
+	// Thread pool: cooperative, a request that has not been started by its deadline is skipped; one that is already
+	// running cannot be interrupted.
+	std::chrono::nanoseconds timeout{0};
+
+	// Read / Write: overrides the file's priority (see file::set_priority()) for this operation.
+	// io_uring: sent with the request (RealTime fails with EPERM without the capability). Thread pool: the worker thread's
+	// priority for the duration of the operation.
+	io_priority priority;
+
+	io_result result;
+
+	// Called by the thread running the io_context
+	void (*on_complete)(io_request&) noexcept = nullptr;
+	void* user_data = nullptr;
+
+	[[nodiscard]] static inline io_request pread(file& f, void* dest, uint64_t size, uint64_t pos) noexcept {
+		io_request r;
+		r.op = io_op::Read;
+		r.target = &f;
+		r.buffer = dest;
+		r.size = size;
+		r.offset = pos;
+		return r;
+	}
+
+	[[nodiscard]] static inline io_request pwrite(file& f, const void* src, uint64_t size, uint64_t pos) noexcept {
+		io_request r;
+		r.op = io_op::Write;
+		r.target = &f;
+		r.buffer = const_cast<void*>(src);
+		r.size = size;
+		r.offset = pos;
+		return r;
+	}
+
+	[[nodiscard]] static inline io_request fsync(file& f) noexcept {
+		io_request r;
+		r.op = io_op::Fsync;
+		r.target = &f;
+		return r;
+	}
+
+	[[nodiscard]] static inline io_request fdatasync(file& f) noexcept {
+		io_request r;
+		r.op = io_op::Fdatasync;
+		r.target = &f;
+		return r;
+	}
+
+	[[nodiscard]] static inline io_request open(file& f, const char* path, file::open_mode openMode, file::sys_cache_mode cacheMode) noexcept {
+		io_request r;
+		r.op = io_op::Open;
+		r.target = &f;
+		r.path = path;
+		r.openMode = openMode;
+		r.cacheMode = cacheMode;
+		return r;
+	}
+
+	// A copy of this Read or Write request that transfers to / from the registered buffer
+	[[nodiscard]] inline io_request with_buffer(const io_buffer& b) const noexcept;
+
+	[[nodiscard]] inline io_request with_timeout(std::chrono::nanoseconds t) const noexcept {
+		io_request r = *this;
+		r.timeout = t;
+		return r;
+	}
+
+	[[nodiscard]] inline io_request with_priority(io_priority p) const noexcept {
+		io_request r = *this;
+		r.priority = p;
+		return r;
+	}
+
+	// Backend bookkeeping, not to be touched
+	struct {
+		std::chrono::steady_clock::time_point deadline;
+		int64_t timespec[2] = {0, 0}; // io_uring linked timeout, read by the kernel at submission
+		uint8_t completions = 0; // Outstanding CQEs
+		bool expired = false;
+	} backend_state;
+};
+
+namespace detail {
+
+struct io_buffer_region {
+	void* data;
+	size_t size;
+};
+
+class buffer_pool {
+public:
+	buffer_pool(size_t count, size_t bufferSize) noexcept;
+	~buffer_pool() noexcept;
+
+	buffer_pool(const buffer_pool&) = delete;
+	buffer_pool& operator=(const buffer_pool&) = delete;
+
+	[[nodiscard]] std::optional<size_t> acquire() noexcept;
+	void release(size_t index) noexcept;
+
+	[[nodiscard]] inline void* data(size_t index) const noexcept { return _regions[index].data; }
+	[[nodiscard]] inline size_t buffer_size() const noexcept { return _bufferSize; }
+	[[nodiscard]] inline std::span<const io_buffer_region> regions() const noexcept { return _regions; }
+
+	// Registered with the kernel
+	bool registered = false;
+
+private:
+	std::vector<io_buffer_region> _regions;
+	std::mutex _mutex;
+	std::vector<size_t> _free;
+	const size_t _bufferSize;
+};
+
+class io_backend {
+public:
+	virtual ~io_backend() noexcept = default;
+
+	// Thread-safe
+	virtual void submit(io_request& request) noexcept = 0;
+	// Thread-safe. Best effort: an operation that has already started may still complete normally.
+	virtual void cancel(io_request& request) noexcept = 0;
+	// Thread-safe. Makes a blocked reap() return.
+	virtual void wake() noexcept = 0;
+
+	// Only one thread at a time. Calls the completion handlers of the finished requests and returns their number.
+	// If wait is true, blocks until there is at least one completion or wake() is called.
+	// Resets the notification handle.
+	virtual size_t reap(bool wait) noexcept = 0;
+
+	// Invalid (-1 / nullptr) if the completion notification was not enabled or could not be set up
+	[[nodiscard]] virtual notification_handle_type notification_handle() const noexcept = 0;
+
+	// Registered resources are optional.
+	// Returns the slot, or -1 if the file was not registered
+	[[nodiscard]] virtual int register_file(file& /*f*/) noexcept { return -1; }
+	virtual void unregister_file(int /*slot*/) noexcept {}
+	// Returns false if the buffers were not registered
+	[[nodiscard]] virtual bool register_buffers(std::span<const io_buffer_region> /*buffers*/) noexcept { return false; }
+};
+
+// Performs the request synchronously on the calling thread and stores the result
+void execute_blocking(io_request& request) noexcept;
+
+} // namespace detail
+
+struct io_context_options {
+	unsigned queue_depth = 256;
+	// Set to false to always use the thread pool
+	bool allow_io_uring = true;
+	// Thread pool backend: the number of worker threads, 0 for one per core
+	unsigned pool_threads = 4;
+
+	// io_uring: the size of the registered file table, see io_context::register_file()
+	unsigned registered_file_slots = 64;
+	// io_uring: a kernel thread polls the submission queue, so submitting does not take a system call.
+	// Falls back to regular submission if not supported (kernels before 5.11 or not enough privileges).
+	bool sqpoll = false;
+	// How long the polling thread spins without work before going to sleep
+	unsigned sqpoll_idle_ms = 1000;
+
+	// Signal a handle on completion, see io_context::notification_handle()
+	bool completion_notification = false;
+};
+
+// Cancels a submitted request, see io_context::cancel(). Only valid until the request's completion handler has run:
+// afterwards it may refer to a request object that has been reused.
+class cancel_handle {
+public:
+	cancel_handle() noexcept = default;
+
+	inline void cancel() const noexcept;
+
+private:
+	friend class io_context;
+	inline cancel_handle(io_context& ctx, io_request& request) noexcept : _ctx{&ctx}, _request{&request} {}
+
+private:
+	io_context* _ctx = nullptr;
+	io_request* _request = nullptr;
+};
+
+// A file registered with an io_context, see io_context::register_file(). Unregisters on destruction.
+class [[nodiscard]] registered_file {
+public:
+	registered_file() noexcept = default;
+	inline registered_file(registered_file&& other) noexcept;
+	inline registered_file& operator=(registered_file&& other) noexcept;
+	inline ~registered_file() noexcept;
+
+	inline void reset() noexcept;
+
+	[[nodiscard]] inline explicit operator bool() const noexcept { return _file != nullptr; }
+	[[nodiscard]] inline file& get() const noexcept { return *_file; }
+	// -1 if the backend does not support registration, the requests then use the plain file handle
+	[[nodiscard]] inline int slot() const noexcept { return _slot; }
+
+	[[nodiscard]] inline io_request pread(void* dest, uint64_t size, uint64_t pos) const noexcept;
+	[[nodiscard]] inline io_request pwrite(const void* src, uint64_t size, uint64_t pos) const noexcept;
+	[[nodiscard]] inline io_request fsync() const noexcept;
+	[[nodiscard]] inline io_request fdatasync() const noexcept;
+
+private:
+	friend class io_context;
+	inline registered_file(io_context& ctx, file& f, int slot) noexcept : _ctx{&ctx}, _file{&f}, _slot{slot} {}
+
+private:
+	io_context* _ctx = nullptr;
+	file* _file = nullptr;
+	int _slot = -1;
+};
+
+// One of the buffers registered with io_context::register_buffers(). Goes back to the pool on destruction.
+class [[nodiscard]] io_buffer {
+public:
+	inline io_buffer(io_buffer&& other) noexcept : _pool{other._pool}, _index{other._index} { other._pool = nullptr; }
+	io_buffer& operator=(io_buffer&&) = delete;
+	inline ~io_buffer() noexcept {
+		if (_pool)
+			_pool->release(_index);
+	}
+
+	[[nodiscard]] inline void* data() const noexcept { return _pool->data(_index); }
+	[[nodiscard]] inline size_t size() const noexcept { return _pool->buffer_size(); }
+	// -1 if the buffers are not registered with the kernel
+	[[nodiscard]] inline int index() const noexcept { return _pool->registered ? static_cast<int>(_index) : -1; }
+
+private:
+	friend class io_context;
+	inline io_buffer(detail::buffer_pool& pool, size_t index) noexcept : _pool{&pool}, _index{index} {}
+
+private:
+	detail::buffer_pool* _pool;
+	size_t _index;
+};
+
+inline io_request io_request::with_buffer(const io_buffer& b) const noexcept
+{
+	io_request r = *this;
+	r.fixed_buffer = b.index();
+	return r;
+}
+
+// Executor for asynchronous file I/O.
+// Backed by io_uring where available. If io_uring cannot be set up (old kernel, blocked by seccomp, disabled by sysctl)
+// the operations are run on a small pool of worker threads instead - with the same interface and semantics.
+// Requests can be submitted and cancelled from any thread; completion handlers and coroutines run on the thread that calls
+// run(), run_one() or poll().
+class io_context {
+public:
+	explicit io_context(unsigned queueDepth = 256) noexcept;
+	explicit io_context(const io_context_options& options) noexcept;
+	~io_context() noexcept;
+
+	io_context(const io_context&) = delete;
+	io_context& operator=(const io_context&) = delete;
+
+	[[nodiscard]] io_backend_type backend() const noexcept { return _backendType; }
+
+	cancel_handle submit(io_request& request) noexcept;
+	// callback(io_result) is called on the io_context thread
+	template <std::invocable<io_result> Callback>
+	cancel_handle submit(const io_request& request, Callback&& callback) noexcept;
+	// The future becomes ready when the completion is processed by the io_context thread, so someone must be running it!
+	[[nodiscard]] inline std::future<io_result> submit_for_future(const io_request& request) noexcept;
+
+	void cancel(io_request& request) noexcept;
+
+	// Registers the file with the kernel so that requests skip the file descriptor lookup and reference counting.
+	// The registration holds its own reference to the open file: if f is closed, the file stays open until the registration
+	// is released. f must outlive the registered_file.
+	// With the thread pool backend, or when the table is full, the registered_file only refers to f.
+	[[nodiscard]] registered_file register_file(file& f) noexcept;
+
+	// Allocates count page-aligned buffers of size bytes each and registers them with the kernel, which then does not have to
+	// map and pin the pages on every request. Can only be done once. Returns false if the buffers could not be allocated.
+	bool register_buffers(size_t count, size_t size) noexcept;
+	// Nothing if all the buffers are in use or none were registered. Thread-safe.
+	[[nodiscard]] std::optional<io_buffer> acquire_buffer() noexcept;
+
+	// Processes completions until there are no outstanding requests or stop() is called
+	void run() noexcept;
+	// Blocks until at least one request completes (or stop() is called), returns the number of completions processed
+	size_t run_one() noexcept;
+	// Processes the completions that are ready without blocking
+	size_t poll() noexcept;
+	// With io_context_options::completion_notification: a handle that becomes ready when there are completions to process,
+	// so that they can be dispatched from an existing event loop (epoll, poll, WaitForMultipleObjects) with no extra thread.
+	// POSIX: readable (eventfd on Linux, a pipe elsewhere); Windows: signaled (manual-reset event).
+	// Call poll() when it fires, which also resets it. There may be spurious wake-ups.
+	// Invalid (-1 / nullptr) if the notification is not enabled or not available.
+	[[nodiscard]] notification_handle_type notification_handle() const noexcept;
+	// Thread-safe. Makes run() return as soon as possible.
+	void stop() noexcept;
+	// Thread-safe. Makes a blocked run_one() return, possibly with 0 completions.
+	void wake() noexcept;
+
+	// Submitted requests whose completion handlers have not been called yet
+	[[nodiscard]] size_t pending() const noexcept { return _pending.load(std::memory_order_acquire); }
+
+	// Awaitables, see below
+	[[nodiscard]] inline auto async(const io_request& request, std::stop_token stop = {}) noexcept;
+	[[nodiscard]] inline auto async_pread(file& f, void* dest, uint64_t size, uint64_t pos, std::stop_token stop = {}) noexcept;
+	[[nodiscard]] inline auto async_pwrite(file& f, const void* src, uint64_t size, uint64_t pos, std::stop_token stop = {}) noexcept;
+	[[nodiscard]] inline auto async_fsync(file& f, std::stop_token stop = {}) noexcept;
+	[[nodiscard]] inline auto async_fdatasync(file& f, std::stop_token stop = {}) noexcept;
+	// Opens the file into f (closing whatever was open there before)
+	[[nodiscard]] inline auto async_open(file& f, const char* path, file::open_mode openMode,
+		file::sys_cache_mode cacheMode = file::sys_cache_mode::CachingEnabled, std::stop_token stop = {}) noexcept;
+
+private:
+	friend class registered_file;
+	size_t reap(bool wait) noexcept;
+
+private:
+	std::unique_ptr<detail::buffer_pool> _buffers; // Outlives the backend, whose destructor may run completion handlers
+	std::unique_ptr<detail::io_backend> _backend;
+	std::atomic<size_t> _pending{0};
+	std::atomic<bool> _stopped{false};
+	io_backend_type _backendType = io_backend_type::ThreadPool;
+};
+
+// co_await-able wrapper around one io_request. Resumes the coroutine on the io_context thread.
+// Cancellation: when the stop token is triggered the request is cancelled, and the result is cancelled() unless it has already completed.
+class [[nodiscard]] io_awaitable {
+public:
+	inline io_awaitable(io_context& ctx, const io_request& request, std::stop_token stop) noexcept :
+		_ctx{ctx}, _request{request}, _stopToken{std::move(stop)}
+	{}
+
+	io_awaitable(const io_awaitable&) = delete;
+	io_awaitable& operator=(const io_awaitable&) = delete;
+
+	[[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+
+	inline bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		if (_stopToken.stop_requested())
+		{
+			_request.result = io_result::cancelled_result();
+			return false; // Resume immediately
+		}
+
+		_handle = h;
+		_request.user_data = this;
+		_request.on_complete = [](io_request& r) noexcept {
+			// Until await_suspend() is done with the request, it resumes the coroutine itself
+			auto* self = static_cast<io_awaitable*>(r.user_data);
+			if (self->_state.fetch_or(completed, std::memory_order_acq_rel) & submitted)
+				self->_handle.resume();
+		};
+
+		if (_stopToken.stop_possible())
+			_stopCallback.emplace(_stopToken, canceller{this});
+
+		_ctx.submit(_request);
+
+		uint8_t state = 0;
+		if (_state.compare_exchange_strong(state, submitted, std::memory_order_acq_rel))
+			return true; // The coroutine may already have been resumed on another thread, *this must not be touched anymore
+
+		// Stopped while the request was being submitted, when cancelling it had no effect yet
+		if ((state & completed) == 0)
+			_ctx.cancel(_request);
+
+		return (_state.fetch_or(submitted, std::memory_order_acq_rel) & completed) == 0;
+	}
+
+	inline io_result await_resume() noexcept
+	{
+		_stopCallback.reset();
+		return _request.result;
+	}
+
+private:
+	struct canceller {
+		io_awaitable* self;
+		inline void operator()() const noexcept
+		{
+			if (self->_state.fetch_or(cancel_requested, std::memory_order_acq_rel) & submitted)
+				self->_ctx.cancel(self->_request);
+		}
+	};
+
+	enum : uint8_t {submitted = 1, cancel_requested = 2, completed = 4};
+
+private:
+	io_context& _ctx;
+	io_request _request;
+	std::stop_token _stopToken;
+	std::optional<std::stop_callback<canceller>> _stopCallback;
+	std::coroutine_handle<> _handle;
+	std::atomic<uint8_t> _state{0};
+};
+
+template <std::invocable<io_result> Callback>
+cancel_handle io_context::submit(const io_request& request, Callback&& callback) noexcept
+{
+	struct holder {
+		io_request request;
+		std::decay_t<Callback> callback;
+	};
+
+	auto* h = new holder{request, std::forward<Callback>(callback)};
+	h->request.user_data = h;
+	h->request.on_complete = [](io_request& r) noexcept {
+		auto* self = static_cast<holder*>(r.user_data);
+		self->callback(r.result);
+		delete self;
+	};
+	return submit(h->request);
+}
+
+inline void cancel_handle::cancel() const noexcept
+{
+	if (_request)
+		_ctx->cancel(*_request);
+}
+
+inline std::future<io_result> io_context::submit_for_future(const io_request& request) noexcept
+{
+	std::promise<io_result> promise;
+	auto future = promise.get_future();
+	submit(request, [promise = std::move(promise)](io_result result) mutable {
+		promise.set_value(result);
+	});
+	return future;
+}
+
+inline registered_file::registered_file(registered_file&& other) noexcept :
+	_ctx{other._ctx}, _file{other._file}, _slot{other._slot}
+{
+	other._file = nullptr;
+	other._slot = -1;
+}
+
+inline registered_file& registered_file::operator=(registered_file&& other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		_ctx = other._ctx;
+		_file = other._file;
+		_slot = other._slot;
+		other._file = nullptr;
+		other._slot = -1;
+	}
+	return *this;
+}
+
+inline registered_file::~registered_file() noexcept
+{
+	reset();
+}
+
+inline void registered_file::reset() noexcept
+{
+	if (_slot >= 0)
+		_ctx->_backend->unregister_file(_slot);
+
+	_file = nullptr;
+	_slot = -1;
+}
+
+inline io_request registered_file::pread(void* dest, uint64_t size, uint64_t pos) const noexcept
+{
+	io_request r = io_request::pread(*_file, dest, size, pos);
+	r.fixed_file = _slot;
+	return r;
+}
+
+inline io_request registered_file::pwrite(const void* src, uint64_t size, uint64_t pos) const noexcept
+{
+	io_request r = io_request::pwrite(*_file, src, size, pos);
+	r.fixed_file = _slot;
+	return r;
+}
+
+inline io_request registered_file::fsync() const noexcept
+{
+	io_request r = io_request::fsync(*_file);
+	r.fixed_file = _slot;
+	return r;
+}
+
+inline io_request registered_file::fdatasync() const noexcept
+{
+	io_request r = io_request::fdatasync(*_file);
+	r.fixed_file = _slot;
+	return r;
+}
+
+inline auto io_context::async(const io_request& request, std::stop_token stop) noexcept
+{
+	return io_awaitable{*this, request, std::move(stop)};
+}
+
+inline auto io_context::async_pread(file& f, void* dest, uint64_t size, uint64_t pos, std::stop_token stop) noexcept
+{
+	return io_awaitable{*this, io_request::pread(f, dest, size, pos), std::move(stop)};
+}
+
+inline auto io_context::async_pwrite(file& f, const void* src, uint64_t size, uint64_t pos, std::stop_token stop) noexcept
+{
+	return io_awaitable{*this, io_request::pwrite(f, src, size, pos), std::move(stop)};
+}
+
+inline auto io_context::async_fsync(file& f, std::stop_token stop) noexcept
+{
+	return io_awaitable{*this, io_request::fsync(f), std::move(stop)};
+}
+
+inline auto io_context::async_fdatasync(file& f, std::stop_token stop) noexcept
+{
+	return io_awaitable{*this, io_request::fdatasync(f), std::move(stop)};
+}
+
+inline auto io_context::async_open(file& f, const char* path, file::open_mode openMode, file::sys_cache_mode cacheMode, std::stop_token stop) noexcept
+{
+	return io_awaitable{*this, io_request::open(f, path, openMode, cacheMode), std::move(stop)};
+}
+
+// Minimal fire-and-forget coroutine type: starts immediately and frees itself when done
+struct detached_task {
+	struct promise_type {
+		constexpr detached_task get_return_object() const noexcept { return {}; }
+		constexpr std::suspend_never initial_suspend() const noexcept { return {}; }
+		constexpr std::suspend_never final_suspend() const noexcept { return {}; }
+		constexpr void return_void() const noexcept {}
+		[[noreturn]] void unhandled_exception() const noexcept { std::terminate(); }
+	};
+};
+
+} // namespace thin_io
@@ -0,0 +1,266 @@
+#include "file_arena.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <string.h>
+#include <vector>
+
+using namespace thin_io;
+
+// At the start of the file
+struct file_arena::header {
+	static constexpr uint64_t magic_value = 0x41'4E'45'52'41'4F'49'54; // "TIOARENA"
+	static constexpr uint64_t current_version = 1;
+
+	uint64_t magic;
+	uint64_t version;
+	uint64_t segmentSize;
+	uint64_t segmentCount;
+	uint64_t current; // Index + 1 of the segment being allocated from, 0 for none
+	uint64_t bump; // Offset of the end of the last allocation in it
+	uint64_t freeList; // Index + 1 of the first free segment, 0 for none
+	uint64_t freeCount;
+	uint64_t liveBytes;
+	uint64_t root;
+};
+
+// At the start of every segment
+struct file_arena::segment_header {
+	uint64_t live; // Bytes allocated in it and not deallocated yet
+	uint64_t run; // Number of segments in the allocation it starts, 0 if free
+	uint64_t nextFree; // Index + 1 of the next free segment
+};
+
+namespace {
+
+// The segments are aligned on it, so that their space can be released whatever the page size
+constexpr uint64_t header_size = 64 * 1024;
+constexpr uint64_t segment_header_size = 64;
+
+} // namespace
+
+bool file_arena::open(const char* path, const file_arena_options& options) noexcept
+{
+	static_assert(sizeof(header) <= header_size && sizeof(segment_header) <= segment_header_size);
+	if (is_open())
+		close();
+
+	if (!_mapping.open(path, options.mapping))
+		return false;
+
+	if (_mapping.size() == 0)
+	{
+		if (!_mapping.resize(header_size))
+		{
+			(void)_mapping.close();
+			return false;
+		}
+
+		(void)_mapping.backing_file().set_sparse(); // For punch_hole() on Windows
+		const uint64_t segmentSize = std::max((options.segment_size + header_size - 1) / header_size * header_size, header_size);
+		*arena_header() = header{.magic = header::magic_value, .version = header::current_version, .segmentSize = segmentSize, .segmentCount = 0,
+			.current = 0, .bump = 0, .freeList = 0, .freeCount = 0, .liveBytes = 0, .root = 0};
+		return true;
+	}
+
+	const header* h = arena_header();
+	if (_mapping.size() < header_size || h->magic != header::magic_value || h->version != header::current_version
+		|| h->segmentSize == 0 || h->segmentSize % header_size != 0 || _mapping.size() < segment_offset(h->segmentCount))
+	{
+		(void)_mapping.close();
+		return false;
+	}
+	return true;
+}
+
+bool file_arena::close() noexcept
+{
+	return _mapping.close();
+}
+
+uint64_t file_arena::allocate_bytes(uint64_t size, uint64_t align) noexcept
+{
+	if (!is_open() || size == 0 || align > segment_header_size || !std::has_single_bit(align))
+		return 0;
+
+	const uint64_t segmentSize = arena_header()->segmentSize;
+	if (size > segmentSize - segment_header_size)
+	{
+		const auto first = take_segments((size + segment_header_size + segmentSize - 1) / segmentSize);
+		if (!first)
+			return 0;
+
+		segment(*first)->live = size;
+		arena_header()->liveBytes += size;
+		return segment_offset(*first) + segment_header_size;
+	}
+
+	header* h = arena_header();
+	uint64_t offset = h->current != 0 ? (h->bump + align - 1) & ~(align - 1) : segmentSize;
+	if (offset + size > segmentSize)
+	{
+		const auto index = take_segments(1);
+		if (!index)
+			return 0;
+
+		h = arena_header(); // The mapping may have moved
+		const uint64_t previous = h->current;
+		h->current = *index + 1;
+		offset = segment_header_size;
+		// Nothing more will be allocated from the previous one: released if already empty
+		if (previous != 0 && segment(previous - 1)->live == 0)
+			release_segments(previous - 1);
+	}
+
+	h->bump = offset + size;
+	h->liveBytes += size;
+	segment(h->current - 1)->live += size;
+	return segment_offset(h->current - 1) + offset;
+}
+
+void file_arena::deallocate_bytes(uint64_t offset, uint64_t size) noexcept
+{
+	if (!is_open() || offset < header_size)
+		return;
+
+	header* h = arena_header();
+	const uint64_t index = (offset - header_size) / h->segmentSize;
+	if (index >= h->segmentCount)
+		return;
+
+	segment_header* s = segment(index);
+	s->live -= std::min(size, s->live);
+	h->liveBytes -= std::min(size, h->liveBytes);
+	if (s->live == 0 && index + 1 != h->current)
+		release_segments(index);
+}
+
+void file_arena::set_root(uint64_t offset) noexcept
+{
+	if (is_open())
+		arena_header()->root = offset;
+}
+
+uint64_t file_arena::root() const noexcept
+{
+	return is_open() ? arena_header()->root : 0;
+}
+
+bool file_arena::flush(bool wait) noexcept
+{
+	return is_open() && _mapping.flush(0, _mapping.size(), wait);
+}
+
+uint64_t file_arena::segment_size() const noexcept
+{
+	return is_open() ? arena_header()->segmentSize : 0;
+}
+
+uint64_t file_arena::segment_count() const noexcept
+{
+	return is_open() ? arena_header()->segmentCount : 0;
+}
+
+uint64_t file_arena::free_segment_count() const noexcept
+{
+	return is_open() ? arena_header()->freeCount : 0;
+}
+
+uint64_t file_arena::live_bytes() const noexcept
+{
+	return is_open() ? arena_header()->liveBytes : 0;
+}
+
+file_arena::header* file_arena::arena_header() noexcept
+{
+	return reinterpret_cast<header*>(_mapping.data());
+}
+
+const file_arena::header* file_arena::arena_header() const noexcept
+{
+	return reinterpret_cast<const header*>(_mapping.data());
+}
+
+file_arena::segment_header* file_arena::segment(uint64_t index) noexcept
+{
+	return reinterpret_cast<segment_header*>(_mapping.data() + segment_offset(index));
+}
+
+uint64_t file_arena::segment_offset(uint64_t index) const noexcept
+{
+	return header_size + index * arena_header()->segmentSize;
+}
+
+std::optional<uint64_t> file_arena::take_segments(uint64_t count) noexcept
+{
+	header* h = arena_header();
+	if (count == 1 && h->freeList != 0)
+	{
+		const uint64_t index = h->freeList - 1;
+		segment_header* s = segment(index);
+		h->freeList = s->nextFree;
+		--h->freeCount;
+		*s = segment_header{.live = 0, .run = 1, .nextFree = 0};
+		return index;
+	}
+
+	if (count > 1 && h->freeCount >= count)
+	{
+		std::vector<uint64_t> freeSegments;
+		freeSegments.reserve(static_cast<size_t>(h->freeCount));
+		for (uint64_t next = h->freeList; next != 0; next = segment(next - 1)->nextFree)
+			freeSegments.push_back(next - 1);
+		std::sort(freeSegments.begin(), freeSegments.end());
+
+		// The first run of count free segments in a row
+		for (size_t first = 0; first + count <= freeSegments.size(); ++first)
+		{
+			const size_t last = first + static_cast<size_t>(count) - 1;
+			if (freeSegments[last] - freeSegments[first] != count - 1)
+				continue;
+
+			// The others are linked again, lowest first
+			h->freeList = 0;
+			for (size_t i = freeSegments.size(); i-- > 0;)
+			{
+				if (i >= first && i <= last)
+					continue;
+				segment(freeSegments[i])->nextFree = h->freeList;
+				h->freeList = freeSegments[i] + 1;
+			}
+			h->freeCount -= count;
+
+			const uint64_t index = freeSegments[first];
+			// The headers of the following segments are in the allocation now, which must be zero
+			for (uint64_t i = index + 1; i <= freeSegments[last]; ++i)
+				::memset(segment(i), 0, sizeof(segment_header));
+			*segment(index) = segment_header{.live = 0, .run = count, .nextFree = 0};
+			return index;
+		}
+	}
+
+	const uint64_t index = h->segmentCount;
+	if (!_mapping.resize(segment_offset(index + count)))
+		return {};
+
+	arena_header()->segmentCount += count;
+	*segment(index) = segment_header{.live = 0, .run = count, .nextFree = 0};
+	return index;
+}
+
+void file_arena::release_segments(uint64_t first) noexcept
+{
+	header* h = arena_header();
+	const uint64_t count = std::max<uint64_t>(segment(first)->run, 1);
+	const uint64_t start = segment_offset(first), length = count * h->segmentSize;
+	// Zeroed by hand where holes aren't supported, so that the memory handed out is always zero
+	if (!_mapping.backing_file().punch_hole(start, length))
+		::memset(_mapping.data() + start, 0, static_cast<size_t>(length));
+
+	for (uint64_t i = first; i < first + count; ++i)
+	{
+		*segment(i) = segment_header{.live = 0, .run = 0, .nextFree = h->freeList};
+		h->freeList = i + 1;
+		++h->freeCount;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "growable_mapping.hpp"
+
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+namespace thin_io {
+
+// A pointer into a file_arena: the offset of the object in the file, so it stays valid when the mapping moves and when
+// the file is reopened by another process. Resolved with file_arena::get().
+template <typename T>
+struct arena_ptr {
+	uint64_t offset = 0; // 0 is null
+
+	[[nodiscard]] explicit constexpr operator bool() const noexcept { return offset != 0; }
+	[[nodiscard]] constexpr bool operator==(const arena_ptr&) const noexcept = default;
+};
+
+struct file_arena_options {
+	// Unit of allocation from the file and of release back to it; rounded up to a multiple of 64 KiB.
+	// Only used when creating the file.
+	uint64_t segment_size = 1024 * 1024;
+	// The file is grown with truncate() by default: freed segments are holes anyway, and so is the unused space
+	growable_mapping_options mapping = {.reserve = uint64_t{1} << 30, .preallocate = false};
+};
+
+// Bump allocator over a file mapped into memory, for data structures larger than RAM that live on across restarts.
+// Objects are allocated one after another in fixed-size segments, and each segment counts the bytes still in use in it.
+// When a segment becomes empty, its space is returned to the file system (punch_hole) and the segment is reused.
+// Allocations larger than a segment get a run of segments of their own, made of free segments in a row if there are enough.
+//
+// The memory comes zeroed: it is never reused without being punched out first. T must be trivially copyable and
+// must not hold raw pointers to other objects in the arena, only arena_ptr.
+// Not thread-safe.
+class file_arena {
+public:
+	file_arena() noexcept = default;
+	inline ~file_arena() noexcept { close(); }
+
+	file_arena(file_arena&&) noexcept = default;
+	file_arena& operator=(file_arena&&) noexcept = default;
+
+	// Creates the file, or opens an existing arena with its objects
+	bool open(const char* path, const file_arena_options& options = {}) noexcept;
+	bool close() noexcept;
+	[[nodiscard]] inline bool is_open() const noexcept { return _mapping.is_open(); }
+
+	// Returns the offset of the new block, 0 on failure. align is at most 64.
+	[[nodiscard]] uint64_t allocate_bytes(uint64_t size, uint64_t align = alignof(max_align_t)) noexcept;
+	// size must be the one allocated
+	void deallocate_bytes(uint64_t offset, uint64_t size) noexcept;
+
+	template <typename T>
+	[[nodiscard]] inline arena_ptr<T> allocate(size_t count = 1) noexcept
+	{
+		static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 64);
+		return arena_ptr<T>{allocate_bytes(uint64_t{sizeof(T)} * count, alignof(T))};
+	}
+
+	template <typename T>
+	inline void deallocate(arena_ptr<T> p, size_t count = 1) noexcept
+	{
+		if (p)
+			deallocate_bytes(p.offset, uint64_t{sizeof(T)} * count);
+	}
+
+	// Valid until the next allocation, which may move the mapping
+	template <typename T>
+	[[nodiscard]] inline T* get(arena_ptr<T> p) noexcept
+	{
+		return p ? reinterpret_cast<T*>(_mapping.data() + p.offset) : nullptr;
+	}
+
+	template <typename T>
+	[[nodiscard]] inline arena_ptr<T> to_ptr(const T* address) const noexcept
+	{
+		return address ? arena_ptr<T>{static_cast<uint64_t>(reinterpret_cast<const std::byte*>(address) - _mapping.data())} : arena_ptr<T>{};
+	}
+
+	// The entry point of the data structure, found again when the file is reopened
+	void set_root(uint64_t offset) noexcept;
+	[[nodiscard]] uint64_t root() const noexcept;
+
+	template <typename T>
+	inline void set_root(arena_ptr<T> p) noexcept { set_root(p.offset); }
+	template <typename T>
+	[[nodiscard]] inline arena_ptr<T> root_as() const noexcept { return arena_ptr<T>{root()}; }
+
+	// Writes the dirty pages back to the file
+	bool flush(bool wait = true) noexcept;
+
+	[[nodiscard]] uint64_t segment_size() const noexcept;
+	// In the file, free ones included
+	[[nodiscard]] uint64_t segment_count() const noexcept;
+	[[nodiscard]] uint64_t free_segment_count() const noexcept;
+	// Allocated and not deallocated yet
+	[[nodiscard]] uint64_t live_bytes() const noexcept;
+
+	[[nodiscard]] inline growable_mapping& mapping() noexcept { return _mapping; }
+
+private:
+	struct header;
+	struct segment_header;
+
+	[[nodiscard]] header* arena_header() noexcept;
+	[[nodiscard]] const header* arena_header() const noexcept;
+	[[nodiscard]] segment_header* segment(uint64_t index) noexcept;
+	[[nodiscard]] uint64_t segment_offset(uint64_t index) const noexcept;
+
+	// A run of count segments, from the free list if it has that many in a row, otherwise from the end of the file. Returns its index.
+	[[nodiscard]] std::optional<uint64_t> take_segments(uint64_t count) noexcept;
+	void release_segments(uint64_t first) noexcept;
+
+private:
+	growable_mapping _mapping;
+};
+
+} // namespace thin_io
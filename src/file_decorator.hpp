@@ -0,0 +1,100 @@
+#pragma once
+#include "file.hpp"
+
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+namespace thin_io {
+
+// Base for the file_impl decorators: forwards every call to the wrapped Impl.
+// A decorator derives from it and declares only the calls it changes, which hide the base's ones. Everything is resolved
+// at compile time, so the layers stack with no virtual calls:
+//
+// using file_t = file_interface<instrumented<rate_limited<file_impl>>>;
+// file_t f; layer<rate_limited<file_impl>>(f.impl()).set_limiter(bucket);
+template <file_backend Impl>
+class file_decorator : public file_constants {
+public:
+	using native_handle_type = typename Impl::native_handle_type;
+	using inner_type = Impl;
+
+	[[nodiscard]] inline Impl& inner() noexcept { return _impl; }
+	[[nodiscard]] inline const Impl& inner() const noexcept { return _impl; }
+
+	inline bool open(const char* path, open_mode openMode, sys_cache_mode cacheMode, sharing_mode sharingMode) noexcept {
+		return _impl.open(path, openMode, cacheMode, sharingMode);
+	}
+
+	inline bool open_anonymous(const char* name, const anonymous_file_options& options) noexcept { return _impl.open_anonymous(name, options); }
+	inline bool add_seals(file_seal seals) noexcept { return _impl.add_seals(seals); }
+	[[nodiscard]] inline std::optional<file_seal> seals() const noexcept { return _impl.seals(); }
+
+	inline bool close() noexcept { return _impl.close(); }
+	[[nodiscard]] inline bool is_open() const noexcept { return _impl.is_open(); }
+	[[nodiscard]] inline native_handle_type native_handle() const noexcept { return _impl.native_handle(); }
+	inline bool attach(native_handle_type h) noexcept { return _impl.attach(h); }
+
+	inline std::optional<uint64_t> read(void* dest, uint64_t size) noexcept { return _impl.read(dest, size); }
+	inline std::optional<uint64_t> write(const void* src, uint64_t size) noexcept { return _impl.write(src, size); }
+	inline std::optional<uint64_t> pread(void* dest, uint64_t size, uint64_t pos) noexcept { return _impl.pread(dest, size, pos); }
+	inline std::optional<uint64_t> pwrite(const void* src, uint64_t size, uint64_t pos) noexcept { return _impl.pwrite(src, size, pos); }
+
+	[[nodiscard]] inline std::optional<uint64_t> pos() const noexcept { return _impl.pos(); }
+	inline bool set_pos(uint64_t newPos) noexcept { return _impl.set_pos(newPos); }
+	inline bool truncate(uint64_t newFileSize) noexcept { return _impl.truncate(newFileSize); }
+	inline bool preallocate(uint64_t offset, uint64_t length) noexcept { return _impl.preallocate(offset, length); }
+	inline bool set_sparse() noexcept { return _impl.set_sparse(); }
+	inline bool punch_hole(uint64_t offset, uint64_t length) noexcept { return _impl.punch_hole(offset, length); }
+
+	[[nodiscard]] inline bool fsync() noexcept { return _impl.fsync(); }
+	[[nodiscard]] inline bool fdatasync() noexcept { return _impl.fdatasync(); }
+
+	inline bool set_priority(io_priority priority) noexcept { return _impl.set_priority(priority); }
+	[[nodiscard]] inline io_priority priority() const noexcept { return _impl.priority(); }
+	static inline bool set_thread_priority(io_priority priority) noexcept { return Impl::set_thread_priority(priority); }
+	static inline io_priority override_thread_priority(io_priority priority) noexcept { return Impl::override_thread_priority(priority); }
+
+	[[nodiscard]] inline void* mmap(mmap_access_mode mode, uint64_t offset, uint64_t length) noexcept { return _impl.mmap(mode, offset, length); }
+	[[nodiscard]] inline bool unmap(void* mapAddress) noexcept { return _impl.unmap(mapAddress); }
+	inline bool flush(void* address, uint64_t length, mmap_flush_mode mode) noexcept { return _impl.flush(address, length, mode); }
+	inline bool lock(const void* address, uint64_t length) noexcept { return _impl.lock(address, length); }
+	inline bool unlock(const void* address, uint64_t length) noexcept { return _impl.unlock(address, length); }
+
+	[[nodiscard]] inline std::optional<file_extent> next_extent(uint64_t pos) noexcept { return _impl.next_extent(pos); }
+	[[nodiscard]] inline std::optional<file_layout> physical_layout() const noexcept { return _impl.physical_layout(); }
+
+	[[nodiscard]] inline std::optional<uint64_t> size() const noexcept { return _impl.size(); }
+	[[nodiscard]] inline bool at_end() const noexcept { return _impl.at_end(); }
+
+	static inline bool delete_file(const char* filePath) noexcept { return Impl::delete_file(filePath); }
+	[[nodiscard]] static inline auto error_code() noexcept { return Impl::error_code(); }
+	[[nodiscard]] static inline std::string text_for_error(decltype(Impl::error_code()) ec) noexcept { return Impl::text_for_error(ec); }
+
+protected:
+	// The result of a call as an optional byte count: the syncs' bool becomes 0 or nothing
+	template <typename Result>
+	[[nodiscard]] static inline std::optional<uint64_t> transferred(const Result& result) noexcept
+	{
+		if constexpr (std::is_same_v<Result, bool>)
+			return result ? std::optional<uint64_t>{0} : std::nullopt;
+		else
+			return result;
+	}
+
+protected:
+	Impl _impl;
+};
+
+// The Layer decorator in a stack of decorators, starting from (and including) impl
+template <class Layer, class Impl>
+[[nodiscard]] inline Layer& layer(Impl& impl) noexcept
+{
+	if constexpr (std::is_same_v<Layer, Impl>)
+		return impl;
+	else
+		return layer<Layer>(impl.inner());
+}
+
+} // namespace thin_io
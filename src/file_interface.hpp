@@ -1,7 +1,11 @@
 #pragma once
+#include <concepts>
+#include <iterator>
 #include <optional>
 #include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace thin_io {
 
@@ -10,9 +14,167 @@ struct file_constants {
 	enum class sys_cache_mode {CachingEnabled = 0, NoOsCaching = 1};
 	enum class sharing_mode {NoSharing = 0, ShareRead = 1, ShareWrite = 2, ShareDelete = 4, ShareExec = 8};
 	enum class mmap_access_mode {ReadOnly = 0, ReadWrite = 1};
+	enum class mmap_flush_mode {Async = 0, Sync = 1};
 };
 
+// I/O scheduling priority, see file_interface::set_priority().
+// Linux: the ioprio classes, honored by the BFQ and mq-deadline schedulers. RealTime needs CAP_SYS_ADMIN (or CAP_SYS_NICE).
+// Windows: Idle is the very low I/O priority hint, BestEffort levels 5-7 are low, everything else is normal.
+struct io_priority {
+	enum class priority_class : uint8_t {None = 0, RealTime = 1, BestEffort = 2, Idle = 3}; // Same values as IOPRIO_CLASS_*
+
+	priority_class cls = priority_class::None; // The default: derived from the CPU nice value on Linux
+	uint8_t level = 4; // RealTime and BestEffort: 0 (highest) to 7
+
+	[[nodiscard]] static constexpr io_priority realtime(uint8_t level = 4) noexcept { return {priority_class::RealTime, level}; }
+	[[nodiscard]] static constexpr io_priority best_effort(uint8_t level = 4) noexcept { return {priority_class::BestEffort, level}; }
+	[[nodiscard]] static constexpr io_priority idle() noexcept { return {priority_class::Idle, 0}; }
+
+	[[nodiscard]] constexpr bool is_default() const noexcept { return cls == priority_class::None; }
+	[[nodiscard]] constexpr bool operator==(const io_priority&) const noexcept = default;
+};
+
+// Restrictions that can be placed on an anonymous file, see file_interface::add_seals(). Same values as Linux F_SEAL_*.
+enum class file_seal : uint32_t {
+	None = 0,
+	Seal = 0x1, // No more seals can be added
+	Shrink = 0x2,
+	Grow = 0x4,
+	Write = 0x8, // No writes of any kind, including through mappings. Fails if there are writable mappings.
+	FutureWrite = 0x10, // No new writes, the existing writable mappings keep working
+};
+
+[[nodiscard]] constexpr file_seal operator|(file_seal a, file_seal b) noexcept {
+	return static_cast<file_seal>(static_cast<uint32_t>(a) | static_cast<uint32_t>(b));
+}
+
+[[nodiscard]] constexpr bool has_seal(file_seal seals, file_seal seal) noexcept {
+	return (static_cast<uint32_t>(seals) & static_cast<uint32_t>(seal)) == static_cast<uint32_t>(seal);
+}
+
+struct anonymous_file_options {
+	bool allow_sealing = true;
+	// Linux: backed by huge pages (MFD_HUGETLB). Such files can only be sized with truncate() and accessed with mmap().
+	bool huge_pages = false;
+};
+
+// A contiguous logical range of a file that is either backed by data or is a hole (reads as zeros)
+struct file_extent {
+	uint64_t offset = 0;
+	uint64_t length = 0;
+	bool is_hole = false;
+};
+
+// A piece of the file as laid out on the storage device
+struct physical_extent {
+	uint64_t logical = 0;
+	uint64_t physical = 0;
+	uint64_t length = 0;
+	uint32_t flags = 0; // OS-specific, FIEMAP_EXTENT_* on Linux
+};
+
+struct file_layout {
+	std::vector<physical_extent> extents;
+
+	// The number of places where logically adjacent extents are not physically adjacent, 0 for a contiguous file
+	[[nodiscard]] inline uint64_t fragment_count() const noexcept {
+		uint64_t n = 0;
+		for (size_t i = 1; i < extents.size(); ++i)
+		{
+			const auto& prev = extents[i - 1];
+			if (extents[i].physical != prev.physical + prev.length)
+				++n;
+		}
+		return n;
+	}
+
+	[[nodiscard]] inline uint64_t allocated_bytes() const noexcept {
+		uint64_t total = 0;
+		for (const auto& e : extents)
+			total += e.length;
+		return total;
+	}
+};
+
+// Walks the data and hole extents of a file, starting at the given offset
+template <class File>
+class extent_iterator {
+public:
+	using value_type = file_extent;
+	using difference_type = std::ptrdiff_t;
+
+	extent_iterator() noexcept = default;
+	inline extent_iterator(File& f, uint64_t from) noexcept : _file{&f} {
+		_current = _file->next_extent(from);
+	}
+
+	[[nodiscard]] inline const file_extent& operator*() const noexcept { return *_current; }
+	[[nodiscard]] inline const file_extent* operator->() const noexcept { return &*_current; }
+
+	inline extent_iterator& operator++() noexcept {
+		_current = _file->next_extent(_current->offset + _current->length);
+		return *this;
+	}
+
+	inline extent_iterator operator++(int) noexcept {
+		auto copy = *this;
+		++*this;
+		return copy;
+	}
+
+	// Iteration ends at EOF or on error
+	[[nodiscard]] inline bool operator==(std::default_sentinel_t) const noexcept { return !_current; }
+
+private:
+	File* _file = nullptr;
+	std::optional<file_extent> _current;
+};
+
+template <class File>
+struct extent_range {
+	File& file;
+	uint64_t from = 0;
+
+	[[nodiscard]] inline extent_iterator<File> begin() const noexcept { return {file, from}; }
+	[[nodiscard]] inline std::default_sentinel_t end() const noexcept { return {}; }
+};
+
+// What file_interface needs from an implementation: file_impl, or a decorator stacked on top of one (see file_decorator.hpp).
+// The optional calls (preallocate, set_sparse, punch_hole, priorities, extents) are only required when used.
 template <class Impl>
+concept file_backend = std::default_initializable<Impl> && std::movable<Impl> && requires(Impl& f, const Impl& cf,
+	typename Impl::native_handle_type handle, void* dest, const void* src, uint64_t n, const char* path,
+	file_constants::open_mode openMode, file_constants::sys_cache_mode cacheMode, file_constants::sharing_mode sharingMode,
+	file_constants::mmap_access_mode mmapMode)
+{
+	{ f.open(path, openMode, cacheMode, sharingMode) } -> std::same_as<bool>;
+	{ f.close() } -> std::same_as<bool>;
+	{ cf.is_open() } -> std::same_as<bool>;
+	{ cf.native_handle() } -> std::same_as<typename Impl::native_handle_type>;
+	{ f.attach(handle) } -> std::same_as<bool>;
+
+	{ f.read(dest, n) } -> std::same_as<std::optional<uint64_t>>;
+	{ f.write(src, n) } -> std::same_as<std::optional<uint64_t>>;
+	{ f.pread(dest, n, n) } -> std::same_as<std::optional<uint64_t>>;
+	{ f.pwrite(src, n, n) } -> std::same_as<std::optional<uint64_t>>;
+
+	{ cf.pos() } -> std::same_as<std::optional<uint64_t>>;
+	{ f.set_pos(n) } -> std::same_as<bool>;
+	{ f.truncate(n) } -> std::same_as<bool>;
+	{ f.fsync() } -> std::same_as<bool>;
+	{ f.fdatasync() } -> std::same_as<bool>;
+
+	{ f.mmap(mmapMode, n, n) } -> std::same_as<void*>;
+	{ f.unmap(dest) } -> std::same_as<bool>;
+
+	{ cf.size() } -> std::same_as<std::optional<uint64_t>>;
+	{ cf.at_end() } -> std::same_as<bool>;
+
+	{ Impl::delete_file(path) } -> std::same_as<bool>;
+	{ Impl::text_for_error(Impl::error_code()) } -> std::same_as<std::string>;
+};
+
+template <file_backend Impl>
 class [[nodiscard]] file_interface final : public file_constants {
 public:
 	inline bool open(const char* path,
@@ -35,6 +197,26 @@ public:
 		return f;
 	}
 
+	// A file with no path that goes away when its last handle is closed.
+	// Linux: memfd_create(), the name is only shown in /proc/<pid>/fd. The descriptor can be passed to another process
+	// (SCM_RIGHTS or fork) and mapped there. Other POSIX: an unlinked temporary file.
+	// Windows: a temporary file opened with FILE_FLAG_DELETE_ON_CLOSE; huge pages and seals are not supported.
+	[[nodiscard]] inline static file_interface create_anonymous(const char* name, const anonymous_file_options& options = {}) noexcept
+	{
+		file_interface<Impl> f;
+		f._impl.open_anonymous(name, options);
+		return f;
+	}
+
+	// Linux only, for files created with allow_sealing. Seals cannot be removed.
+	inline bool add_seals(file_seal seals) noexcept {
+		return _impl.add_seals(seals);
+	}
+
+	[[nodiscard]] inline std::optional<file_seal> seals() const noexcept {
+		return _impl.seals();
+	}
+
 	[[nodiscard]] inline bool is_open() const noexcept {
 		return _impl.is_open();
 	}
@@ -43,6 +225,16 @@ public:
 		return is_open();
 	}
 
+	// File descriptor on POSIX, HANDLE on Windows. Still owned by this object.
+	[[nodiscard]] inline auto native_handle() const noexcept {
+		return _impl.native_handle();
+	}
+
+	// Takes ownership of an already open native handle, closing the currently open file (if any)
+	inline bool attach(decltype(std::declval<const Impl&>().native_handle()) h) noexcept {
+		return _impl.attach(h);
+	}
+
 	[[nodiscard]] inline bool close() noexcept {
 		return _impl.close();
 	}
@@ -85,6 +277,24 @@ public:
 		return _impl.truncate(newFileSize);
 	}
 
+	// Allocates disk space for the range so that writing it cannot fail with "out of space" and does not fragment the file.
+	// The file is extended if the range goes past its end.
+	inline bool preallocate(uint64_t offset, uint64_t length) noexcept {
+		return _impl.preallocate(offset, length);
+	}
+
+	// Windows: marks the file as sparse, otherwise skipped ranges and punched holes still occupy disk space.
+	// POSIX: no-op.
+	inline bool set_sparse() noexcept {
+		return _impl.set_sparse();
+	}
+
+	// Deallocates the range, which then reads as zeros. The file size is not changed.
+	// The filesystem may only free whole blocks and zero the partial blocks at the edges.
+	inline bool punch_hole(uint64_t offset, uint64_t length) noexcept {
+		return _impl.punch_hole(offset, length);
+	}
+
 	[[nodiscard]] inline bool fsync() noexcept {
 		return _impl.fsync();
 	}
@@ -93,6 +303,30 @@ public:
 		return _impl.fdatasync();
 	}
 
+	// The I/O scheduling priority of this file's reads, writes and syncs. False if not supported or the value is invalid.
+	// Linux / POSIX: applied to the calling thread with ioprio_set() before each operation, only when it differs from the
+	// thread's current priority. Windows: set on the handle (FileIoPriorityHintInfo).
+	inline bool set_priority(io_priority priority) noexcept {
+		return _impl.set_priority(priority);
+	}
+
+	// POSIX only
+	[[nodiscard]] inline io_priority priority() const noexcept {
+		return _impl.priority();
+	}
+
+	// The priority of the calling thread's operations on files that have no priority of their own.
+	// Windows: only Idle makes a difference (background mode, which also lowers the thread's CPU priority).
+	static bool set_thread_priority(io_priority priority) noexcept {
+		return Impl::set_thread_priority(priority);
+	}
+
+	// Takes precedence over the files' priorities for the calling thread until reset with io_priority{}.
+	// Returns the previous override.
+	static io_priority override_thread_priority(io_priority priority) noexcept {
+		return Impl::override_thread_priority(priority);
+	}
+
 	[[nodiscard]] inline void* mmap(mmap_access_mode mode, uint64_t offset, uint64_t length) noexcept {
 		return _impl.mmap(mode, offset, length);
 	}
@@ -101,6 +335,41 @@ public:
 		return _impl.unmap(mapAddress);
 	}
 
+	// Writes the modified pages of a range mapped from this file back to it, the range being widened to whole pages.
+	// Async only starts the writeback, Sync returns once the data is on the device.
+	inline bool flush(void* address, uint64_t length, mmap_flush_mode mode = mmap_flush_mode::Sync) noexcept {
+		return _impl.flush(address, length, mode);
+	}
+
+	// Keeps the pages of a mapped range in RAM. Linux: mlock2(MLOCK_ONFAULT), the pages are locked as they are touched
+	// rather than all read now. Limited by RLIMIT_MEMLOCK on POSIX, by the working set size on Windows.
+	inline bool lock(const void* address, uint64_t length) noexcept {
+		return _impl.lock(address, length);
+	}
+
+	inline bool unlock(const void* address, uint64_t length) noexcept {
+		return _impl.unlock(address, length);
+	}
+
+	// Returns the data or hole extent that contains pos, or nothing at EOF or on error.
+	// !!!
+	// Linux / POSIX: the file position is altered (SEEK_DATA / SEEK_HOLE)
+	// !!!
+	[[nodiscard]] inline std::optional<file_extent> next_extent(uint64_t pos) noexcept {
+		return _impl.next_extent(pos);
+	}
+
+	// for (const file_extent& e : f.extents()) { if (!e.is_hole) ... }
+	[[nodiscard]] inline extent_range<file_interface> extents(uint64_t from = 0) noexcept {
+		return {*this, from};
+	}
+
+	// Where the file lives on the device (FIEMAP on Linux, retrieval pointers on Windows).
+	// Nothing if the filesystem or the OS does not support the query.
+	[[nodiscard]] inline std::optional<file_layout> physical_layout() const noexcept {
+		return _impl.physical_layout();
+	}
+
 	// Negative value means an error querying the size
 	[[nodiscard]] inline std::optional<uint64_t> size() const noexcept {
 		return _impl.size();
@@ -129,6 +398,15 @@ public:
 		return Impl::text_for_error(error_code());
 	}
 
+	// The implementation object, for configuring decorators (see rate_limited)
+	[[nodiscard]] inline Impl& impl() noexcept {
+		return _impl;
+	}
+
+	[[nodiscard]] inline const Impl& impl() const noexcept {
+		return _impl;
+	}
+
 private:
 	Impl _impl;
 };
@@ -9,7 +9,34 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 #include <algorithm>
+#include <stdlib.h> // getenv, mkstemp
+#include <utility>
+
+// USDT probes for perf / bpftrace / SystemTap, provider "thin_io". A probe is a single nop until a tracer attaches to it.
+// Every call has a <name>_entry and a <name>_return probe. Arguments: fd, then offset and size where applicable;
+// the return probes add the result: bytes transferred (-1 on failure), the fsync return value or the mapping address (null on failure).
+// open_entry / open_return carry the path, then the flags / the new fd.
+// E.g. bpftrace -e 'usdt:./app:thin_io:pread_return { @[arg2] = hist(arg3); }'
+#if defined __linux__ && __has_include(<sys/sdt.h>) && !defined THIN_IO_NO_PROBES
+#include <sys/sdt.h>
+#define THIN_IO_PROBE1(name, a1) STAP_PROBE1(thin_io, name, a1)
+#define THIN_IO_PROBE2(name, a1, a2) STAP_PROBE2(thin_io, name, a1, a2)
+#define THIN_IO_PROBE3(name, a1, a2, a3) STAP_PROBE3(thin_io, name, a1, a2, a3)
+#define THIN_IO_PROBE4(name, a1, a2, a3, a4) STAP_PROBE4(thin_io, name, a1, a2, a3, a4)
+#else
+#define THIN_IO_PROBE1(name, a1)
+#define THIN_IO_PROBE2(name, a1, a2)
+#define THIN_IO_PROBE3(name, a1, a2, a3)
+#define THIN_IO_PROBE4(name, a1, a2, a3, a4)
+#endif
 
 #ifdef __APPLE__
 #define O_LARGEFILE 0 // Not needed
@@ -24,8 +51,94 @@ using off64_t = off_t;
 
 using namespace thin_io;
 
+#if defined __linux__ && !defined F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010 // Linux 5.1
+#endif
 
-bool file_impl::open(const char *path, open_mode openMode, sys_cache_mode cacheMode, sharing_mode /*sharingMode*/) noexcept
+#ifdef __linux__
+static_assert(static_cast<int>(file_seal::Seal) == F_SEAL_SEAL && static_cast<int>(file_seal::Shrink) == F_SEAL_SHRINK
+	&& static_cast<int>(file_seal::Grow) == F_SEAL_GROW && static_cast<int>(file_seal::Write) == F_SEAL_WRITE
+	&& static_cast<int>(file_seal::FutureWrite) == F_SEAL_FUTURE_WRITE);
+#endif
+
+namespace {
+
+#ifdef __linux__
+// Not using <linux/ioprio.h>, older kernel headers do not have it
+constexpr int ioprio_class_shift = 13;
+constexpr int ioprio_who_process = 1;
+
+[[nodiscard]] constexpr int to_ioprio(io_priority p) noexcept
+{
+	return (static_cast<int>(p.cls) << ioprio_class_shift) | (p.cls == io_priority::priority_class::Idle ? 0 : p.level);
+}
+#endif
+
+[[nodiscard]] constexpr bool is_valid(io_priority p) noexcept
+{
+	return p.cls <= io_priority::priority_class::Idle && p.level <= 7;
+}
+
+// ioprio_set() is a system call: the value currently applied to the thread is cached, and only changed when an operation
+// needs a different one
+struct thread_io_priority {
+	io_priority override;
+	io_priority baseline; // set_thread_priority()
+	int applied = -1; // -1 until first changed
+	int inherited = 0; // What the thread had before the first change
+	int refused = -1; // The last value the kernel refused (RealTime without the capability), not retried
+};
+
+thread_local thread_io_priority tl_ioPriority;
+
+void apply_io_priority(io_priority filePriority) noexcept
+{
+#ifdef __linux__
+	auto& t = tl_ioPriority;
+	const io_priority wanted = !t.override.is_default() ? t.override : (!filePriority.is_default() ? filePriority : t.baseline);
+	if (wanted.is_default() && t.applied == -1) [[likely]]
+		return; // Nobody has changed anything on this thread
+
+	if (t.applied == -1)
+	{
+		const int current = static_cast<int>(::syscall(SYS_ioprio_get, ioprio_who_process, 0));
+		t.inherited = current >= 0 ? current : 0;
+		t.applied = t.inherited;
+	}
+
+	const int value = wanted.is_default() ? t.inherited : to_ioprio(wanted);
+	if (value == t.applied || value == t.refused)
+		return;
+
+	const int savedErrno = errno;
+	if (::syscall(SYS_ioprio_set, ioprio_who_process, 0, value) == 0)
+		t.applied = value;
+	else
+		t.refused = value;
+	errno = savedErrno;
+#else
+	(void)filePriority;
+#endif
+}
+
+[[nodiscard]] uint64_t page_size() noexcept
+{
+	static const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGE_SIZE));
+	return pageSize;
+}
+
+// The whole pages that contain [address, address + length), as msync() and mlock() want them
+[[nodiscard]] std::pair<void*, size_t> page_range(const void* address, uint64_t length) noexcept
+{
+	const uintptr_t start = reinterpret_cast<uintptr_t>(address) / page_size() * page_size();
+	const uintptr_t end = reinterpret_cast<uintptr_t>(address) + length;
+	return {reinterpret_cast<void*>(start), static_cast<size_t>(end - start)};
+}
+
+} // namespace
+
+
+file_impl::open_parameters file_impl::open_parameters_for(open_mode openMode, sys_cache_mode cacheMode) noexcept
 {
 	int flags = 0;
 	switch (openMode) {
@@ -43,10 +156,14 @@ bool file_impl::open(const char *path, open_mode openMode, sys_cache_mode cacheM
 #ifdef __linux__
 	if (cacheMode == sys_cache_mode::NoOsCaching) [[unlikely]]
 		flags |= O_DIRECT;
+#else
+	(void)cacheMode;
 #endif
 
+	flags |= O_LARGEFILE;
+
 	// The mneaning if sharingMode mode flag is not the same as the Linux access mode. Ignoring sharing flags.
-	int access = O_LARGEFILE;
+	unsigned access = 0;
 	if ((flags & O_CREAT) != 0) // The access parameter is ignored unless O_CREAT is specified
 	{
 		access |= (S_IRUSR | S_IRGRP | S_IROTH);
@@ -54,7 +171,14 @@ bool file_impl::open(const char *path, open_mode openMode, sys_cache_mode cacheM
 		access |= (S_IXUSR | S_IXGRP | S_IXOTH);
 	}
 
-	_fd = ::open(path, flags, access);
+	return {flags, access};
+}
+
+bool file_impl::open(const char *path, open_mode openMode, sys_cache_mode cacheMode, sharing_mode /*sharingMode*/) noexcept
+{
+	const auto params = open_parameters_for(openMode, cacheMode);
+	THIN_IO_PROBE2(open_entry, path, params.flags);
+	_fd = ::open(path, params.flags, params.mode);
 
 #ifdef __APPLE__
 	if (cacheMode == sys_cache_mode::NoOsCaching && is_open()) [[unlikely]]
@@ -64,6 +188,80 @@ bool file_impl::open(const char *path, open_mode openMode, sys_cache_mode cacheM
 	}
 #endif
 
+	THIN_IO_PROBE2(open_return, path, _fd);
+	return is_open();
+}
+
+bool file_impl::open_anonymous(const char* name, const anonymous_file_options& options) noexcept
+{
+	if (is_open() && !close())
+		return false;
+
+	if (!name)
+		name = "";
+
+#ifdef __linux__
+	unsigned flags = MFD_CLOEXEC;
+	if (options.allow_sealing)
+		flags |= MFD_ALLOW_SEALING;
+	if (options.huge_pages)
+		flags |= MFD_HUGETLB;
+
+	_fd = ::memfd_create(name, flags);
+#else
+	if (options.huge_pages)
+	{
+		errno = EINVAL;
+		return false;
+	}
+
+	// Name collisions are taken care of by mkstemp(). The name must not add directories to the template.
+	std::string fileName = name;
+	std::replace(fileName.begin(), fileName.end(), '/', '_');
+	const char* tmpDir = ::getenv("TMPDIR");
+	std::string path = std::string{tmpDir && *tmpDir ? tmpDir : "/tmp"} + "/thin_io-" + fileName + "-XXXXXX";
+	_fd = ::mkstemp(path.data());
+	if (_fd != -1)
+	{
+		::unlink(path.c_str());
+		::fcntl(_fd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	return is_open();
+}
+
+bool file_impl::add_seals(file_seal seals) noexcept
+{
+#ifdef __linux__
+	return ::fcntl(_fd, F_ADD_SEALS, static_cast<int>(seals)) == 0;
+#else
+	(void)seals;
+	errno = EINVAL;
+	return false;
+#endif
+}
+
+std::optional<file_seal> file_impl::seals() const noexcept
+{
+#ifdef __linux__
+	const int seals = ::fcntl(_fd, F_GET_SEALS);
+	if (seals == -1)
+		return {};
+
+	return static_cast<file_seal>(seals);
+#else
+	errno = EINVAL;
+	return {};
+#endif
+}
+
+bool file_impl::attach(native_handle_type fd) noexcept
+{
+	if (is_open() && !close())
+		return false;
+
+	_fd = fd;
 	return is_open();
 }
 
@@ -71,6 +269,7 @@ bool file_impl::close() noexcept
 {
 	for (const auto& mapping: _memoryMappings)
 		::munmap(mapping.addr, mapping.length);
+	_memoryMappings.clear();
 
 	if (is_open() && ::close(_fd) == 0)
 	{
@@ -82,25 +281,37 @@ bool file_impl::close() noexcept
 
 std::optional<uint64_t> file_impl::read(void *dest, uint64_t size) noexcept
 {
+	apply_io_priority(_priority);
+	THIN_IO_PROBE2(read_entry, _fd, size);
 	ssize_t bytesRead = ::read(_fd, dest, size);
+	THIN_IO_PROBE3(read_return, _fd, size, bytesRead);
 	return bytesRead >= 0 ? static_cast<uint64_t>(bytesRead) : std::optional<uint64_t>{};
 }
 
 std::optional<uint64_t> file_impl::write(const void *src, uint64_t size) noexcept
 {
+	apply_io_priority(_priority);
+	THIN_IO_PROBE2(write_entry, _fd, size);
 	const ssize_t bytesWritten = ::write(_fd, src, size);
+	THIN_IO_PROBE3(write_return, _fd, size, bytesWritten);
 	return bytesWritten >= 0 ? static_cast<uint64_t>(bytesWritten) : std::optional<uint64_t>{};
 }
 
 std::optional<uint64_t> file_impl::pread(void *dest, uint64_t size, uint64_t pos) noexcept
 {
+	apply_io_priority(_priority);
+	THIN_IO_PROBE3(pread_entry, _fd, pos, size);
 	const ssize_t bytesRead = ::pread64(_fd, dest, size, static_cast<off64_t>(pos));
+	THIN_IO_PROBE4(pread_return, _fd, pos, size, bytesRead);
 	return bytesRead >= 0 ? static_cast<uint64_t>(bytesRead) : std::optional<uint64_t>{};
 }
 
 std::optional<uint64_t> file_impl::pwrite(const void *src, uint64_t size, uint64_t pos) noexcept
 {
+	apply_io_priority(_priority);
+	THIN_IO_PROBE3(pwrite_entry, _fd, pos, size);
 	const ssize_t bytesWritten = ::pwrite64(_fd, src, size, static_cast<off64_t>(pos));
+	THIN_IO_PROBE4(pwrite_return, _fd, pos, size, bytesWritten);
 	return bytesWritten >= 0 ? static_cast<uint64_t>(bytesWritten) : std::optional<uint64_t>{};
 }
 
@@ -112,6 +323,81 @@ std::optional<uint64_t> file_impl::size() const noexcept
 	return {};
 }
 
+std::optional<file_extent> file_impl::next_extent(uint64_t pos) noexcept
+{
+	const auto fileSize = size();
+	if (!fileSize || pos >= *fileSize)
+		return {};
+
+#ifdef SEEK_DATA
+	const off64_t dataStart = ::lseek64(_fd, static_cast<off64_t>(pos), SEEK_DATA);
+	if (dataStart < 0)
+	{
+		// ENXIO: no more data past pos, the rest of the file is a hole
+		if (errno == ENXIO)
+			return file_extent{.offset = pos, .length = *fileSize - pos, .is_hole = true};
+		return {};
+	}
+
+	if (static_cast<uint64_t>(dataStart) > pos)
+		return file_extent{.offset = pos, .length = static_cast<uint64_t>(dataStart) - pos, .is_hole = true};
+
+	// There is always an implicit hole at EOF, so SEEK_HOLE cannot fail with ENXIO here
+	const off64_t holeStart = ::lseek64(_fd, dataStart, SEEK_HOLE);
+	if (holeStart < 0) [[unlikely]]
+		return {};
+
+	return file_extent{.offset = pos, .length = static_cast<uint64_t>(holeStart) - pos, .is_hole = false};
+#else
+	// No sparse file support - everything is data
+	return file_extent{.offset = pos, .length = *fileSize - pos, .is_hole = false};
+#endif
+}
+
+std::optional<file_layout> file_impl::physical_layout() const noexcept
+{
+#ifdef __linux__
+	static constexpr uint32_t batchSize = 256;
+	// uint64_t storage for the correct alignment of the variable-length request structure
+	std::vector<uint64_t> storage((sizeof(struct fiemap) + batchSize * sizeof(struct fiemap_extent)) / sizeof(uint64_t));
+	auto* request = reinterpret_cast<struct fiemap*>(storage.data());
+
+	file_layout layout;
+	uint64_t start = 0;
+	for (;;)
+	{
+		::memset(request, 0, sizeof(struct fiemap));
+		request->fm_start = start;
+		request->fm_length = FIEMAP_MAX_OFFSET - start;
+		request->fm_flags = FIEMAP_FLAG_SYNC; // Flush delayed allocations first, or they are not reported
+		request->fm_extent_count = batchSize;
+
+		if (::ioctl(_fd, FS_IOC_FIEMAP, request) != 0)
+			return {};
+
+		const uint32_t n = request->fm_mapped_extents;
+		if (n == 0)
+			break;
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const auto& e = request->fm_extents[i];
+			layout.extents.push_back(physical_extent{.logical = e.fe_logical, .physical = e.fe_physical, .length = e.fe_length, .flags = e.fe_flags});
+		}
+
+		const auto& last = request->fm_extents[n - 1];
+		if ((last.fe_flags & FIEMAP_EXTENT_LAST) != 0)
+			break;
+
+		start = last.fe_logical + last.fe_length;
+	}
+
+	return layout;
+#else
+	return {};
+#endif
+}
+
 std::optional<uint64_t> file_impl::pos() const noexcept
 {
 	const off64_t pos = ::lseek64(_fd, 0, SEEK_CUR);
@@ -130,45 +416,136 @@ bool file_impl::truncate(uint64_t newFileSize) noexcept
 	return ::ftruncate64(_fd, static_cast<off64_t>(newFileSize)) == 0;
 }
 
+bool file_impl::preallocate(uint64_t offset, uint64_t length) noexcept
+{
+#ifdef __linux__
+	return ::fallocate64(_fd, 0, static_cast<off64_t>(offset), static_cast<off64_t>(length)) == 0;
+#elif defined(F_PREALLOCATE)
+	const auto currentSize = size();
+	if (!currentSize)
+		return false;
+
+	const uint64_t end = offset + length;
+	if (end <= *currentSize)
+		return true;
+
+	// Try for a contiguous allocation first
+	fstore_t store{.fst_flags = F_ALLOCATECONTIG | F_ALLOCATEALL, .fst_posmode = F_PEOFPOSMODE, .fst_offset = 0, .fst_length = static_cast<off_t>(end - *currentSize), .fst_bytesalloc = 0};
+	if (::fcntl(_fd, F_PREALLOCATE, &store) == -1)
+	{
+		store.fst_flags = F_ALLOCATEALL;
+		if (::fcntl(_fd, F_PREALLOCATE, &store) == -1)
+			return false;
+	}
+
+	return ::ftruncate64(_fd, static_cast<off64_t>(end)) == 0;
+#else
+	return ::posix_fallocate(_fd, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0;
+#endif
+}
+
+bool file_impl::set_sparse() noexcept
+{
+	return is_open();
+}
+
+bool file_impl::punch_hole(uint64_t offset, uint64_t length) noexcept
+{
+#ifdef __linux__
+	return ::fallocate64(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off64_t>(offset), static_cast<off64_t>(length)) == 0;
+#elif defined(F_PUNCHHOLE)
+	fpunchhole_t args{.fp_flags = 0, .reserved = 0, .fp_offset = static_cast<off_t>(offset), .fp_length = static_cast<off_t>(length)};
+	return ::fcntl(_fd, F_PUNCHHOLE, &args) != -1;
+#else
+	return false;
+#endif
+}
+
 bool file_impl::fsync() noexcept
 {
+	apply_io_priority(_priority);
+	THIN_IO_PROBE1(fsync_entry, _fd);
 #ifndef __APPLE__
-	return ::fsync(_fd) == 0;
+	const int result = ::fsync(_fd);
 #else
-	return ::fcntl(_fd, F_FULLFSYNC, 0) != -1;
+	const int result = ::fcntl(_fd, F_FULLFSYNC, 0) != -1 ? 0 : -1;
 #endif
+	THIN_IO_PROBE2(fsync_return, _fd, result);
+	return result == 0;
 }
 
 bool file_impl::fdatasync() noexcept
 {
+	apply_io_priority(_priority);
 #ifndef __APPLE__
-	return ::fdatasync(_fd) == 0;
+	THIN_IO_PROBE1(fdatasync_entry, _fd);
+	const int result = ::fdatasync(_fd);
+	THIN_IO_PROBE2(fdatasync_return, _fd, result);
+	return result == 0;
 #else
 	return fsync();
 #endif
 }
 
+bool file_impl::set_priority(io_priority priority) noexcept
+{
+#ifdef __linux__
+	if (!is_valid(priority))
+		return false;
+
+	_priority = priority;
+	return true;
+#else
+	return priority.is_default();
+#endif
+}
+
+bool file_impl::set_thread_priority(io_priority priority) noexcept
+{
+#ifdef __linux__
+	if (!is_valid(priority))
+		return false;
+
+	tl_ioPriority.baseline = priority;
+	apply_io_priority({});
+	return priority.is_default() || tl_ioPriority.applied == to_ioprio(priority);
+#else
+	return priority.is_default();
+#endif
+}
+
+io_priority file_impl::override_thread_priority(io_priority priority) noexcept
+{
+	const io_priority previous = tl_ioPriority.override;
+	if (is_valid(priority))
+		tl_ioPriority.override = priority;
+	return previous;
+}
+
 void* file_impl::mmap(mmap_access_mode mode, const uint64_t offset, const uint64_t length) noexcept
 {
 	// Offset must be a multiple of page size!
 	auto actualOffset = offset;
 	if (offset != 0) [[unlikely]]
 	{
-		// Query only once
-		static const uint64_t pageSize = (uint64_t)::sysconf(_SC_PAGE_SIZE);
-		const auto nPages = offset / pageSize;
-		actualOffset = nPages * pageSize; // Find the closest suitable lower offset
+		const auto nPages = offset / page_size();
+		actualOffset = nPages * page_size(); // Find the closest suitable lower offset
 	}
 
 	const auto offsetDiff = offset - actualOffset;
 	const int protectFlag = mode == mmap_access_mode::ReadOnly ? PROT_READ : (PROT_READ | PROT_WRITE);
+	THIN_IO_PROBE3(mmap_entry, _fd, offset, length);
 	void* addr = ::mmap(nullptr, length + offsetDiff, protectFlag, MAP_SHARED, _fd, static_cast<off_t>(actualOffset));
 	if (addr == MAP_FAILED) [[unlikely]]
+	{
+		THIN_IO_PROBE4(mmap_return, _fd, offset, length, static_cast<void*>(nullptr));
 		return nullptr;
+	}
 
 	auto* userAddress = reinterpret_cast<std::byte*>(addr) + offsetDiff;
 	_memoryMappings.push_back(Mapping{.addr = addr, .userAddr = userAddress, .length = length + offsetDiff});
 
+	THIN_IO_PROBE4(mmap_return, _fd, offset, length, userAddress);
 	return userAddress;
 }
 
@@ -190,6 +567,32 @@ bool file_impl::unmap(void* mapAddress) noexcept
 	return false;
 }
 
+bool file_impl::flush(void* address, uint64_t length, mmap_flush_mode mode) noexcept
+{
+	const auto [start, size] = page_range(address, length);
+	return ::msync(start, size, mode == mmap_flush_mode::Sync ? MS_SYNC : MS_ASYNC) == 0;
+}
+
+bool file_impl::lock(const void* address, uint64_t length) noexcept
+{
+	const auto [start, size] = page_range(address, length);
+#if defined __linux__ && defined SYS_mlock2
+	// Linux 4.4. Through syscall(): glibc only has a wrapper since 2.27.
+	constexpr unsigned int mlock_onfault = 1; // MLOCK_ONFAULT
+	if (::syscall(SYS_mlock2, start, size, mlock_onfault) == 0)
+		return true;
+	else if (errno != ENOSYS && errno != EINVAL)
+		return false;
+#endif
+	return ::mlock(start, size) == 0;
+}
+
+bool file_impl::unlock(const void* address, uint64_t length) noexcept
+{
+	const auto [start, size] = page_range(address, length);
+	return ::munlock(start, size) == 0;
+}
+
 bool file_impl::at_end() const noexcept
 {
 	return pos() == size();
@@ -7,6 +7,8 @@ namespace thin_io {
 
 class [[nodiscard]] file_impl final : public file_constants {
 public:
+	using native_handle_type = int;
+
 	file_impl() noexcept = default;
 	inline file_impl(file_impl&& other) noexcept;
 	inline ~file_impl() noexcept;
@@ -17,11 +19,26 @@ public:
 			  sys_cache_mode cacheMode,
 			  sharing_mode sharingMode) noexcept;
 
+	bool open_anonymous(const char* name, const anonymous_file_options& options) noexcept;
+	bool add_seals(file_seal seals) noexcept;
+	[[nodiscard]] std::optional<file_seal> seals() const noexcept;
+
 	// Does not check if the handle was open, returns false if it wasn't
 	bool close() noexcept;
 
 	[[nodiscard]] inline bool is_open() const noexcept;
 
+	[[nodiscard]] inline native_handle_type native_handle() const noexcept;
+	// Takes ownership of an open file descriptor, closing the current one
+	bool attach(native_handle_type fd) noexcept;
+
+	// The flags and the mode for ::open() / openat()
+	struct open_parameters {
+		int flags;
+		unsigned mode;
+	};
+	[[nodiscard]] static open_parameters open_parameters_for(open_mode openMode, sys_cache_mode cacheMode) noexcept;
+
 	std::optional<uint64_t> read(void* dest, uint64_t size) noexcept;
 	std::optional<uint64_t> write(const void* src, uint64_t size) noexcept;
 
@@ -36,12 +53,31 @@ public:
 	// This function also sets file position to the end
 	bool truncate(uint64_t newFileSize) noexcept;
 
+	// Allocates disk space for the range, extending the file if necessary
+	bool preallocate(uint64_t offset, uint64_t length) noexcept;
+
+	// Allows the file to have holes. Always succeeds on POSIX where this is not an attribute of a file.
+	bool set_sparse() noexcept;
+	// Deallocates the range, which then reads as zeros. The file size is not changed.
+	bool punch_hole(uint64_t offset, uint64_t length) noexcept;
+
 	[[nodiscard]] bool fsync() noexcept;
 	[[nodiscard]] bool fdatasync() noexcept;
 
+	bool set_priority(io_priority priority) noexcept;
+	[[nodiscard]] inline io_priority priority() const noexcept { return _priority; }
+	static bool set_thread_priority(io_priority priority) noexcept;
+	static io_priority override_thread_priority(io_priority priority) noexcept;
+
 	[[nodiscard]] void* mmap(mmap_access_mode mode, uint64_t offset, uint64_t length) noexcept;
 	[[nodiscard]] bool unmap(void* mapAddress) noexcept;
+	bool flush(void* address, uint64_t length, mmap_flush_mode mode) noexcept;
+	bool lock(const void* address, uint64_t length) noexcept;
+	bool unlock(const void* address, uint64_t length) noexcept;
+
 
+	[[nodiscard]] std::optional<file_extent> next_extent(uint64_t pos) noexcept;
+	[[nodiscard]] std::optional<file_layout> physical_layout() const noexcept;
 
 	[[nodiscard]] std::optional<uint64_t> size() const noexcept;
 	[[nodiscard]] bool at_end() const noexcept;
@@ -60,9 +96,11 @@ private:
 
 	std::vector<Mapping> _memoryMappings;
 	int _fd = -1;
+	io_priority _priority;
 };
 
-inline file_impl::file_impl(file_impl &&other) noexcept : _fd{other._fd} {
+inline file_impl::file_impl(file_impl &&other) noexcept : _memoryMappings{std::move(other._memoryMappings)}, _fd{other._fd}, _priority{other._priority} {
+	other._memoryMappings.clear();
 	other._fd = -1;
 }
 
@@ -74,7 +112,10 @@ inline file_impl::~file_impl() noexcept
 inline file_impl& file_impl::operator=(file_impl&& other) noexcept
 {
 	close();
+	_memoryMappings = std::move(other._memoryMappings);
+	other._memoryMappings.clear();
 	_fd = other._fd;
+	_priority = other._priority;
 	other._fd = -1;
 	return *this;
 }
@@ -84,4 +125,9 @@ inline bool file_impl::is_open() const noexcept
 	return _fd != -1;
 }
 
+inline file_impl::native_handle_type file_impl::native_handle() const noexcept
+{
+	return _fd;
+}
+
 }
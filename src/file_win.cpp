@@ -5,8 +5,9 @@ ENABLE_ENUM_ARITHMETIC(thin_io::file_constants::open_mode);
 ENABLE_ENUM_ARITHMETIC(thin_io::file_constants::sharing_mode);
 
 #include <assert.h>
-#include <string.h> // memcpy
+#include <string.h> // memcpy, strchr
 #include <Windows.h>
+#include <winioctl.h>
 
 using namespace thin_io;
 
@@ -36,6 +37,24 @@ static inline void to_wide_unc_path(const char* str, WCHAR(&wCharArray)[N])
 	}
 }
 
+[[nodiscard]] static uint64_t volume_cluster_size(HANDLE h) noexcept
+{
+	WCHAR filePath[32768];
+	const DWORD pathLength = ::GetFinalPathNameByHandleW(h, filePath, static_cast<DWORD>(std::size(filePath)), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+	if (pathLength == 0 || pathLength >= std::size(filePath))
+		return 0;
+
+	WCHAR volumePath[32768];
+	if (!::GetVolumePathNameW(filePath, volumePath, static_cast<DWORD>(std::size(volumePath))))
+		return 0;
+
+	DWORD sectorsPerCluster = 0, bytesPerSector = 0, freeClusters = 0, totalClusters = 0;
+	if (!::GetDiskFreeSpaceW(volumePath, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters))
+		return 0;
+
+	return static_cast<uint64_t>(sectorsPerCluster) * bytesPerSector;
+}
+
 #if !(defined(THIN_IO_WANT_FDATASYNC) && THIN_IO_WANT_FDATASYNC == 0)
 struct IO_STATUS_BLOCK {
 	union {
@@ -119,11 +138,76 @@ bool file_impl::open(const char *path, open_mode openMode, sys_cache_mode cacheM
 	return is_open();
 }
 
+bool file_impl::open_anonymous(const char* name, const anonymous_file_options& options) noexcept
+{
+	if (is_open() && !close())
+		return false;
+
+	if (options.huge_pages)
+	{
+		::SetLastError(ERROR_NOT_SUPPORTED);
+		return false;
+	}
+
+	WCHAR tempDir[MAX_PATH + 1];
+	const DWORD tempDirLength = ::GetTempPathW(static_cast<DWORD>(std::size(tempDir)), tempDir);
+	if (tempDirLength == 0 || tempDirLength > MAX_PATH)
+		return false;
+
+	WCHAR prefix[4] {L"tio"}; // GetTempFileNameW() only uses the first 3 characters
+	for (size_t i = 0; i < 3 && name && name[i]; ++i)
+	{
+		// Not a path separator or another character that can't be in a file name
+		const auto c = static_cast<unsigned char>(name[i]);
+		prefix[i] = c < 0x20 || ::strchr("\\/:*?\"<>|", c) ? L'_' : static_cast<WCHAR>(c);
+	}
+
+	WCHAR path[MAX_PATH + 1];
+	if (::GetTempFileNameW(tempDir, prefix, 0, path) == 0)
+		return false;
+
+	// Temporary: kept in the cache rather than written out if there is enough memory
+	_h = ::CreateFileW(path,
+					   GENERIC_READ | GENERIC_WRITE,
+					   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+					   nullptr,
+					   CREATE_ALWAYS,
+					   FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+					   nullptr);
+
+	if (!is_open())
+		::DeleteFileW(path);
+
+	return is_open();
+}
+
+bool file_impl::add_seals(file_seal /*seals*/) noexcept
+{
+	::SetLastError(ERROR_NOT_SUPPORTED);
+	return false;
+}
+
+std::optional<file_seal> file_impl::seals() const noexcept
+{
+	::SetLastError(ERROR_NOT_SUPPORTED);
+	return {};
+}
+
+bool file_impl::attach(native_handle_type h) noexcept
+{
+	if (is_open() && !close())
+		return false;
+
+	_h = h;
+	return is_open();
+}
+
 bool file_impl::close() noexcept
 {
 	// Unmap memory before closing the file
 	for (const auto& mapping : _memoryMappings)
 		do_unmap(mapping);
+	_memoryMappings.clear();
 
 	if (is_open() && ::CloseHandle(_h) != 0)
 	{
@@ -183,6 +267,86 @@ std::optional<uint64_t> file_impl::size() const noexcept
 			static_cast<uint64_t>(li.QuadPart): std::optional<uint64_t>{};
 }
 
+std::optional<file_extent> file_impl::next_extent(uint64_t pos) noexcept
+{
+	const auto fileSize = size();
+	if (!fileSize || pos >= *fileSize)
+		return {};
+
+	FILE_ALLOCATED_RANGE_BUFFER query;
+	query.FileOffset.QuadPart = static_cast<LONGLONG>(pos);
+	query.Length.QuadPart = static_cast<LONGLONG>(*fileSize - pos);
+
+	// Only the first allocated range is needed, ERROR_MORE_DATA is expected
+	FILE_ALLOCATED_RANGE_BUFFER range;
+	DWORD bytesReturned = 0;
+	if (!::DeviceIoControl(_h, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), &range, sizeof(range), &bytesReturned, nullptr) && ::GetLastError() != ERROR_MORE_DATA)
+		return {};
+
+	if (bytesReturned < sizeof(range))
+		return file_extent{.offset = pos, .length = *fileSize - pos, .is_hole = true};
+
+	const auto rangeStart = static_cast<uint64_t>(range.FileOffset.QuadPart);
+	if (rangeStart > pos)
+		return file_extent{.offset = pos, .length = rangeStart - pos, .is_hole = true};
+
+	const auto rangeEnd = (std::min)(rangeStart + static_cast<uint64_t>(range.Length.QuadPart), *fileSize);
+	return file_extent{.offset = pos, .length = rangeEnd - pos, .is_hole = false};
+}
+
+std::optional<file_layout> file_impl::physical_layout() const noexcept
+{
+	const uint64_t clusterSize = volume_cluster_size(_h);
+	if (clusterSize == 0)
+		return {};
+
+	static constexpr size_t batchSize = 256;
+	// LARGE_INTEGER storage for the correct alignment of the variable-length output structure
+	std::vector<LARGE_INTEGER> storage((sizeof(RETRIEVAL_POINTERS_BUFFER) + batchSize * 2 * sizeof(LARGE_INTEGER)) / sizeof(LARGE_INTEGER));
+	auto* pointers = reinterpret_cast<RETRIEVAL_POINTERS_BUFFER*>(storage.data());
+	const auto outputSize = static_cast<DWORD>(storage.size() * sizeof(LARGE_INTEGER));
+
+	STARTING_VCN_INPUT_BUFFER input;
+	input.StartingVcn.QuadPart = 0;
+
+	file_layout layout;
+	for (;;)
+	{
+		DWORD bytesReturned = 0;
+		const BOOL done = ::DeviceIoControl(_h, FSCTL_GET_RETRIEVAL_POINTERS, &input, sizeof(input), pointers, outputSize, &bytesReturned, nullptr);
+		if (!done)
+		{
+			const DWORD ec = ::GetLastError();
+			if (ec == ERROR_HANDLE_EOF) // Empty file or the data is resident in the MFT
+				break;
+			else if (ec != ERROR_MORE_DATA)
+				return {};
+		}
+
+		LONGLONG vcn = pointers->StartingVcn.QuadPart;
+		for (DWORD i = 0; i < pointers->ExtentCount; ++i)
+		{
+			const auto& e = pointers->Extents[i];
+			if (e.Lcn.QuadPart != -1) // -1 is a sparse or a compressed range with no clusters allocated
+			{
+				layout.extents.push_back(physical_extent{
+					.logical = static_cast<uint64_t>(vcn) * clusterSize,
+					.physical = static_cast<uint64_t>(e.Lcn.QuadPart) * clusterSize,
+					.length = static_cast<uint64_t>(e.NextVcn.QuadPart - vcn) * clusterSize
+				});
+			}
+			vcn = e.NextVcn.QuadPart;
+		}
+
+		if (done)
+			break;
+
+		input.StartingVcn.QuadPart = vcn;
+	}
+
+	return layout;
+}
+
 std::optional<uint64_t> file_impl::pos() const noexcept
 {
 	LARGE_INTEGER offset = {0};
@@ -206,6 +370,45 @@ bool file_impl::truncate(uint64_t newFileSize) noexcept
 	return ::SetFileInformationByHandle(_h, FileEndOfFileInfo, &eof, sizeof(eof)) != 0;
 }
 
+bool file_impl::preallocate(uint64_t offset, uint64_t length) noexcept
+{
+	const auto currentSize = size();
+	if (!currentSize)
+		return false;
+
+	const uint64_t end = offset + length;
+	if (end <= *currentSize)
+		return true;
+
+	FILE_ALLOCATION_INFO allocation;
+	allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(end);
+	if (!::SetFileInformationByHandle(_h, FileAllocationInfo, &allocation, sizeof(allocation)))
+		return false;
+
+	return truncate(end);
+}
+
+bool file_impl::set_sparse() noexcept
+{
+	FILE_SET_SPARSE_BUFFER sparse;
+	sparse.SetSparse = TRUE;
+	DWORD bytesReturned = 0;
+	return ::DeviceIoControl(_h, FSCTL_SET_SPARSE, &sparse, sizeof(sparse), nullptr, 0, &bytesReturned, nullptr) != 0;
+}
+
+bool file_impl::punch_hole(uint64_t offset, uint64_t length) noexcept
+{
+	// Without the sparse attribute the zeroed range stays allocated
+	if (!set_sparse()) [[unlikely]]
+		return false;
+
+	FILE_ZERO_DATA_INFORMATION zeroData;
+	zeroData.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+	zeroData.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + length);
+	DWORD bytesReturned = 0;
+	return ::DeviceIoControl(_h, FSCTL_SET_ZERO_DATA, &zeroData, sizeof(zeroData), nullptr, 0, &bytesReturned, nullptr) != 0;
+}
+
 bool file_impl::fsync() noexcept
 {
 	return ::FlushFileBuffers(_h) != 0;
@@ -227,6 +430,66 @@ bool file_impl::fdatasync() noexcept
 #endif
 }
 
+bool file_impl::set_priority(io_priority priority) noexcept
+{
+	FILE_IO_PRIORITY_HINT_INFO info;
+	switch (priority.cls) {
+	case io_priority::priority_class::Idle:
+		info.PriorityHint = IoPriorityHintVeryLow;
+		break;
+	case io_priority::priority_class::BestEffort:
+		info.PriorityHint = priority.level >= 5 ? IoPriorityHintLow : IoPriorityHintNormal;
+		break;
+	default:
+		info.PriorityHint = IoPriorityHintNormal; // High is reserved for the system
+		break;
+	}
+
+	return ::SetFileInformationByHandle(_h, FileIoPriorityHintInfo, &info, sizeof(info)) != 0;
+}
+
+namespace {
+
+// Background mode is the only per-thread I/O priority, and it cannot be entered or left twice
+struct thread_io_priority {
+	io_priority override;
+	io_priority baseline;
+	bool background = false;
+};
+
+thread_local thread_io_priority tl_ioPriority;
+
+bool apply_thread_priority() noexcept
+{
+	auto& t = tl_ioPriority;
+	const io_priority& effective = !t.override.is_default() ? t.override : t.baseline;
+	const bool background = effective.cls == io_priority::priority_class::Idle;
+	if (background == t.background)
+		return true;
+
+	if (!::SetThreadPriority(::GetCurrentThread(), background ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END))
+		return false;
+
+	t.background = background;
+	return true;
+}
+
+}
+
+bool file_impl::set_thread_priority(io_priority priority) noexcept
+{
+	tl_ioPriority.baseline = priority;
+	return apply_thread_priority();
+}
+
+io_priority file_impl::override_thread_priority(io_priority priority) noexcept
+{
+	const io_priority previous = tl_ioPriority.override;
+	tl_ioPriority.override = priority;
+	apply_thread_priority();
+	return previous;
+}
+
 void* file_impl::mmap(mmap_access_mode mode, uint64_t offset, uint64_t length) noexcept
 {
 	uint64_t actualOffset = offset;
@@ -338,6 +601,25 @@ bool file_impl::delete_file(const char *filePath) noexcept
 	return ::DeleteFileW(wPath) != 0;
 }
 
+bool file_impl::flush(void* address, uint64_t length, mmap_flush_mode mode) noexcept
+{
+	// FlushViewOfFile() only starts writing the pages, FlushFileBuffers() waits for the data to reach the device
+	if (!::FlushViewOfFile(address, static_cast<SIZE_T>(length)))
+		return false;
+	return mode == mmap_flush_mode::Async || ::FlushFileBuffers(_h) != 0;
+}
+
+bool file_impl::lock(const void* address, uint64_t length) noexcept
+{
+	// Whole pages: VirtualLock() rounds the range itself
+	return ::VirtualLock(const_cast<void*>(address), static_cast<SIZE_T>(length)) != 0;
+}
+
+bool file_impl::unlock(const void* address, uint64_t length) noexcept
+{
+	return ::VirtualUnlock(const_cast<void*>(address), static_cast<SIZE_T>(length)) != 0;
+}
+
 bool file_impl::do_unmap(const Mapping& mapping) noexcept
 {
 	const BOOL success = ::UnmapViewOfFile(mapping.addr) && ::CloseHandle(mapping.handle);
@@ -0,0 +1,107 @@
+#include "growable_mapping.hpp"
+
+#include <algorithm>
+#include <utility>
+
+using namespace thin_io;
+
+growable_mapping::growable_mapping(growable_mapping&& other) noexcept :
+	_file{std::move(other._file)},
+	_data{std::exchange(other._data, nullptr)},
+	_size{std::exchange(other._size, 0)},
+	_capacity{std::exchange(other._capacity, 0)},
+	_moves{std::exchange(other._moves, 0)},
+	_preallocate{other._preallocate}
+{}
+
+growable_mapping& growable_mapping::operator=(growable_mapping&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		_file = std::move(other._file);
+		_data = std::exchange(other._data, nullptr);
+		_size = std::exchange(other._size, 0);
+		_capacity = std::exchange(other._capacity, 0);
+		_moves = std::exchange(other._moves, 0);
+		_preallocate = other._preallocate;
+	}
+	return *this;
+}
+
+bool growable_mapping::open(const char* path, const growable_mapping_options& options) noexcept
+{
+	if (is_open())
+		close();
+
+	file f = file::open_file(path, file::open_mode::ReadWrite);
+	if (!f)
+		return false;
+
+	const auto fileSize = f.size();
+	if (!fileSize)
+		return false;
+
+	_file = std::move(f);
+	_size = *fileSize;
+	_moves = 0;
+	_preallocate = options.preallocate;
+
+	const uint64_t g = granularity();
+	if (!map_view((std::max({options.reserve, _size, uint64_t{1}}) + g - 1) / g * g))
+	{
+		(void)_file.close();
+		_size = 0;
+		return false;
+	}
+	return true;
+}
+
+bool growable_mapping::close() noexcept
+{
+	if (!is_open())
+		return false;
+
+	unmap_view();
+	_data = nullptr;
+	_size = 0;
+	_capacity = 0;
+	return _file.close();
+}
+
+bool growable_mapping::resize(uint64_t newSize) noexcept
+{
+	if (!is_open())
+		return false;
+
+	if (newSize > _capacity)
+	{
+		const uint64_t g = granularity();
+		const std::byte* previous = _data;
+		if (!remap_view(std::max((newSize + g - 1) / g * g, 2 * _capacity)))
+			return false;
+		if (_data != previous)
+			++_moves;
+	}
+
+	if (!resize_file(newSize))
+		return false;
+
+	_size = newSize;
+	return true;
+}
+
+bool growable_mapping::flush(uint64_t offset, uint64_t length, bool wait) noexcept
+{
+	if (!is_open() || offset >= _size)
+		return false;
+
+	const uint64_t end = std::min(offset + length, _size);
+	return _file.flush(_data + offset, end - offset, wait ? file::mmap_flush_mode::Sync : file::mmap_flush_mode::Async);
+}
+
+std::byte* growable_mapping::extend(uint64_t n) noexcept
+{
+	const uint64_t previousSize = _size;
+	return resize(previousSize + n) ? _data + previousSize : nullptr;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "file.hpp"
+
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thin_io {
+
+struct growable_mapping_options {
+	// Address space mapped up front. Growing within it only extends the file; growing past it may move the mapping.
+	uint64_t reserve = uint64_t{1} << 30;
+	// Grow the file with preallocate() rather than truncate(), so that writing through the mapping can't fail for lack of space.
+	// Falls back to truncate() where the filesystem doesn't support preallocation.
+	bool preallocate = true;
+};
+
+// A read-write mapping of a whole file that grows and shrinks with it, for files appended to through memory.
+// POSIX: the file is mapped past its end over the reserved range, so growing within it only extends the file and data()
+// stays put. Past the reservation, the mapping is extended in place when the following address space is free (mremap on
+// Linux), otherwise it moves and the reservation doubles.
+// Windows: a view can't extend past the end of the file, so the file is grown to the view's size and trimmed on close();
+// the view doubles when full, which may move it.
+class growable_mapping {
+public:
+	growable_mapping() noexcept = default;
+	inline ~growable_mapping() noexcept { close(); }
+
+	growable_mapping(growable_mapping&& other) noexcept;
+	growable_mapping& operator=(growable_mapping&& other) noexcept;
+
+	// Opens or creates the file, mapping its current contents
+	bool open(const char* path, const growable_mapping_options& options = {}) noexcept;
+	bool close() noexcept;
+	[[nodiscard]] inline bool is_open() const noexcept { return _data != nullptr; }
+
+	[[nodiscard]] inline std::byte* data() noexcept { return _data; }
+	[[nodiscard]] inline const std::byte* data() const noexcept { return _data; }
+	[[nodiscard]] inline std::span<std::byte> bytes() noexcept { return {_data, static_cast<size_t>(_size)}; }
+
+	// Of the file, the valid part of data()
+	[[nodiscard]] inline uint64_t size() const noexcept { return _size; }
+	// Address space mapped, size() can grow up to it without moving data()
+	[[nodiscard]] inline uint64_t capacity() const noexcept { return _capacity; }
+	// How many times the mapping has moved: pointers into data() must be recomputed when it changes
+	[[nodiscard]] inline uint64_t moves() const noexcept { return _moves; }
+
+	// Shrinking discards the end of the file
+	bool resize(uint64_t newSize) noexcept;
+	// Grows by n bytes, returns the address of the first new one or nullptr on failure
+	[[nodiscard]] std::byte* extend(uint64_t n) noexcept;
+
+	// Writes the dirty pages of [offset, offset + length) back to the file. wait: returns once they are on the device,
+	// otherwise only schedules the writeback.
+	bool flush(uint64_t offset, uint64_t length, bool wait = true) noexcept;
+
+	// For fsync() and the like
+	[[nodiscard]] inline file& backing_file() noexcept { return _file; }
+
+private:
+	// Platform-specific
+	[[nodiscard]] static uint64_t granularity() noexcept;
+	bool map_view(uint64_t capacity) noexcept;
+	bool remap_view(uint64_t capacity) noexcept;
+	void unmap_view() noexcept;
+	bool resize_file(uint64_t newSize) noexcept;
+
+private:
+	file _file;
+	std::byte* _data = nullptr;
+	uint64_t _size = 0;
+	uint64_t _capacity = 0;
+	uint64_t _moves = 0;
+	bool _preallocate = true;
+};
+
+} // namespace thin_io
@@ -0,0 +1,76 @@
+#include "growable_mapping.hpp"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace thin_io;
+
+uint64_t growable_mapping::granularity() noexcept
+{
+	static const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGE_SIZE));
+	return pageSize;
+}
+
+// Mapped directly rather than with file::mmap(): the mapping is resized behind its back.
+// Past the end of the file, the pages are there but can't be touched (SIGBUS) until the file grows.
+bool growable_mapping::map_view(uint64_t capacity) noexcept
+{
+	void* addr = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _file.native_handle(), 0);
+	if (addr == MAP_FAILED)
+		return false;
+
+	_data = static_cast<std::byte*>(addr);
+	_capacity = capacity;
+	return true;
+}
+
+bool growable_mapping::remap_view(uint64_t capacity) noexcept
+{
+#ifdef __linux__
+	void* addr = ::mremap(_data, _capacity, capacity, 0); // In place
+	if (addr == MAP_FAILED)
+		addr = ::mremap(_data, _capacity, capacity, MREMAP_MAYMOVE);
+	if (addr == MAP_FAILED)
+		return false;
+#else
+	// Mapping the rest of the file right after the current mapping if that address space is free, elsewhere otherwise
+	std::byte* tail = _data + _capacity;
+	void* extension = ::mmap(tail, capacity - _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _file.native_handle(), static_cast<off_t>(_capacity));
+	if (extension == tail)
+	{
+		_capacity = capacity;
+		return true;
+	}
+	if (extension != MAP_FAILED)
+		::munmap(extension, capacity - _capacity);
+
+	void* addr = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _file.native_handle(), 0);
+	if (addr == MAP_FAILED)
+		return false;
+	::munmap(_data, _capacity);
+#endif
+
+	_data = static_cast<std::byte*>(addr);
+	_capacity = capacity;
+	return true;
+}
+
+void growable_mapping::unmap_view() noexcept
+{
+	::munmap(_data, _capacity);
+}
+
+bool growable_mapping::resize_file(uint64_t newSize) noexcept
+{
+	if (newSize > _size && _preallocate)
+	{
+		if (_file.preallocate(_size, newSize - _size))
+			return true;
+		// Not supported by the filesystem or the kernel: growing the file sparse instead
+		const int ec = file::error_code();
+		if (ec != EOPNOTSUPP && ec != ENOSYS)
+			return false;
+	}
+	return _file.truncate(newSize);
+}
@@ -0,0 +1,65 @@
+#include "growable_mapping.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <Windows.h>
+
+using namespace thin_io;
+
+uint64_t growable_mapping::granularity() noexcept
+{
+	static const uint64_t allocationGranularity = [] {
+		SYSTEM_INFO info;
+		::GetSystemInfo(&info);
+		return static_cast<uint64_t>(info.dwAllocationGranularity);
+	}();
+	return allocationGranularity;
+}
+
+// The reservation is not used: mapping the view extends the file to its size, so it starts at the size of the file
+bool growable_mapping::map_view(uint64_t /*capacity*/) noexcept
+{
+	const uint64_t g = granularity();
+	const uint64_t capacity = std::max((_size + g - 1) / g * g, g);
+	void* addr = _file.mmap(file::mmap_access_mode::ReadWrite, 0, capacity);
+	if (addr == nullptr)
+		return false;
+
+	_data = static_cast<std::byte*>(addr);
+	_capacity = capacity;
+	return true;
+}
+
+bool growable_mapping::remap_view(uint64_t capacity) noexcept
+{
+	if (!_file.unmap(_data))
+		return false;
+
+	void* addr = _file.mmap(file::mmap_access_mode::ReadWrite, 0, capacity);
+	if (addr == nullptr)
+	{
+		// Restoring the previous view
+		addr = _file.mmap(file::mmap_access_mode::ReadWrite, 0, _capacity);
+		_data = static_cast<std::byte*>(addr);
+		return false;
+	}
+
+	_data = static_cast<std::byte*>(addr);
+	_capacity = capacity;
+	return true;
+}
+
+void growable_mapping::unmap_view() noexcept
+{
+	// Trimming the file to its logical size
+	if (_file.unmap(_data))
+		_file.truncate(_size);
+}
+
+bool growable_mapping::resize_file(uint64_t newSize) noexcept
+{
+	// The file is already as large as the view. Shrunk for real on close(), zeroed meanwhile like on POSIX.
+	if (newSize < _size)
+		::memset(_data + newSize, 0, static_cast<size_t>(_size - newSize));
+	return true;
+}
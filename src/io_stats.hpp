@@ -0,0 +1,291 @@
+#pragma once
+#include "file_decorator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+namespace thin_io {
+
+// The file_impl calls that are measured
+enum class file_op : uint8_t {Read, Write, Pread, Pwrite, Fsync, Fdatasync};
+inline constexpr size_t file_op_count = 6;
+
+[[nodiscard]] constexpr const char* file_op_name(file_op op) noexcept
+{
+	constexpr const char* names[file_op_count] {"read", "write", "pread", "pwrite", "fsync", "fdatasync"};
+	return names[static_cast<size_t>(op)];
+}
+
+// Log-linear buckets as in HdrHistogram: values below 2^sub_bucket_bits are exact, above that every power of 2
+// is divided into 2^sub_bucket_bits buckets, so a value is known to within 1/8 (12.5%) over the whole 64 bit range.
+struct histogram_buckets {
+	static constexpr unsigned sub_bucket_bits = 3;
+	static constexpr size_t sub_buckets = size_t{1} << sub_bucket_bits;
+	static constexpr size_t count = sub_buckets + (64 - sub_bucket_bits) * sub_buckets;
+
+	[[nodiscard]] static constexpr size_t index(uint64_t value) noexcept
+	{
+		if (value < sub_buckets)
+			return static_cast<size_t>(value);
+
+		const unsigned shift = static_cast<unsigned>(std::bit_width(value)) - 1 - sub_bucket_bits;
+		return (shift + 1) * sub_buckets + static_cast<size_t>((value >> shift) & (sub_buckets - 1));
+	}
+
+	// The largest value that falls into the bucket
+	[[nodiscard]] static constexpr uint64_t upper_bound(size_t index) noexcept
+	{
+		if (index < sub_buckets)
+			return index;
+
+		const unsigned shift = static_cast<unsigned>(index / sub_buckets) - 1;
+		const uint64_t first = (sub_buckets + index % sub_buckets) << shift;
+		return first + ((uint64_t{1} << shift) - 1);
+	}
+};
+
+struct histogram_snapshot {
+	std::array<uint64_t, histogram_buckets::count> counts {};
+	uint64_t total = 0;
+	uint64_t sum = 0;
+
+	// The value below which the fraction p (0 to 1) of the recorded values fall, rounded up to the bucket's bound
+	[[nodiscard]] inline uint64_t percentile(double p) const noexcept
+	{
+		if (total == 0)
+			return 0;
+
+		const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::clamp(p, 0.0, 1.0) * static_cast<double>(total) + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+				return histogram_buckets::upper_bound(i);
+		}
+		return max();
+	}
+
+	[[nodiscard]] inline uint64_t max() const noexcept
+	{
+		for (size_t i = counts.size(); i-- > 0; )
+		{
+			if (counts[i] != 0)
+				return histogram_buckets::upper_bound(i);
+		}
+		return 0;
+	}
+
+	[[nodiscard]] inline double mean() const noexcept
+	{
+		return total != 0 ? static_cast<double>(sum) / static_cast<double>(total) : 0.0;
+	}
+
+	inline histogram_snapshot& operator+=(const histogram_snapshot& other) noexcept
+	{
+		for (size_t i = 0; i < counts.size(); ++i)
+			counts[i] += other.counts[i];
+		total += other.total;
+		sum += other.sum;
+		return *this;
+	}
+};
+
+// Lock-free: recording is two relaxed atomic increments and an add, any number of threads at once.
+// A snapshot taken while values are being recorded may be off by the values in flight.
+class latency_histogram {
+public:
+	inline void record(uint64_t value) noexcept
+	{
+		_counts[histogram_buckets::index(value)].fetch_add(1, std::memory_order_relaxed);
+		_total.fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] inline histogram_snapshot snapshot() const noexcept
+	{
+		histogram_snapshot s;
+		for (size_t i = 0; i < _counts.size(); ++i)
+			s.counts[i] = _counts[i].load(std::memory_order_relaxed);
+		s.total = _total.load(std::memory_order_relaxed);
+		s.sum = _sum.load(std::memory_order_relaxed);
+		return s;
+	}
+
+	inline void reset() noexcept
+	{
+		for (auto& c : _counts)
+			c.store(0, std::memory_order_relaxed);
+		_total.store(0, std::memory_order_relaxed);
+		_sum.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::array<std::atomic<uint64_t>, histogram_buckets::count> _counts {};
+	std::atomic<uint64_t> _total{0};
+	std::atomic<uint64_t> _sum{0};
+};
+
+struct op_stats_snapshot {
+	uint64_t ops = 0;
+	uint64_t bytes = 0;
+	uint64_t errors = 0;
+	uint64_t short_transfers = 0; // Fewer bytes than requested, including reads at EOF
+	histogram_snapshot latency_ns;
+
+	inline op_stats_snapshot& operator+=(const op_stats_snapshot& other) noexcept
+	{
+		ops += other.ops;
+		bytes += other.bytes;
+		errors += other.errors;
+		short_transfers += other.short_transfers;
+		latency_ns += other.latency_ns;
+		return *this;
+	}
+};
+
+struct io_stats_snapshot {
+	std::array<op_stats_snapshot, file_op_count> ops;
+
+	[[nodiscard]] inline const op_stats_snapshot& operator[](file_op op) const noexcept { return ops[static_cast<size_t>(op)]; }
+};
+
+// Counters and latency histograms for every file_op
+class io_stats {
+public:
+	inline void record(file_op op, uint64_t requested, std::optional<uint64_t> transferred, std::chrono::nanoseconds latency) noexcept
+	{
+		auto& s = _ops[static_cast<size_t>(op)];
+		s.ops.fetch_add(1, std::memory_order_relaxed);
+		if (!transferred)
+			s.errors.fetch_add(1, std::memory_order_relaxed);
+		else
+		{
+			s.bytes.fetch_add(*transferred, std::memory_order_relaxed);
+			if (*transferred < requested)
+				s.short_transfers.fetch_add(1, std::memory_order_relaxed);
+		}
+		s.latency.record(static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)));
+	}
+
+	[[nodiscard]] inline io_stats_snapshot snapshot() const noexcept
+	{
+		io_stats_snapshot result;
+		for (size_t i = 0; i < file_op_count; ++i)
+		{
+			auto& r = result.ops[i];
+			const auto& s = _ops[i];
+			r.ops = s.ops.load(std::memory_order_relaxed);
+			r.bytes = s.bytes.load(std::memory_order_relaxed);
+			r.errors = s.errors.load(std::memory_order_relaxed);
+			r.short_transfers = s.short_transfers.load(std::memory_order_relaxed);
+			r.latency_ns = s.latency.snapshot();
+		}
+		return result;
+	}
+
+	inline void reset() noexcept
+	{
+		for (auto& s : _ops)
+		{
+			s.ops.store(0, std::memory_order_relaxed);
+			s.bytes.store(0, std::memory_order_relaxed);
+			s.errors.store(0, std::memory_order_relaxed);
+			s.short_transfers.store(0, std::memory_order_relaxed);
+			s.latency.reset();
+		}
+	}
+
+private:
+	struct op_counters {
+		std::atomic<uint64_t> ops{0};
+		std::atomic<uint64_t> bytes{0};
+		std::atomic<uint64_t> errors{0};
+		std::atomic<uint64_t> short_transfers{0};
+		latency_histogram latency;
+	};
+
+	std::array<op_counters, file_op_count> _ops;
+};
+
+// Every instrumented file of the process records here as well as in its own stats
+[[nodiscard]] inline io_stats& global_io_stats() noexcept
+{
+	static io_stats stats;
+	return stats;
+}
+
+// file_impl decorator that records every read, write and sync into the file's io_stats and global_io_stats().
+// Costs two clock reads and a handful of relaxed atomic increments per call.
+template <file_backend Impl>
+class [[nodiscard]] instrumented final : public file_decorator<Impl> {
+public:
+	instrumented() noexcept : _stats{std::make_unique<io_stats>()} {}
+
+	// The file's own counters, since it was created
+	[[nodiscard]] inline io_stats_snapshot stats() const noexcept { return _stats ? _stats->snapshot() : io_stats_snapshot{}; }
+	inline void reset_stats() noexcept { if (_stats) _stats->reset(); }
+
+	inline std::optional<uint64_t> read(void* dest, uint64_t size) noexcept {
+		return measure(file_op::Read, size, [&] { return this->_impl.read(dest, size); });
+	}
+
+	inline std::optional<uint64_t> write(const void* src, uint64_t size) noexcept {
+		return measure(file_op::Write, size, [&] { return this->_impl.write(src, size); });
+	}
+
+	inline std::optional<uint64_t> pread(void* dest, uint64_t size, uint64_t pos) noexcept {
+		return measure(file_op::Pread, size, [&] { return this->_impl.pread(dest, size, pos); });
+	}
+
+	inline std::optional<uint64_t> pwrite(const void* src, uint64_t size, uint64_t pos) noexcept {
+		return measure(file_op::Pwrite, size, [&] { return this->_impl.pwrite(src, size, pos); });
+	}
+
+	[[nodiscard]] inline bool fsync() noexcept {
+		return measure(file_op::Fsync, 0, [this] { return this->_impl.fsync(); });
+	}
+
+	[[nodiscard]] inline bool fdatasync() noexcept {
+		return measure(file_op::Fdatasync, 0, [this] { return this->_impl.fdatasync(); });
+	}
+
+private:
+	template <typename Op>
+	inline auto measure(file_op op, uint64_t requested, Op&& call) noexcept
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const auto result = call();
+		const auto latency = std::chrono::steady_clock::now() - start;
+
+		const auto transferred = this->transferred(result);
+		if (_stats)
+			_stats->record(op, requested, transferred, latency);
+		global_io_stats().record(op, requested, transferred, latency);
+		return result;
+	}
+
+private:
+	std::unique_ptr<io_stats> _stats; // Separate allocation: the histograms are a few tens of KiB
+};
+
+#ifdef THIN_IO_STATS
+inline constexpr bool io_stats_enabled = true;
+#else
+inline constexpr bool io_stats_enabled = false;
+#endif
+
+// instrumented<Impl> when enabled, otherwise Impl itself with no trace of the instrumentation.
+// E.g. using file = file_interface<with_stats<file_impl>>; and build with THIN_IO_STATS defined to turn the statistics on.
+template <file_backend Impl, bool enabled = io_stats_enabled>
+using with_stats = std::conditional_t<enabled, instrumented<Impl>, Impl>;
+
+} // namespace thin_io
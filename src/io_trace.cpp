@@ -0,0 +1,242 @@
+#include "io_trace.hpp"
+#include "file.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+
+using namespace thin_io;
+
+namespace {
+
+struct ring_registry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<detail::trace_ring>> rings;
+	uint32_t nextThread = 0;
+};
+
+ring_registry& registry() noexcept
+{
+	static ring_registry r;
+	return r;
+}
+
+// Retires the thread's ring when the thread exits, so that threads coming and going don't add up rings
+struct ring_owner {
+	detail::trace_ring* ring = nullptr;
+
+	~ring_owner() noexcept
+	{
+		if (!ring)
+			return;
+
+		auto& r = registry();
+		std::lock_guard lock{r.mutex};
+		ring->retired = true;
+		detail::tl_trace_ring = nullptr;
+	}
+};
+
+thread_local ring_owner tl_ringOwner;
+
+struct binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+	uint64_t count;
+};
+
+constexpr char binary_magic[8] {'T', 'I', 'O', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t binary_version = 1;
+
+// A single call transfers at most 0x7ffff000 bytes on Linux
+bool write_all(file& f, const void* data, uint64_t size) noexcept
+{
+	const auto* bytes = static_cast<const std::byte*>(data);
+	for (uint64_t done = 0; done < size;)
+	{
+		const auto n = f.write(bytes + done, size - done);
+		if (!n || *n == 0)
+			return false;
+		done += *n;
+	}
+	return true;
+}
+
+bool read_all(file& f, void* data, uint64_t size) noexcept
+{
+	auto* bytes = static_cast<std::byte*>(data);
+	for (uint64_t done = 0; done < size;)
+	{
+		const auto n = f.read(bytes + done, size - done);
+		if (!n || *n == 0)
+			return false;
+		done += *n;
+	}
+	return true;
+}
+
+} // namespace
+
+void io_trace::start(size_t eventsPerThread) noexcept
+{
+	_ringCapacity.store(std::bit_ceil(std::max<size_t>(eventsPerThread, 2)), std::memory_order_relaxed);
+	_active.store(true, std::memory_order_release);
+}
+
+void io_trace::stop() noexcept
+{
+	_active.store(false, std::memory_order_release);
+}
+
+detail::trace_ring* io_trace::register_thread() noexcept
+{
+	const size_t capacity = _ringCapacity.load(std::memory_order_relaxed);
+
+	auto& r = registry();
+	std::lock_guard lock{r.mutex};
+	// The ring of a thread that has exited, if one has the right size: its events are overwritten as the new thread records
+	const auto retired = std::find_if(r.rings.begin(), r.rings.end(), [capacity](const auto& ring) {
+		return ring->retired && ring->capacity() == capacity;
+	});
+	detail::trace_ring* ring = nullptr;
+	if (retired != r.rings.end())
+	{
+		ring = retired->get();
+		ring->retired = false;
+		ring->thread = r.nextThread++;
+	}
+	else
+		ring = r.rings.emplace_back(std::make_unique<detail::trace_ring>(capacity, r.nextThread++)).get();
+
+	tl_ringOwner.ring = ring;
+	detail::tl_trace_ring = ring;
+	return ring;
+}
+
+std::vector<trace_event> io_trace::collect() noexcept
+{
+	std::vector<trace_event> events;
+
+	auto& r = registry();
+	std::lock_guard lock{r.mutex};
+	for (const auto& ring : r.rings)
+	{
+		const size_t capacity = ring->capacity();
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		const uint64_t first = std::max({ring->floor.load(std::memory_order_relaxed), head > capacity ? head - capacity : 0});
+
+		// The owner may lap us while copying: the slots it has overwritten since, or is writing to, are skipped
+		trace_event e;
+		for (uint64_t i = first; i < head; ++i)
+		{
+			if (ring->read(i, e))
+				events.push_back(e);
+		}
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const trace_event& a, const trace_event& b) {
+		return a.start_ns < b.start_ns;
+	});
+	return events;
+}
+
+void io_trace::clear() noexcept
+{
+	auto& r = registry();
+	std::lock_guard lock{r.mutex};
+	// Nothing left to collect in the rings of the threads that have exited
+	std::erase_if(r.rings, [](const auto& ring) { return ring->retired; });
+	for (const auto& ring : r.rings)
+		ring->floor.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+bool io_trace::write_chrome_json(const char* path) noexcept
+{
+	return write_chrome_json(path, collect());
+}
+
+bool io_trace::write_chrome_json(const char* path, const std::vector<trace_event>& events) noexcept
+{
+	file f = file::open_file(path, file::open_mode::Write);
+	if (!f)
+		return false;
+
+	const uint64_t origin = events.empty() ? 0 : events.front().start_ns;
+
+	std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	char line[512];
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const trace_event& e = events[i];
+		const uint64_t start = e.start_ns - origin;
+		const int n = ::snprintf(line, sizeof(line),
+			"%s\n{\"name\":\"%s\",\"cat\":\"io\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+			"\"args\":{\"handle\":%llu,\"offset\":%lld,\"size\":%llu,\"result\":%lld}}",
+			i == 0 ? "" : ",", file_op_name(e.op), e.thread,
+			static_cast<unsigned long long>(start / 1000), static_cast<unsigned>(start % 1000),
+			static_cast<unsigned long long>(e.duration_ns / 1000), static_cast<unsigned>(e.duration_ns % 1000),
+			static_cast<unsigned long long>(e.handle),
+			e.offset == ~uint64_t{0} ? -1ll : static_cast<long long>(e.offset),
+			static_cast<unsigned long long>(e.size), static_cast<long long>(e.result));
+		json.append(line, static_cast<size_t>(std::max(n, 0)));
+
+		if (json.size() >= 1024 * 1024)
+		{
+			if (!write_all(f, json.data(), json.size()))
+				return false;
+			json.clear();
+		}
+	}
+	json += "\n]}\n";
+
+	return write_all(f, json.data(), json.size()) && f.close();
+}
+
+bool io_trace::write_binary(const char* path) noexcept
+{
+	return write_binary(path, collect());
+}
+
+bool io_trace::write_binary(const char* path, const std::vector<trace_event>& events) noexcept
+{
+	file f = file::open_file(path, file::open_mode::Write);
+	if (!f)
+		return false;
+
+	binary_header header;
+	::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+	header.version = binary_version;
+	header.event_size = sizeof(trace_event);
+	header.count = events.size();
+
+	return write_all(f, &header, sizeof(header))
+		&& write_all(f, events.data(), events.size() * sizeof(trace_event))
+		&& f.close();
+}
+
+std::optional<std::vector<trace_event>> io_trace::read_binary(const char* path) noexcept
+{
+	file f = file::open_file(path, file::open_mode::Read);
+	if (!f)
+		return {};
+
+	binary_header header;
+	if (!read_all(f, &header, sizeof(header))
+		|| ::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0
+		|| header.version != binary_version || header.event_size != sizeof(trace_event))
+		return {};
+
+	const auto fileSize = f.size();
+	if (!fileSize || (*fileSize - sizeof(header)) / sizeof(trace_event) < header.count)
+		return {};
+
+	std::vector<trace_event> events(static_cast<size_t>(header.count));
+	if (!read_all(f, events.data(), events.size() * sizeof(trace_event)))
+		return {};
+
+	return events;
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include "file_decorator.hpp"
+#include "io_stats.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace thin_io {
+
+struct trace_event {
+	uint64_t start_ns = 0; // steady_clock
+	uint64_t duration_ns = 0;
+	uint64_t offset = ~uint64_t{0}; // ~0 for the calls that don't take one
+	uint64_t size = 0; // Requested
+	int64_t result = 0; // Bytes transferred (0 for syncs), -1 on error
+	uint64_t handle = 0; // The file's native handle
+	uint32_t thread = 0; // Sequential, in the order the threads recorded their first event
+	file_op op = file_op::Read;
+	uint8_t reserved[3] {};
+};
+static_assert(sizeof(trace_event) == 56 && std::is_trivially_copyable_v<trace_event>);
+
+namespace detail {
+
+// Written only by its own thread, read by io_trace::collect() from any thread.
+// Retired when its thread exits: its events can still be collected until it is handed to a new thread or clear() frees it.
+// Every slot is a sequence lock: the reader copies the event word by word and keeps it only if the slot's sequence says
+// that the event it wanted was complete in the slot before and after the copy.
+struct trace_ring {
+	static constexpr size_t word_count = sizeof(trace_event) / sizeof(uint64_t);
+	static_assert(word_count * sizeof(uint64_t) == sizeof(trace_event));
+
+	struct slot {
+		std::atomic<uint64_t> sequence{0}; // 2 * (index + 1) once event #index is complete, odd while it is being written
+		std::atomic<uint64_t> words[word_count] {};
+	};
+
+	inline trace_ring(size_t capacity, uint32_t threadId) noexcept : slots(capacity), mask{capacity - 1}, thread{threadId} {}
+
+	inline void push(const trace_event& e) noexcept
+	{
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		slot& s = slots[h & mask];
+		s.sequence.store(2 * h + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release); // Orders the odd sequence before the words
+
+		uint64_t words[word_count];
+		::memcpy(words, &e, sizeof(e));
+		for (size_t i = 0; i < word_count; ++i)
+			s.words[i].store(words[i], std::memory_order_relaxed);
+
+		s.sequence.store(2 * h + 2, std::memory_order_release);
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// false if event #index has been overwritten, or is being overwritten
+	[[nodiscard]] inline bool read(uint64_t index, trace_event& e) const noexcept
+	{
+		const slot& s = slots[index & mask];
+		const uint64_t complete = 2 * index + 2;
+		if (s.sequence.load(std::memory_order_acquire) != complete)
+			return false;
+
+		uint64_t words[word_count];
+		for (size_t i = 0; i < word_count; ++i)
+			words[i] = s.words[i].load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire); // Orders the words before the second sequence check
+		if (s.sequence.load(std::memory_order_relaxed) != complete)
+			return false;
+
+		::memcpy(&e, words, sizeof(e));
+		return true;
+	}
+
+	[[nodiscard]] inline size_t capacity() const noexcept { return slots.size(); }
+
+	std::vector<slot> slots; // Power of 2 size
+	const size_t mask;
+	uint32_t thread; // Changed under the registry lock when the ring is handed to a new thread
+	std::atomic<uint64_t> head{0}; // Total number of events pushed
+	std::atomic<uint64_t> floor{0}; // Events before this one are cleared
+	bool retired = false; // Its thread has exited. Under the registry lock.
+};
+
+inline thread_local trace_ring* tl_trace_ring = nullptr;
+
+template <typename Handle>
+[[nodiscard]] inline uint64_t handle_value(Handle h) noexcept
+{
+	if constexpr (std::is_pointer_v<Handle>)
+		return reinterpret_cast<uintptr_t>(h);
+	else
+		return static_cast<uint64_t>(h);
+}
+
+} // namespace detail
+
+// Opt-in process-wide trace of file operations: every call of a traced<Impl> file is recorded into a ring buffer owned by
+// the calling thread, with no locks and no shared cache lines. When a ring is full the oldest events are overwritten.
+// The ring of a thread that exits goes to the next thread that records, so a pool that keeps creating threads doesn't grow the trace.
+class io_trace {
+public:
+	// Events per thread, rounded up to a power of 2. Threads that already have a ring keep theirs.
+	static void start(size_t eventsPerThread = 64 * 1024) noexcept;
+	static void stop() noexcept;
+	[[nodiscard]] static inline bool active() noexcept { return _active.load(std::memory_order_relaxed); }
+
+	inline static void record(const trace_event& e) noexcept
+	{
+		detail::trace_ring* ring = detail::tl_trace_ring;
+		if (!ring) [[unlikely]]
+			ring = register_thread();
+
+		trace_event stamped = e;
+		stamped.thread = ring->thread;
+		ring->push(stamped);
+	}
+
+	[[nodiscard]] static inline uint64_t now_ns() noexcept
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	// All the threads' events, ordered by start time. Can be called while tracing:
+	// the events being overwritten during the copy are dropped.
+	[[nodiscard]] static std::vector<trace_event> collect() noexcept;
+	// Forgets the events recorded so far, and frees the rings of the threads that have exited
+	static void clear() noexcept;
+
+	// Chrome trace event format, for chrome://tracing or Perfetto. Timestamps are relative to the first event.
+	static bool write_chrome_json(const char* path) noexcept;
+	static bool write_chrome_json(const char* path, const std::vector<trace_event>& events) noexcept;
+
+	// A small header followed by the trace_event structures as they are in memory (native byte order)
+	static bool write_binary(const char* path) noexcept;
+	static bool write_binary(const char* path, const std::vector<trace_event>& events) noexcept;
+	[[nodiscard]] static std::optional<std::vector<trace_event>> read_binary(const char* path) noexcept;
+
+private:
+	static detail::trace_ring* register_thread() noexcept;
+
+private:
+	static inline std::atomic<bool> _active{false};
+	static inline std::atomic<size_t> _ringCapacity{64 * 1024};
+};
+
+// file_impl decorator that records reads, writes and syncs into io_trace while it is active.
+// When it is not, the cost is one relaxed load per call.
+template <file_backend Impl>
+class [[nodiscard]] traced final : public file_decorator<Impl> {
+public:
+	inline std::optional<uint64_t> read(void* dest, uint64_t size) noexcept {
+		return trace(file_op::Read, ~uint64_t{0}, size, [&] { return this->_impl.read(dest, size); });
+	}
+
+	inline std::optional<uint64_t> write(const void* src, uint64_t size) noexcept {
+		return trace(file_op::Write, ~uint64_t{0}, size, [&] { return this->_impl.write(src, size); });
+	}
+
+	inline std::optional<uint64_t> pread(void* dest, uint64_t size, uint64_t pos) noexcept {
+		return trace(file_op::Pread, pos, size, [&] { return this->_impl.pread(dest, size, pos); });
+	}
+
+	inline std::optional<uint64_t> pwrite(const void* src, uint64_t size, uint64_t pos) noexcept {
+		return trace(file_op::Pwrite, pos, size, [&] { return this->_impl.pwrite(src, size, pos); });
+	}
+
+	[[nodiscard]] inline bool fsync() noexcept {
+		return trace(file_op::Fsync, ~uint64_t{0}, 0, [this] { return this->_impl.fsync(); });
+	}
+
+	[[nodiscard]] inline bool fdatasync() noexcept {
+		return trace(file_op::Fdatasync, ~uint64_t{0}, 0, [this] { return this->_impl.fdatasync(); });
+	}
+
+private:
+	template <typename Op>
+	inline auto trace(file_op op, uint64_t offset, uint64_t size, Op&& call) noexcept
+	{
+		if (!io_trace::active()) [[likely]]
+			return call();
+
+		trace_event e;
+		e.start_ns = io_trace::now_ns();
+		const auto result = call();
+		e.duration_ns = io_trace::now_ns() - e.start_ns;
+		e.op = op;
+		e.offset = offset;
+		e.size = size;
+		e.handle = detail::handle_value(this->_impl.native_handle());
+		const auto transferred = this->transferred(result);
+		e.result = transferred ? static_cast<int64_t>(*transferred) : -1;
+
+		io_trace::record(e);
+		return result;
+	}
+};
+
+} // namespace thin_io
@@ -0,0 +1,580 @@
+#include "io_uring_linux.hpp"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace thin_io;
+using namespace thin_io::detail;
+
+namespace {
+
+inline int io_uring_setup(unsigned entries, io_uring_params* params) noexcept
+{
+	return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int io_uring_register(int ringFd, unsigned opcode, const void* arg, unsigned nArgs) noexcept
+{
+	return static_cast<int>(::syscall(__NR_io_uring_register, ringFd, opcode, arg, nArgs));
+}
+
+inline int io_uring_enter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) noexcept
+{
+	int result;
+	do {
+		result = static_cast<int>(::syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+	} while (result < 0 && errno == EINTR);
+	return result;
+}
+
+template <typename T>
+[[nodiscard]] inline T load_acquire(T* p) noexcept
+{
+	return std::atomic_ref<T>{*p}.load(std::memory_order_acquire);
+}
+
+template <typename T>
+inline void store_release(T* p, T value) noexcept
+{
+	std::atomic_ref<T>{*p}.store(value, std::memory_order_release);
+}
+
+// Same limit as read() / write() have
+static constexpr uint64_t max_transfer_size = 0x7ffff000;
+
+// user_data of the internal requests (wake-up, cancel) that have no completion handler
+static constexpr uint64_t internal_request = 0;
+// Set in the user_data of a request's linked timeout, io_request is at least pointer-aligned
+static constexpr uint64_t timeout_tag = 1;
+static_assert(alignof(io_request) > timeout_tag);
+static_assert(sizeof(io_request{}.backend_state.timespec) == sizeof(__kernel_timespec));
+
+class io_uring_backend final : public io_backend {
+public:
+	io_uring_backend() noexcept = default;
+	~io_uring_backend() noexcept override;
+
+	[[nodiscard]] bool init(const io_context_options& options, bool sqpoll) noexcept;
+
+	void submit(io_request& request) noexcept override;
+	void cancel(io_request& request) noexcept override;
+	void wake() noexcept override;
+	size_t reap(bool wait) noexcept override;
+
+	[[nodiscard]] notification_handle_type notification_handle() const noexcept override { return _eventFd; }
+
+	[[nodiscard]] int register_file(file& f) noexcept override;
+	void unregister_file(int slot) noexcept override;
+	[[nodiscard]] bool register_buffers(std::span<const io_buffer_region> buffers) noexcept override;
+
+private:
+	// All of the below require _sqMutex
+	// Makes sure that there is room for `reserve` entries and returns the first one
+	[[nodiscard]] io_uring_sqe* get_sqe(unsigned reserve = 1) noexcept;
+	void publish() noexcept;
+	void flush() noexcept;
+
+	static void prepare(io_uring_sqe& sqe, io_request& request) noexcept;
+
+	size_t process_completions() noexcept;
+	[[nodiscard]] bool cq_overflowed() const noexcept;
+	[[nodiscard]] bool on_reaper_thread() const noexcept;
+
+private:
+	int _ringFd = -1;
+	int _eventFd = -1; // Registered with the ring, signaled on every completion
+
+	void* _sqRing = nullptr;
+	size_t _sqRingSize = 0;
+	void* _cqRing = nullptr;
+	size_t _cqRingSize = 0;
+	io_uring_sqe* _sqes = nullptr;
+	size_t _sqesSize = 0;
+
+	unsigned* _sqHead = nullptr;
+	unsigned* _sqTail = nullptr;
+	unsigned* _sqFlags = nullptr;
+	bool _sqpoll = false;
+	unsigned _sqMask = 0;
+	unsigned _sqEntries = 0;
+	unsigned _sqeTail = 0; // Next free SQE, not yet visible to the kernel
+
+	unsigned* _cqHead = nullptr;
+	unsigned* _cqTail = nullptr;
+	unsigned _cqMask = 0;
+	io_uring_cqe* _cqes = nullptr;
+
+	std::mutex _sqMutex;
+	std::atomic<std::thread::id> _reaperThread;
+	// Requests that could not be queued (the ring was full) and were executed synchronously
+	std::vector<io_request*> _completedInline;
+
+	// The registered file table is sparse, slots are taken and given back one by one
+	std::mutex _filesMutex;
+	std::vector<unsigned> _freeFileSlots;
+};
+
+io_uring_backend::~io_uring_backend() noexcept
+{
+	if (_sqes)
+		::munmap(_sqes, _sqesSize);
+	if (_cqRing && _cqRing != _sqRing)
+		::munmap(_cqRing, _cqRingSize);
+	if (_sqRing)
+		::munmap(_sqRing, _sqRingSize);
+	if (_ringFd != -1)
+		::close(_ringFd);
+	if (_eventFd != -1)
+		::close(_eventFd);
+}
+
+bool io_uring_backend::init(const io_context_options& options, bool sqpoll) noexcept
+{
+	io_uring_params params;
+	::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CLAMP;
+	if (sqpoll)
+	{
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = options.sqpoll_idle_ms;
+	}
+
+	_ringFd = io_uring_setup(options.queue_depth, &params);
+	if (_ringFd < 0)
+	{
+		_ringFd = -1;
+		return false;
+	}
+
+	// IORING_OP_READ / WRITE need 5.6, which is also when IORING_FEAT_RW_CUR_POS appeared
+	static constexpr uint32_t requiredFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+	if ((params.features & requiredFeatures) != requiredFeatures)
+		return false;
+	// Before 5.11 SQPOLL only works with registered files
+	if (sqpoll && (params.features & IORING_FEAT_SQPOLL_NONFIXED) == 0)
+		return false;
+	_sqpoll = sqpoll;
+
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	// Single mmap for both rings
+	_sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+	_sqRing = ::mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+	if (_sqRing == MAP_FAILED)
+	{
+		_sqRing = nullptr;
+		return false;
+	}
+	_cqRing = _sqRing;
+
+	_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void* sqes = ::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return false;
+	_sqes = static_cast<io_uring_sqe*>(sqes);
+
+	auto* sq = static_cast<std::byte*>(_sqRing);
+	_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	_sqFlags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+	_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	_sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+	_sqeTail = *_sqTail;
+
+	// Identity mapping of the submission queue slots to SQEs, set once
+	auto* sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	for (unsigned i = 0; i < _sqEntries; ++i)
+		sqArray[i] = i;
+
+	auto* cq = static_cast<std::byte*>(_cqRing);
+	_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	// An empty (all -1) file table that register_file() fills in. Not fatal if it fails, files are then not registered.
+	if (options.registered_file_slots != 0)
+	{
+		const std::vector<int> emptyTable(options.registered_file_slots, -1);
+		if (io_uring_register(_ringFd, IORING_REGISTER_FILES, emptyTable.data(), options.registered_file_slots) == 0)
+		{
+			for (unsigned slot = options.registered_file_slots; slot-- > 0; )
+				_freeFileSlots.push_back(slot);
+		}
+	}
+
+	if (options.completion_notification)
+	{
+		_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_eventFd != -1 && io_uring_register(_ringFd, IORING_REGISTER_EVENTFD, &_eventFd, 1) != 0)
+		{
+			::close(_eventFd);
+			_eventFd = -1;
+		}
+	}
+
+	return true;
+}
+
+io_uring_sqe* io_uring_backend::get_sqe(unsigned reserve) noexcept
+{
+	if (_sqeTail - load_acquire(_sqHead) + reserve > _sqEntries) [[unlikely]]
+	{
+		// Full: hand the queued entries over to the kernel to make room
+		publish();
+		flush();
+		if (_sqeTail - load_acquire(_sqHead) + reserve > _sqEntries)
+			return nullptr;
+	}
+
+	io_uring_sqe* sqe = &_sqes[_sqeTail & _sqMask];
+	++_sqeTail;
+	::memset(sqe, 0, sizeof(io_uring_sqe));
+	return sqe;
+}
+
+void io_uring_backend::publish() noexcept
+{
+	store_release(_sqTail, _sqeTail);
+}
+
+void io_uring_backend::flush() noexcept
+{
+	const unsigned toSubmit = _sqeTail - load_acquire(_sqHead);
+	if (toSubmit == 0)
+		return;
+
+	if (_sqpoll)
+	{
+		// The kernel thread picks the entries up by itself unless it has gone to sleep.
+		// The fence orders the tail store before the flags load, the kernel does the same on its side.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const unsigned flags = std::atomic_ref<unsigned>{*_sqFlags}.load(std::memory_order_relaxed);
+		if (flags & IORING_SQ_NEED_WAKEUP)
+			io_uring_enter(_ringFd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+		else if (toSubmit >= _sqEntries)
+			io_uring_enter(_ringFd, 0, 0, IORING_ENTER_SQ_WAIT); // Full: wait for the thread to make room
+	}
+	else
+		io_uring_enter(_ringFd, toSubmit, 0, 0);
+}
+
+void io_uring_backend::prepare(io_uring_sqe& sqe, io_request& request) noexcept
+{
+	sqe.user_data = reinterpret_cast<uintptr_t>(&request);
+
+	const auto setFile = [&] {
+		if (request.fixed_file >= 0)
+		{
+			sqe.fd = request.fixed_file;
+			sqe.flags |= IOSQE_FIXED_FILE;
+		}
+		else
+			sqe.fd = request.target->native_handle();
+	};
+
+	switch (request.op) {
+	case io_op::Read:
+	case io_op::Write:
+		setFile();
+		if (request.fixed_buffer >= 0)
+		{
+			sqe.opcode = request.op == io_op::Read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+			sqe.buf_index = static_cast<uint16_t>(request.fixed_buffer);
+		}
+		else
+			sqe.opcode = request.op == io_op::Read ? IORING_OP_READ : IORING_OP_WRITE;
+		if (const io_priority priority = !request.priority.is_default() ? request.priority : request.target->priority(); !priority.is_default())
+		{
+			// IOPRIO_PRIO_VALUE()
+			const int level = priority.cls == io_priority::priority_class::Idle ? 0 : priority.level;
+			sqe.ioprio = static_cast<uint16_t>((static_cast<int>(priority.cls) << 13) | level);
+		}
+		sqe.addr = reinterpret_cast<uintptr_t>(request.buffer);
+		sqe.len = static_cast<uint32_t>(std::min(request.size, max_transfer_size));
+		sqe.off = request.offset;
+		break;
+	case io_op::Fsync:
+	case io_op::Fdatasync:
+		sqe.opcode = IORING_OP_FSYNC;
+		setFile();
+		sqe.fsync_flags = request.op == io_op::Fdatasync ? IORING_FSYNC_DATASYNC : 0;
+		break;
+	case io_op::Open:
+	{
+		const auto params = file_impl::open_parameters_for(request.openMode, request.cacheMode);
+		sqe.opcode = IORING_OP_OPENAT;
+		sqe.fd = AT_FDCWD;
+		sqe.addr = reinterpret_cast<uintptr_t>(request.path);
+		sqe.len = params.mode;
+		sqe.open_flags = static_cast<uint32_t>(params.flags | O_CLOEXEC);
+		break;
+	}
+	}
+}
+
+bool io_uring_backend::cq_overflowed() const noexcept
+{
+	return (std::atomic_ref<unsigned>{*_sqFlags}.load(std::memory_order_acquire) & IORING_SQ_CQ_OVERFLOW) != 0;
+}
+
+bool io_uring_backend::on_reaper_thread() const noexcept
+{
+	return _reaperThread.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+void io_uring_backend::submit(io_request& request) noexcept
+{
+	const bool linkedTimeout = request.timeout.count() > 0;
+	request.backend_state.completions = linkedTimeout ? 2 : 1;
+	request.backend_state.expired = false;
+
+	std::unique_lock lock{_sqMutex};
+	io_uring_sqe* sqe = get_sqe(linkedTimeout ? 2 : 1);
+	if (!sqe) [[unlikely]]
+	{
+		// The kernel takes no more entries even after a flush, completions are backed up (EBUSY).
+		// Degrade to synchronous execution rather than fail, without the lock so that the other submitters and the reaper
+		// are not held up. A request with a timeout can't be bounded that way, it fails with EBUSY instead.
+		lock.unlock();
+		if (linkedTimeout)
+			request.result = io_result{.value = -EBUSY};
+		else
+			execute_blocking(request);
+
+		lock.lock();
+		_completedInline.push_back(&request);
+		if (_eventFd != -1)
+			(void)::eventfd_write(_eventFd, 1); // No CQE for this one
+		return;
+	}
+
+	prepare(*sqe, request);
+	if (linkedTimeout)
+	{
+		// Cancels the request if it is still running when the timeout expires
+		sqe->flags |= IOSQE_IO_LINK;
+		const int64_t ns = request.timeout.count();
+		request.backend_state.timespec[0] = ns / 1'000'000'000;
+		request.backend_state.timespec[1] = ns % 1'000'000'000;
+
+		io_uring_sqe* timeoutSqe = get_sqe();
+		timeoutSqe->opcode = IORING_OP_LINK_TIMEOUT;
+		timeoutSqe->fd = -1;
+		timeoutSqe->addr = reinterpret_cast<uintptr_t>(request.backend_state.timespec);
+		timeoutSqe->len = 1;
+		timeoutSqe->user_data = reinterpret_cast<uintptr_t>(&request) | timeout_tag;
+	}
+	publish();
+
+	// Submissions made by completion handlers are batched and flushed at the end of reap()
+	if (!on_reaper_thread())
+		flush();
+}
+
+void io_uring_backend::cancel(io_request& request) noexcept
+{
+	std::lock_guard lock{_sqMutex};
+	io_uring_sqe* sqe = get_sqe();
+	if (!sqe) [[unlikely]]
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uintptr_t>(&request);
+	sqe->user_data = internal_request;
+	publish();
+	flush();
+}
+
+void io_uring_backend::wake() noexcept
+{
+	std::lock_guard lock{_sqMutex};
+	// If the ring is full, there is plenty of completions on the way to wake the reaper
+	io_uring_sqe* sqe = get_sqe();
+	if (!sqe) [[unlikely]]
+		return;
+
+	sqe->opcode = IORING_OP_NOP;
+	sqe->user_data = internal_request;
+	publish();
+	flush();
+}
+
+size_t io_uring_backend::process_completions() noexcept
+{
+	size_t n = 0;
+
+	// Before looking at the queues, so that anything completing after this point signals again
+	eventfd_t signalCount;
+	if (_eventFd != -1)
+		(void)::eventfd_read(_eventFd, &signalCount);
+
+	std::vector<io_request*> inlineCompletions;
+	{
+		std::lock_guard lock{_sqMutex};
+		inlineCompletions.swap(_completedInline);
+	}
+	for (io_request* r : inlineCompletions)
+	{
+		if (r->on_complete)
+			r->on_complete(*r);
+		++n;
+	}
+
+	unsigned head = *_cqHead; // Only written by this thread
+	for (const unsigned tail = load_acquire(_cqTail); head != tail; )
+	{
+		const io_uring_cqe cqe = _cqes[head & _cqMask];
+		store_release(_cqHead, ++head);
+
+		if (cqe.user_data == internal_request)
+			continue;
+
+		auto* r = reinterpret_cast<io_request*>(cqe.user_data & ~timeout_tag);
+		if (cqe.user_data & timeout_tag)
+			r->backend_state.expired = cqe.res == -ETIME; // -ECANCELED if the request completed first
+		else
+		{
+			r->result.value = cqe.res;
+			if (r->op == io_op::Open && cqe.res >= 0)
+				r->result.value = r->target->attach(cqe.res) ? 0 : -static_cast<int64_t>(errno);
+		}
+
+		// With a linked timeout, the request is done when both have completed
+		if (--r->backend_state.completions != 0)
+			continue;
+
+		// A blocking operation interrupted in an io-wq worker reports EINTR rather than ECANCELED
+		if (r->backend_state.expired && (r->result.cancelled() || r->result.value == -EINTR))
+			r->result = io_result::timed_out_result();
+
+		if (r->on_complete)
+			r->on_complete(*r);
+		++n;
+	}
+
+	return n;
+}
+
+size_t io_uring_backend::reap(bool wait) noexcept
+{
+	_reaperThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+	{
+		std::lock_guard lock{_sqMutex};
+		flush();
+	}
+
+	size_t n = process_completions();
+	if (n == 0 && wait)
+	{
+		// Blocks without holding the lock so that other threads can submit
+		io_uring_enter(_ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+		n = process_completions();
+	}
+
+	// Completions that did not fit in the CQ are held by the kernel (IORING_FEAT_NODROP) until it is asked for events
+	while (cq_overflowed())
+	{
+		io_uring_enter(_ringFd, 0, 0, IORING_ENTER_GETEVENTS);
+		const size_t more = process_completions();
+		if (more == 0)
+			break;
+		n += more;
+	}
+
+	_reaperThread.store(std::thread::id{}, std::memory_order_relaxed);
+
+	{
+		std::lock_guard lock{_sqMutex};
+		flush();
+	}
+
+	return n;
+}
+
+int io_uring_backend::register_file(file& f) noexcept
+{
+	std::lock_guard lock{_filesMutex};
+	if (_freeFileSlots.empty() || !f)
+		return -1;
+
+	const unsigned slot = _freeFileSlots.back();
+	const int fd = f.native_handle();
+	io_uring_files_update update;
+	::memset(&update, 0, sizeof(update));
+	update.offset = slot;
+	update.fds = reinterpret_cast<uintptr_t>(&fd);
+	if (io_uring_register(_ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+		return -1;
+
+	_freeFileSlots.pop_back();
+	return static_cast<int>(slot);
+}
+
+void io_uring_backend::unregister_file(int slot) noexcept
+{
+	std::lock_guard lock{_filesMutex};
+	const int fd = -1;
+	io_uring_files_update update;
+	::memset(&update, 0, sizeof(update));
+	update.offset = static_cast<unsigned>(slot);
+	update.fds = reinterpret_cast<uintptr_t>(&fd);
+	// In-flight requests hold their own reference, the slot can be reused right away
+	(void)io_uring_register(_ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+	_freeFileSlots.push_back(static_cast<unsigned>(slot));
+}
+
+bool io_uring_backend::register_buffers(std::span<const io_buffer_region> buffers) noexcept
+{
+	// buf_index is 16 bits
+	if (buffers.empty() || buffers.size() > 0xFFFF)
+		return false;
+
+	std::vector<iovec> iovecs(buffers.size());
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		iovecs[i].iov_base = buffers[i].data;
+		iovecs[i].iov_len = buffers[i].size;
+	}
+
+	// Fails if the pages cannot be pinned, e.g. RLIMIT_MEMLOCK on kernels before 5.12
+	return io_uring_register(_ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+}
+
+} // namespace
+
+std::unique_ptr<io_backend> detail::make_io_uring_backend(const io_context_options& options) noexcept
+{
+	if (options.sqpoll)
+	{
+		auto backend = std::make_unique<io_uring_backend>();
+		if (backend->init(options, true))
+			return backend;
+	}
+
+	auto backend = std::make_unique<io_uring_backend>();
+	if (!backend->init(options, false))
+		return nullptr;
+
+	return backend;
+}
+
+#endif // __linux__
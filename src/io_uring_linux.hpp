@@ -0,0 +1,13 @@
+#pragma once
+#include "async_io.hpp"
+
+#include <memory>
+
+namespace thin_io::detail {
+
+// io_uring backend for io_context, talks to the kernel directly (no liburing).
+// SQPOLL is not an error if unavailable, the ring is then set up without it.
+// Returns nullptr if io_uring is not available: old kernel, disabled by seccomp or by the kernel.io_uring_disabled sysctl.
+[[nodiscard]] std::unique_ptr<io_backend> make_io_uring_backend(const io_context_options& options) noexcept;
+
+}
@@ -0,0 +1,222 @@
+#pragma once
+#include "growable_mapping.hpp"
+
+#include <algorithm>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+namespace thin_io {
+
+namespace detail {
+
+[[nodiscard]] constexpr uint64_t fnv1a(uint64_t hash, uint64_t value) noexcept
+{
+	for (int i = 0; i < 8; ++i, value >>= 8)
+		hash = (hash ^ (value & 0xFF)) * 0x100000001B3ull;
+	return hash;
+}
+
+struct mapped_vector_header {
+	static constexpr uint64_t magic_value = 0x31'54'43'45'56'4F'49'54; // "TIOVECT1"
+
+	uint64_t magic;
+	uint64_t fingerprint;
+	uint64_t count; // As of the last commit()
+	uint64_t capacity; // In elements, all backed by the file
+	uint64_t elementSize;
+};
+
+} // namespace detail
+
+// Identifies the element type in the file, so that a file is not opened as a vector of another type.
+// The default only captures the size, alignment and kind of T: specialize it to tell apart structs of the same size.
+template <typename T>
+inline constexpr uint64_t mapped_vector_fingerprint = detail::fnv1a(detail::fnv1a(0xCBF29CE484222325ull, sizeof(T)),
+	alignof(T) | uint64_t{std::is_integral_v<T>} << 16 | uint64_t{std::is_floating_point_v<T>} << 17 | uint64_t{std::is_signed_v<T>} << 18);
+
+// A vector whose elements live in a file, mapped into memory: reopening it is instant, with no deserialization.
+// The file holds a header (count, capacity, type fingerprint) followed by the elements. The capacity grows geometrically,
+// by extending the file, over a growable_mapping; like with std::vector, growing may invalidate pointers to the elements.
+//
+// The count in the file only changes on commit() (and close()), so a crash reverts the vector to its last commit.
+// commit(true) first writes the elements back to the device, so that the committed count never covers lost data.
+template <typename T>
+class mapped_vector {
+	static_assert(std::is_trivially_copyable_v<T>, "The elements are stored as their bytes");
+
+public:
+	using value_type = T;
+	using size_type = size_t;
+	using iterator = T*;
+	using const_iterator = const T*;
+
+	mapped_vector() noexcept = default;
+	inline ~mapped_vector() noexcept { close(); }
+
+	mapped_vector(mapped_vector&&) noexcept = default;
+	inline mapped_vector& operator=(mapped_vector&& other) noexcept
+	{
+		if (this != &other)
+		{
+			close();
+			_mapping = std::move(other._mapping);
+			_size = std::exchange(other._size, 0);
+		}
+		return *this;
+	}
+
+	// Creates the file or opens an existing vector, which fails if its element type doesn't match
+	inline bool open(const char* path, const growable_mapping_options& options = {}) noexcept
+	{
+		close();
+		if (!_mapping.open(path, options))
+			return false;
+
+		if (_mapping.size() == 0)
+		{
+			if (!_mapping.resize(data_offset))
+				return close_and_fail();
+
+			*header() = detail::mapped_vector_header{.magic = detail::mapped_vector_header::magic_value, .fingerprint = mapped_vector_fingerprint<T>,
+				.count = 0, .capacity = 0, .elementSize = sizeof(T)};
+		}
+		else
+		{
+			const auto* h = header();
+			if (_mapping.size() < data_offset || h->magic != detail::mapped_vector_header::magic_value || h->fingerprint != mapped_vector_fingerprint<T>
+				|| h->elementSize != sizeof(T) || h->count > h->capacity || h->capacity > (_mapping.size() - data_offset) / sizeof(T))
+			{
+				return close_and_fail();
+			}
+		}
+
+		_size = static_cast<size_t>(header()->count);
+		return true;
+	}
+
+	// Commits, without waiting for the device
+	inline bool close() noexcept
+	{
+		if (!is_open())
+			return false;
+
+		header()->count = _size;
+		_size = 0;
+		return _mapping.close();
+	}
+
+	[[nodiscard]] inline bool is_open() const noexcept { return _mapping.is_open(); }
+
+	// Makes the current size the one found when reopening the file. wait: flushes the elements then the header to the device.
+	inline bool commit(bool wait = false) noexcept
+	{
+		if (!is_open())
+			return false;
+
+		const uint64_t committed = header()->count;
+		if (wait && _size > committed && !_mapping.flush(data_offset + committed * sizeof(T), (_size - committed) * sizeof(T), true))
+			return false;
+
+		header()->count = _size;
+		return !wait || _mapping.flush(0, sizeof(detail::mapped_vector_header), true);
+	}
+
+	[[nodiscard]] inline size_t committed_size() const noexcept { return is_open() ? static_cast<size_t>(header()->count) : 0; }
+
+	[[nodiscard]] inline size_t size() const noexcept { return _size; }
+	[[nodiscard]] inline bool empty() const noexcept { return _size == 0; }
+	[[nodiscard]] inline size_t capacity() const noexcept { return is_open() ? static_cast<size_t>(header()->capacity) : 0; }
+
+	[[nodiscard]] inline T* data() noexcept { return is_open() ? reinterpret_cast<T*>(_mapping.data() + data_offset) : nullptr; }
+	[[nodiscard]] inline const T* data() const noexcept { return is_open() ? reinterpret_cast<const T*>(_mapping.data() + data_offset) : nullptr; }
+
+	[[nodiscard]] inline std::span<T> span() noexcept { return {data(), _size}; }
+	[[nodiscard]] inline std::span<const T> span() const noexcept { return {data(), _size}; }
+
+	[[nodiscard]] inline T& operator[](size_t i) noexcept { return data()[i]; }
+	[[nodiscard]] inline const T& operator[](size_t i) const noexcept { return data()[i]; }
+	[[nodiscard]] inline T& back() noexcept { return data()[_size - 1]; }
+
+	[[nodiscard]] inline iterator begin() noexcept { return data(); }
+	[[nodiscard]] inline iterator end() noexcept { return data() + _size; }
+	[[nodiscard]] inline const_iterator begin() const noexcept { return data(); }
+	[[nodiscard]] inline const_iterator end() const noexcept { return data() + _size; }
+
+	// Grows the file to hold n elements. Never shrinks.
+	inline bool reserve(size_t n) noexcept
+	{
+		if (!is_open())
+			return false;
+		if (n <= capacity())
+			return true;
+
+		if (!_mapping.resize(data_offset + uint64_t{n} * sizeof(T)))
+			return false;
+
+		header()->capacity = n;
+		return true;
+	}
+
+	inline bool push_back(const T& value) noexcept
+	{
+		if (_size == capacity() && !reserve(std::max<size_t>(2 * capacity(), min_capacity)))
+			return false;
+
+		::memcpy(data() + _size, &value, sizeof(T));
+		++_size;
+		return true;
+	}
+
+	inline void pop_back() noexcept { --_size; }
+	inline void clear() noexcept { _size = 0; }
+
+	// The new elements are zero bytes
+	inline bool resize(size_t n) noexcept
+	{
+		if (n > capacity() && !reserve(std::max(n, 2 * capacity())))
+			return false;
+
+		if (n > _size)
+			::memset(static_cast<void*>(data() + _size), 0, (n - _size) * sizeof(T));
+		_size = n;
+		return true;
+	}
+
+	// Trims the file to the current size
+	inline bool shrink_to_fit() noexcept
+	{
+		if (!is_open() || !_mapping.resize(data_offset + uint64_t{_size} * sizeof(T)))
+			return false;
+
+		header()->capacity = _size;
+		header()->count = std::min<uint64_t>(header()->count, _size);
+		return true;
+	}
+
+	[[nodiscard]] inline growable_mapping& mapping() noexcept { return _mapping; }
+
+private:
+	[[nodiscard]] inline detail::mapped_vector_header* header() noexcept { return reinterpret_cast<detail::mapped_vector_header*>(_mapping.data()); }
+	[[nodiscard]] inline const detail::mapped_vector_header* header() const noexcept { return reinterpret_cast<const detail::mapped_vector_header*>(_mapping.data()); }
+
+	inline bool close_and_fail() noexcept
+	{
+		(void)_mapping.close();
+		return false;
+	}
+
+private:
+	// The elements start on a cache line
+	static constexpr uint64_t data_offset = std::max<uint64_t>(64, alignof(T));
+	static constexpr size_t min_capacity = std::max<size_t>(4096 / sizeof(T), 1);
+	static_assert(sizeof(detail::mapped_vector_header) <= data_offset);
+
+	growable_mapping _mapping;
+	size_t _size = 0;
+};
+
+} // namespace thin_io
@@ -0,0 +1,450 @@
+#include "memory_file.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <system_error>
+#include <unordered_map>
+
+using namespace thin_io;
+
+namespace {
+
+struct free_deleter {
+	inline void operator()(std::byte* p) const noexcept { ::free(p); }
+};
+
+// Large blocks come zeroed from the OS and are only backed by memory when touched
+std::unique_ptr<std::byte, free_deleter> allocate_zeroed(uint64_t size) noexcept
+{
+	return std::unique_ptr<std::byte, free_deleter>{static_cast<std::byte*>(::calloc(static_cast<size_t>(size), 1))};
+}
+
+constexpr uint64_t min_chunk_size = 64 * 1024;
+constexpr uint64_t max_chunk_size = 64 * 1024 * 1024;
+
+thread_local int tl_error = 0;
+
+inline void set_error(int ec) noexcept
+{
+	tl_error = ec;
+}
+
+inline bool fail(int ec) noexcept
+{
+	set_error(ec);
+	return false;
+}
+
+} // namespace
+
+struct memory_file_impl::storage : std::enable_shared_from_this<storage> {
+	struct chunk {
+		uint64_t start;
+		uint64_t length;
+		std::unique_ptr<std::byte, free_deleter> data;
+		uint32_t mappings = 0;
+	};
+
+	[[nodiscard]] inline uint64_t capacity() const noexcept
+	{
+		return chunks.empty() ? 0 : chunks.back().start + chunks.back().length;
+	}
+
+	// The chunk that contains offset, which must be below capacity()
+	[[nodiscard]] inline size_t chunk_index(uint64_t offset) const noexcept
+	{
+		const auto it = std::upper_bound(chunks.begin(), chunks.end(), offset, [](uint64_t o, const chunk& c) {
+			return o < c.start;
+		});
+		return static_cast<size_t>(it - chunks.begin()) - 1;
+	}
+
+	// Allocates the chunks up to end. The new chunks grow with the file, so that their number stays logarithmic.
+	inline bool reserve(uint64_t end) noexcept
+	{
+		while (capacity() < end)
+		{
+			const uint64_t length = std::clamp(capacity(), min_chunk_size, max_chunk_size);
+			auto data = allocate_zeroed(length);
+			if (!data)
+				return fail(ENOMEM);
+
+			chunks.push_back(chunk{.start = capacity(), .length = length, .data = std::move(data), .mappings = 0});
+		}
+		return true;
+	}
+
+	// Calls f(chunkBytes, length, doneSoFar) for the pieces of [offset, offset + length), which must be below capacity()
+	template <typename F>
+	inline void for_each_piece(uint64_t offset, uint64_t length, F&& f) noexcept
+	{
+		uint64_t done = 0;
+		for (size_t i = length != 0 ? chunk_index(offset) : chunks.size(); done < length; ++i)
+		{
+			const chunk& c = chunks[i];
+			const uint64_t inChunk = offset + done - c.start;
+			const uint64_t n = std::min(length - done, c.length - inChunk);
+			f(c.data.get() + inChunk, n, done);
+			done += n;
+		}
+	}
+
+	inline void zero(uint64_t offset, uint64_t length) noexcept
+	{
+		for_each_piece(offset, length, [](std::byte* p, uint64_t n, uint64_t) {
+			::memset(p, 0, static_cast<size_t>(n));
+		});
+	}
+
+	// Moves the chunks that cover the range into one, returns its index
+	inline std::optional<size_t> make_contiguous(uint64_t offset, uint64_t length) noexcept
+	{
+		const size_t first = chunk_index(offset), last = chunk_index(offset + length - 1);
+		if (first == last)
+			return first;
+
+		if (std::any_of(chunks.begin() + static_cast<ptrdiff_t>(first), chunks.begin() + static_cast<ptrdiff_t>(last) + 1, [](const chunk& c) { return c.mappings != 0; }))
+		{
+			set_error(EBUSY);
+			return std::nullopt;
+		}
+
+		const uint64_t start = chunks[first].start;
+		const uint64_t mergedLength = chunks[last].start + chunks[last].length - start;
+		auto data = allocate_zeroed(mergedLength);
+		if (!data)
+		{
+			set_error(ENOMEM);
+			return std::nullopt;
+		}
+
+		for (size_t i = first; i <= last; ++i)
+			::memcpy(data.get() + (chunks[i].start - start), chunks[i].data.get(), static_cast<size_t>(chunks[i].length));
+
+		chunks.erase(chunks.begin() + static_cast<ptrdiff_t>(first) + 1, chunks.begin() + static_cast<ptrdiff_t>(last) + 1);
+		chunks[first].length = mergedLength;
+		chunks[first].data = std::move(data);
+		return first;
+	}
+
+	// [0, capacity()) is covered, with no gaps. The bytes in [size, capacity()) are zero.
+	std::vector<chunk> chunks;
+	uint64_t size = 0;
+	std::mutex mutex;
+};
+
+namespace {
+
+struct file_registry {
+	std::mutex mutex;
+	std::unordered_map<std::string, std::shared_ptr<memory_file_impl::storage>> files;
+};
+
+file_registry& registry() noexcept
+{
+	static file_registry r;
+	return r;
+}
+
+} // namespace
+
+memory_file_impl& memory_file_impl::operator=(memory_file_impl&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		_storage = std::move(other._storage);
+		_mappings = std::move(other._mappings);
+		_pos = other._pos;
+		_readable = other._readable;
+		_writable = other._writable;
+		_priority = other._priority;
+		other._mappings.clear();
+	}
+	return *this;
+}
+
+bool memory_file_impl::open(const char* path, open_mode openMode, sys_cache_mode /*cacheMode*/, sharing_mode /*sharingMode*/) noexcept
+{
+	if (is_open() && !close())
+		return false;
+
+	std::shared_ptr<storage> s;
+	if (path == nullptr || *path == '\0')
+	{
+		if (openMode == open_mode::Read)
+			return fail(ENOENT);
+
+		s = std::make_shared<storage>();
+	}
+	else
+	{
+		auto& r = registry();
+		std::lock_guard lock{r.mutex};
+		auto it = r.files.find(path);
+		if (it == r.files.end())
+		{
+			if (openMode == open_mode::Read)
+				return fail(ENOENT);
+
+			it = r.files.emplace(path, std::make_shared<storage>()).first;
+		}
+		s = it->second;
+	}
+
+	if (openMode == open_mode::Write)
+	{
+		std::lock_guard lock{s->mutex};
+		s->zero(0, s->size);
+		s->size = 0;
+	}
+
+	_storage = std::move(s);
+	_readable = openMode != open_mode::Write;
+	_writable = openMode != open_mode::Read;
+	_pos = 0;
+	return true;
+}
+
+bool memory_file_impl::close() noexcept
+{
+	if (!is_open())
+		return false;
+
+	if (!_mappings.empty())
+	{
+		std::lock_guard lock{_storage->mutex};
+		for (const auto& m : _mappings)
+			--_storage->chunks[_storage->chunk_index(m.chunkStart)].mappings;
+		_mappings.clear();
+	}
+
+	_storage.reset();
+	return true;
+}
+
+bool memory_file_impl::attach(native_handle_type h) noexcept
+{
+	if (h == nullptr)
+		return fail(EBADF);
+
+	auto s = h->shared_from_this();
+	if (is_open() && !close())
+		return false;
+
+	_storage = std::move(s);
+	_readable = true;
+	_writable = true;
+	_pos = 0;
+	return true;
+}
+
+std::optional<uint64_t> memory_file_impl::read(void* dest, uint64_t size) noexcept
+{
+	const auto n = pread(dest, size, _pos);
+	if (n)
+		_pos += *n;
+	return n;
+}
+
+std::optional<uint64_t> memory_file_impl::write(const void* src, uint64_t size) noexcept
+{
+	const auto n = pwrite(src, size, _pos);
+	if (n)
+		_pos += *n;
+	return n;
+}
+
+std::optional<uint64_t> memory_file_impl::pread(void* dest, uint64_t size, uint64_t pos) noexcept
+{
+	if (!is_open() || !_readable)
+	{
+		set_error(EBADF);
+		return std::nullopt;
+	}
+
+	std::lock_guard lock{_storage->mutex};
+	if (pos >= _storage->size)
+		return 0;
+
+	const uint64_t n = std::min(size, _storage->size - pos);
+	_storage->for_each_piece(pos, n, [dest](const std::byte* p, uint64_t length, uint64_t done) {
+		::memcpy(static_cast<std::byte*>(dest) + done, p, static_cast<size_t>(length));
+	});
+	return n;
+}
+
+std::optional<uint64_t> memory_file_impl::pwrite(const void* src, uint64_t size, uint64_t pos) noexcept
+{
+	if (!is_open() || !_writable)
+	{
+		set_error(EBADF);
+		return std::nullopt;
+	}
+	if (size > UINT64_MAX - pos)
+	{
+		set_error(EFBIG);
+		return std::nullopt;
+	}
+	// Like pwrite(2): nothing to write doesn't extend the file, even past its end
+	if (size == 0)
+		return 0;
+
+	std::lock_guard lock{_storage->mutex};
+	if (!_storage->reserve(pos + size))
+		return {};
+
+	_storage->for_each_piece(pos, size, [src](std::byte* p, uint64_t length, uint64_t done) {
+		::memcpy(p, static_cast<const std::byte*>(src) + done, static_cast<size_t>(length));
+	});
+	_storage->size = std::max(_storage->size, pos + size);
+	return size;
+}
+
+std::optional<uint64_t> memory_file_impl::pos() const noexcept
+{
+	if (!is_open())
+	{
+		set_error(EBADF);
+		return std::nullopt;
+	}
+
+	return _pos;
+}
+
+bool memory_file_impl::set_pos(uint64_t newPos) noexcept
+{
+	if (!is_open())
+		return fail(EBADF);
+
+	_pos = newPos;
+	return true;
+}
+
+bool memory_file_impl::truncate(uint64_t newFileSize) noexcept
+{
+	if (!is_open() || !_writable)
+		return fail(EBADF);
+
+	std::lock_guard lock{_storage->mutex};
+	auto& s = *_storage;
+	if (newFileSize > s.size)
+	{
+		if (!s.reserve(newFileSize))
+			return false;
+	}
+	else
+	{
+		s.zero(newFileSize, s.size - newFileSize);
+		// Releasing the chunks past the end, as long as they are not mapped
+		while (!s.chunks.empty() && s.chunks.back().start >= newFileSize && s.chunks.back().mappings == 0)
+			s.chunks.pop_back();
+	}
+
+	s.size = newFileSize;
+	_pos = newFileSize; // As file_impl::truncate()
+	return true;
+}
+
+bool memory_file_impl::preallocate(uint64_t offset, uint64_t length) noexcept
+{
+	if (!is_open() || !_writable)
+		return fail(EBADF);
+	if (length > UINT64_MAX - offset)
+		return fail(EFBIG);
+
+	std::lock_guard lock{_storage->mutex};
+	if (!_storage->reserve(offset + length))
+		return false;
+
+	_storage->size = std::max(_storage->size, offset + length);
+	return true;
+}
+
+bool memory_file_impl::punch_hole(uint64_t offset, uint64_t length) noexcept
+{
+	if (!is_open() || !_writable)
+		return fail(EBADF);
+
+	std::lock_guard lock{_storage->mutex};
+	if (offset < _storage->size)
+		_storage->zero(offset, std::min(length, _storage->size - offset));
+	return true;
+}
+
+void* memory_file_impl::mmap(mmap_access_mode /*mode*/, uint64_t offset, uint64_t length) noexcept
+{
+	if (!is_open())
+	{
+		set_error(EBADF);
+		return nullptr;
+	}
+
+	std::lock_guard lock{_storage->mutex};
+	if (length == 0 || offset >= _storage->size || length > _storage->size - offset)
+	{
+		set_error(EINVAL);
+		return nullptr;
+	}
+
+	const auto index = _storage->make_contiguous(offset, length);
+	if (!index)
+		return nullptr;
+
+	auto& c = _storage->chunks[*index];
+	void* addr = c.data.get() + (offset - c.start);
+	++c.mappings;
+	_mappings.push_back(mapping{.addr = addr, .chunkStart = c.start});
+	return addr;
+}
+
+bool memory_file_impl::unmap(void* mapAddress) noexcept
+{
+	const auto it = std::find_if(_mappings.begin(), _mappings.end(), [mapAddress](const mapping& m) {
+		return m.addr == mapAddress;
+	});
+	if (it == _mappings.end() || !is_open())
+		return fail(EINVAL);
+
+	std::lock_guard lock{_storage->mutex};
+	--_storage->chunks[_storage->chunk_index(it->chunkStart)].mappings;
+	_mappings.erase(it);
+	return true;
+}
+
+std::optional<uint64_t> memory_file_impl::size() const noexcept
+{
+	if (!is_open())
+	{
+		set_error(EBADF);
+		return std::nullopt;
+	}
+
+	std::lock_guard lock{_storage->mutex};
+	return _storage->size;
+}
+
+bool memory_file_impl::at_end() const noexcept
+{
+	return pos() == size();
+}
+
+bool memory_file_impl::delete_file(const char* filePath) noexcept
+{
+	auto& r = registry();
+	std::lock_guard lock{r.mutex};
+	return r.files.erase(filePath) != 0 || fail(ENOENT);
+}
+
+int memory_file_impl::error_code() noexcept
+{
+	return tl_error;
+}
+
+std::string memory_file_impl::text_for_error(int ec) noexcept
+{
+	return std::generic_category().message(ec);
+}
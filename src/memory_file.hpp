@@ -0,0 +1,103 @@
+#pragma once
+#include "file_interface.hpp"
+
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace thin_io {
+
+// A file that lives in RAM, with the same interface as file_impl: using memory_file = file_interface<memory_file_impl>.
+//
+// The contents are stored in chunks that are never moved while they hold data, so growing a file is cheap and does not copy.
+// A non-empty path names the file in a process-wide registry: every handle opened with the same path shares the contents,
+// and delete_file() removes the name (the handles that are open keep the contents, as with unlink()).
+// An empty path creates a private file that exists until its last handle is closed.
+//
+// mmap() returns a pointer straight into the contents; a range that spans several chunks is first moved into a single one,
+// which fails with EBUSY if any of them is mapped. The access mode is not enforced. Mapped chunks are not released by truncate().
+// Reading a handle opened with open_mode::Write fails with EBADF, as with file_impl.
+// The contents can be used through any number of handles from any threads. A handle's own position and mappings are not
+// synchronized: share a handle between threads for pread() and pwrite() only. error_code() returns errno values.
+class [[nodiscard]] memory_file_impl final : public file_constants {
+public:
+	struct storage;
+	using native_handle_type = storage*;
+
+	memory_file_impl() noexcept = default;
+	memory_file_impl(memory_file_impl&& other) noexcept = default;
+	inline ~memory_file_impl() noexcept { close(); }
+
+	memory_file_impl& operator=(memory_file_impl&& other) noexcept;
+
+	// Read: the named file must exist. Write: creates or truncates. ReadWrite: creates if needed.
+	bool open(const char* path, open_mode openMode, sys_cache_mode cacheMode, sharing_mode sharingMode) noexcept;
+	bool close() noexcept;
+
+	[[nodiscard]] inline bool is_open() const noexcept { return _storage != nullptr; }
+
+	[[nodiscard]] inline native_handle_type native_handle() const noexcept { return _storage.get(); }
+	// Opens another handle (read-write) to the contents of an open memory file
+	bool attach(native_handle_type h) noexcept;
+
+	std::optional<uint64_t> read(void* dest, uint64_t size) noexcept;
+	std::optional<uint64_t> write(const void* src, uint64_t size) noexcept;
+
+	// Unlike file_impl, these do not change the position
+	std::optional<uint64_t> pread(void* dest, uint64_t size, uint64_t pos) noexcept;
+	std::optional<uint64_t> pwrite(const void* src, uint64_t size, uint64_t pos) noexcept;
+
+	[[nodiscard]] std::optional<uint64_t> pos() const noexcept;
+	bool set_pos(uint64_t newPos) noexcept;
+
+	bool truncate(uint64_t newFileSize) noexcept;
+	bool preallocate(uint64_t offset, uint64_t length) noexcept;
+	inline bool set_sparse() noexcept { return is_open(); }
+	// Zeroes the range, the memory is not released
+	bool punch_hole(uint64_t offset, uint64_t length) noexcept;
+
+	// Nothing to sync
+	[[nodiscard]] inline bool fsync() noexcept { return is_open(); }
+	[[nodiscard]] inline bool fdatasync() noexcept { return is_open(); }
+
+	// Stored, has no effect
+	inline bool set_priority(io_priority priority) noexcept { _priority = priority; return true; }
+	[[nodiscard]] inline io_priority priority() const noexcept { return _priority; }
+
+	// The range must be within the file
+	[[nodiscard]] void* mmap(mmap_access_mode mode, uint64_t offset, uint64_t length) noexcept;
+	[[nodiscard]] bool unmap(void* mapAddress) noexcept;
+	// The mapping is the contents: nothing to flush. Locking has no effect.
+	inline bool flush(void* /*address*/, uint64_t /*length*/, mmap_flush_mode /*mode*/) noexcept { return is_open(); }
+	inline bool lock(const void* /*address*/, uint64_t /*length*/) noexcept { return is_open(); }
+	inline bool unlock(const void* /*address*/, uint64_t /*length*/) noexcept { return is_open(); }
+
+	[[nodiscard]] std::optional<uint64_t> size() const noexcept;
+	[[nodiscard]] bool at_end() const noexcept;
+
+	// Removes the name from the registry
+	static bool delete_file(const char* filePath) noexcept;
+
+	// Of the calling thread's last failed call
+	[[nodiscard]] static int error_code() noexcept;
+	[[nodiscard]] static std::string text_for_error(int ec) noexcept;
+
+private:
+	struct mapping {
+		void* addr;
+		uint64_t chunkStart;
+	};
+
+	std::shared_ptr<storage> _storage;
+	std::vector<mapping> _mappings;
+	uint64_t _pos = 0;
+	bool _readable = false;
+	bool _writable = false;
+	io_priority _priority;
+};
+
+using memory_file = file_interface<memory_file_impl>;
+
+} // namespace thin_io
@@ -0,0 +1,149 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <stdint.h>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace thin_io {
+
+struct io_range {
+	uint64_t offset = 0;
+	uint64_t length = 0;
+};
+
+struct worker_stats {
+	uint64_t bytes = 0;
+	uint64_t chunks = 0; // Transferred completely
+	std::chrono::nanoseconds busy{0}; // Time spent in I/O calls
+
+	// Bytes per second
+	[[nodiscard]] inline double throughput() const noexcept {
+		return busy.count() > 0 ? static_cast<double>(bytes) * 1e9 / static_cast<double>(busy.count()) : 0.0;
+	}
+};
+
+struct parallel_io_result {
+	bool ok = false; // All the bytes were transferred without errors
+	uint64_t bytes = 0;
+	std::chrono::nanoseconds elapsed{0};
+	std::vector<worker_stats> workers;
+
+	// Bytes per second, wall time
+	[[nodiscard]] inline double throughput() const noexcept {
+		return elapsed.count() > 0 ? static_cast<double>(bytes) * 1e9 / static_cast<double>(elapsed.count()) : 0.0;
+	}
+};
+
+namespace detail {
+
+// Splits the range into chunks that the workers pick up one by one.
+// transfer(offset in range, size) returns the number of bytes done, 0 for EOF or an error.
+template <class Transfer>
+parallel_io_result run_parallel(const io_range range, unsigned threads, uint64_t chunk, Transfer&& transfer) noexcept
+{
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency() != 0 ? std::thread::hardware_concurrency() : 1;
+	if (chunk == 0)
+		chunk = range.length;
+
+	const uint64_t nChunks = chunk != 0 ? (range.length + chunk - 1) / chunk : 0;
+	if (threads > nChunks)
+		threads = nChunks > 0 ? static_cast<unsigned>(nChunks) : 1;
+
+	parallel_io_result result;
+	result.workers.resize(threads);
+
+	std::atomic<uint64_t> nextChunk{0};
+	std::atomic<bool> failed{false};
+
+	const auto worker = [&](worker_stats& stats) {
+		for (uint64_t i = nextChunk.fetch_add(1, std::memory_order_relaxed); i < nChunks && !failed.load(std::memory_order_relaxed); i = nextChunk.fetch_add(1, std::memory_order_relaxed))
+		{
+			const uint64_t begin = i * chunk;
+			const uint64_t size = begin + chunk <= range.length ? chunk : range.length - begin;
+
+			const auto start = std::chrono::steady_clock::now();
+			// Retry short transfers
+			uint64_t done = 0;
+			while (done < size)
+			{
+				const uint64_t n = transfer(begin + done, size - done);
+				if (n == 0) [[unlikely]]
+				{
+					failed.store(true, std::memory_order_relaxed);
+					break;
+				}
+				done += n;
+				stats.bytes += n;
+			}
+			stats.busy += std::chrono::steady_clock::now() - start;
+			if (done == size)
+				++stats.chunks;
+		}
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	{
+		// The calling thread is one of the workers
+		std::vector<std::thread> pool;
+		try
+		{
+			pool.reserve(threads - 1);
+			for (unsigned t = 1; t < threads; ++t)
+				pool.emplace_back(worker, std::ref(result.workers[t]));
+		}
+		catch (const std::system_error&)
+		{
+			// Out of threads: the ones started so far, this one included, take over the remaining chunks
+		}
+
+		worker(result.workers[0]);
+		for (auto& thread : pool)
+			thread.join();
+	}
+	result.elapsed = std::chrono::steady_clock::now() - start;
+
+	for (const auto& stats : result.workers)
+		result.bytes += stats.bytes;
+	result.ok = !failed && result.bytes == range.length;
+
+	return result;
+}
+
+} // namespace detail
+
+// Reads range.length bytes starting at file offset range.offset into dest, using up to `threads` threads (0 = one per core)
+// issuing positional reads of up to `chunk` bytes.
+// Reading past EOF is a failure.
+//
+// !!!
+// Windows: synchronous I/O on a single handle is serialized by the OS, there is no speed-up unless the file is opened separately per thread
+// !!!
+template <class File>
+parallel_io_result parallel_read(File& f, void* dest, io_range range, unsigned threads = 0, uint64_t chunk = 8 * 1024 * 1024) noexcept
+{
+	auto* destBytes = static_cast<std::byte*>(dest);
+	return detail::run_parallel(range, threads, chunk, [&](uint64_t offset, uint64_t size) -> uint64_t {
+		return f.pread(destBytes + offset, size, range.offset + offset).value_or(0);
+	});
+}
+
+// Writes range.length bytes from src to the file starting at offset range.offset, see parallel_read().
+// The range is preallocated first to avoid fragmentation and concurrent file size updates.
+template <class File>
+parallel_io_result parallel_write(File& f, const void* src, io_range range, unsigned threads = 0, uint64_t chunk = 8 * 1024 * 1024) noexcept
+{
+	// Not supported by every filesystem, not an error
+	(void)f.preallocate(range.offset, range.length);
+
+	const auto* srcBytes = static_cast<const std::byte*>(src);
+	return detail::run_parallel(range, threads, chunk, [&](uint64_t offset, uint64_t size) -> uint64_t {
+		return f.pwrite(srcBytes + offset, size, range.offset + offset).value_or(0);
+	});
+}
+
+} // namespace thin_io
@@ -0,0 +1,257 @@
+#pragma once
+#include "file_decorator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+namespace thin_io {
+
+// Bandwidth and IOPS budget, shared by any number of files and threads.
+// A caller that takes more than is available is let through and goes into debt, then sleeps until the debt is paid off:
+// the tokens are handed out in arrival order and nobody spins.
+class token_bucket {
+public:
+	struct limits {
+		uint64_t bytes_per_second = 0; // 0: no limit
+		uint64_t ops_per_second = 0; // 0: no limit
+		// How much can be spent at once after being idle, also the largest single transfer, a page at least (see max_chunk())
+		std::chrono::milliseconds burst{100};
+
+		// Adaptive mode when not 0: the rates above become the maximum. They are cut by 20% whenever the average
+		// latency of a window of operations exceeds the target, and raised by 5% of the maximum when it does not.
+		std::chrono::nanoseconds target_latency{0};
+		uint32_t latency_window = 16; // Operations per adjustment
+		double min_fraction = 0.05; // The rates are never cut below this fraction of the maximum
+	};
+
+	inline explicit token_bucket(const limits& l) noexcept { set_limits(l); }
+
+	inline void set_limits(const limits& l) noexcept
+	{
+		std::lock_guard lock{_mutex};
+		_limits = l;
+		_limits.latency_window = std::max(_limits.latency_window, 1u);
+		_scale = 1.0;
+		_bytes = capacity(_limits.bytes_per_second);
+		_ops = capacity(_limits.ops_per_second);
+		_lastRefill = clock::now();
+		_latencySum = {};
+		_latencySamples = 0;
+	}
+
+	[[nodiscard]] inline limits current_limits() const noexcept
+	{
+		std::lock_guard lock{_mutex};
+		return _limits;
+	}
+
+	// The fraction of the configured rates currently allowed, below 1 only in adaptive mode
+	[[nodiscard]] inline double scale() const noexcept
+	{
+		std::lock_guard lock{_mutex};
+		return _scale;
+	}
+
+	// A page: a tiny burst doesn't turn transfers into one-byte calls
+	static constexpr uint64_t min_chunk = 4096;
+
+	// Transfers larger than this are split, never into pieces smaller than min_chunk
+	[[nodiscard]] inline uint64_t max_chunk() const noexcept
+	{
+		std::lock_guard lock{_mutex};
+		if (_limits.bytes_per_second == 0)
+			return UINT64_MAX;
+		return std::max(static_cast<uint64_t>(capacity(_limits.bytes_per_second)), min_chunk);
+	}
+
+	// Takes `ops` operations and `bytes` bytes from the budget, sleeping as long as needed
+	inline void acquire(uint64_t bytes, uint64_t ops = 1) noexcept
+	{
+		std::chrono::nanoseconds wait{0};
+		{
+			std::lock_guard lock{_mutex};
+			refill();
+			if (_limits.bytes_per_second != 0)
+			{
+				_bytes -= static_cast<double>(bytes);
+				if (_bytes < 0)
+					wait = std::max(wait, seconds_to_ns(-_bytes / rate(_limits.bytes_per_second)));
+			}
+			if (_limits.ops_per_second != 0 && ops != 0)
+			{
+				_ops -= static_cast<double>(ops);
+				if (_ops < 0)
+					wait = std::max(wait, seconds_to_ns(-_ops / rate(_limits.ops_per_second)));
+			}
+		}
+
+		if (wait.count() > 0)
+			std::this_thread::sleep_for(wait);
+	}
+
+	// Feedback for the adaptive mode: how long an operation took
+	inline void record_latency(std::chrono::nanoseconds latency) noexcept
+	{
+		std::lock_guard lock{_mutex};
+		if (_limits.target_latency.count() == 0)
+			return;
+
+		_latencySum += latency;
+		if (++_latencySamples < _limits.latency_window)
+			return;
+
+		const auto average = _latencySum / _latencySamples;
+		_latencySum = {};
+		_latencySamples = 0;
+
+		refill(); // At the old rate up to now
+		_scale = average > _limits.target_latency ? std::max(_scale * 0.8, _limits.min_fraction) : std::min(_scale + 0.05, 1.0);
+		// Not keeping more than the new burst capacity
+		_bytes = std::min(_bytes, capacity(_limits.bytes_per_second));
+		_ops = std::min(_ops, capacity(_limits.ops_per_second));
+	}
+
+	[[nodiscard]] inline bool adaptive() const noexcept
+	{
+		std::lock_guard lock{_mutex};
+		return _limits.target_latency.count() != 0;
+	}
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	[[nodiscard]] inline double rate(uint64_t perSecond) const noexcept
+	{
+		return static_cast<double>(perSecond) * _scale;
+	}
+
+	[[nodiscard]] inline double capacity(uint64_t perSecond) const noexcept
+	{
+		return rate(perSecond) * std::chrono::duration<double>(_limits.burst).count();
+	}
+
+	[[nodiscard]] static inline std::chrono::nanoseconds seconds_to_ns(double s) noexcept
+	{
+		return std::chrono::nanoseconds{static_cast<int64_t>(s * 1e9)};
+	}
+
+	inline void refill() noexcept
+	{
+		const auto now = clock::now();
+		const double elapsed = std::chrono::duration<double>(now - _lastRefill).count();
+		_lastRefill = now;
+		_bytes = std::min(_bytes + elapsed * rate(_limits.bytes_per_second), capacity(_limits.bytes_per_second));
+		_ops = std::min(_ops + elapsed * rate(_limits.ops_per_second), capacity(_limits.ops_per_second));
+	}
+
+private:
+	mutable std::mutex _mutex;
+	limits _limits;
+	double _scale = 1.0;
+	double _bytes = 0; // Negative when in debt
+	double _ops = 0;
+	clock::time_point _lastRefill;
+	std::chrono::nanoseconds _latencySum{0};
+	uint32_t _latencySamples = 0;
+};
+
+// file_impl decorator that keeps reads, writes and syncs within a token_bucket's budget.
+// Transfers larger than the burst are split so that one big call cannot overdraw the budget in one go;
+// a call is still one operation for the IOPS budget, however many pieces it is split into.
+// Without a limiter set, everything goes straight through.
+//
+// using throttled_file = file_interface<rate_limited<file_impl>>;
+// throttled_file f; f.impl().set_limiter(sharedBucket);
+template <file_backend Impl>
+class [[nodiscard]] rate_limited final : public file_decorator<Impl> {
+public:
+	inline void set_limiter(std::shared_ptr<token_bucket> limiter) noexcept { _limiter = std::move(limiter); }
+	[[nodiscard]] inline const std::shared_ptr<token_bucket>& limiter() const noexcept { return _limiter; }
+
+	inline std::optional<uint64_t> read(void* dest, uint64_t size) noexcept
+	{
+		return transfer(size, [&](uint64_t done, uint64_t n) {
+			return this->_impl.read(static_cast<std::byte*>(dest) + done, n);
+		});
+	}
+
+	inline std::optional<uint64_t> write(const void* src, uint64_t size) noexcept
+	{
+		return transfer(size, [&](uint64_t done, uint64_t n) {
+			return this->_impl.write(static_cast<const std::byte*>(src) + done, n);
+		});
+	}
+
+	inline std::optional<uint64_t> pread(void* dest, uint64_t size, uint64_t pos) noexcept
+	{
+		return transfer(size, [&](uint64_t done, uint64_t n) {
+			return this->_impl.pread(static_cast<std::byte*>(dest) + done, n, pos + done);
+		});
+	}
+
+	inline std::optional<uint64_t> pwrite(const void* src, uint64_t size, uint64_t pos) noexcept
+	{
+		return transfer(size, [&](uint64_t done, uint64_t n) {
+			return this->_impl.pwrite(static_cast<const std::byte*>(src) + done, n, pos + done);
+		});
+	}
+
+	// One operation each
+	[[nodiscard]] inline bool fsync() noexcept { return timed(0, 1, [this] { return this->_impl.fsync(); }); }
+	[[nodiscard]] inline bool fdatasync() noexcept { return timed(0, 1, [this] { return this->_impl.fdatasync(); }); }
+
+	// Page faults are not accounted for, mmap() goes straight through
+
+private:
+	// Waits for the budget, then runs op() and reports its latency in adaptive mode
+	template <typename Op>
+	inline auto timed(uint64_t bytes, uint64_t ops, Op&& op) noexcept
+	{
+		if (!_limiter)
+			return op();
+
+		_limiter->acquire(bytes, ops);
+		if (!_limiter->adaptive())
+			return op();
+
+		const auto start = std::chrono::steady_clock::now();
+		auto result = op();
+		_limiter->record_latency(std::chrono::steady_clock::now() - start);
+		return result;
+	}
+
+	// chunk(done, n) transfers n bytes starting at offset done of the request
+	template <typename Chunk>
+	inline std::optional<uint64_t> transfer(uint64_t size, Chunk&& chunk) noexcept
+	{
+		if (!_limiter)
+			return chunk(uint64_t{0}, size);
+
+		const uint64_t maxChunk = _limiter->max_chunk();
+		uint64_t done = 0;
+		do {
+			const uint64_t n = std::min(size - done, maxChunk);
+			// The operation is charged with the first piece
+			const auto result = timed(n, done == 0 ? uint64_t{1} : uint64_t{0}, [&] { return chunk(done, n); });
+			if (!result)
+				return done != 0 ? std::optional<uint64_t>{done} : std::nullopt; // Report what was transferred before the error
+
+			done += *result;
+			if (*result < n)
+				break; // EOF or a short write
+		} while (done < size);
+
+		return done;
+	}
+
+private:
+	std::shared_ptr<token_bucket> _limiter;
+};
+
+} // namespace thin_io
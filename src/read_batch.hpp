@@ -0,0 +1,208 @@
+#pragma once
+#include "async_io.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace thin_io {
+
+struct read_req {
+	uint64_t offset = 0;
+	uint64_t length = 0;
+	void* dest = nullptr;
+
+	// Output: less than length if the range extends past EOF
+	uint64_t bytes_read = 0;
+	bool ok = false;
+};
+
+struct batch_read_options {
+	// Ranges separated by no more than this are read together, the bytes in between are read and discarded
+	uint64_t max_gap = 4096;
+	// Merging stops at this size
+	uint64_t max_read_size = 1024 * 1024;
+};
+
+struct batch_read_result {
+	bool ok = false; // Every request succeeded (short reads at EOF are not errors)
+	size_t reads = 0; // Reads issued after coalescing
+	uint64_t bytes_read = 0; // Read from the file, including the discarded gaps
+};
+
+namespace detail {
+
+struct coalesced_read {
+	uint64_t offset = 0;
+	uint64_t length = 0;
+	size_t first = 0, last = 0; // [first, last) in the sorted order
+	std::vector<std::byte> buffer; // Only if more than one request is covered, otherwise the data goes straight to dest
+};
+
+struct batch_plan {
+	std::vector<size_t> order; // Request indices sorted by offset
+	std::vector<coalesced_read> reads;
+};
+
+inline batch_plan plan_batch(std::span<read_req> requests, const batch_read_options& options) noexcept
+{
+	batch_plan plan;
+	plan.order.resize(requests.size());
+	std::iota(plan.order.begin(), plan.order.end(), size_t{0});
+	std::sort(plan.order.begin(), plan.order.end(), [&](size_t a, size_t b) {
+		return requests[a].offset < requests[b].offset;
+	});
+
+	for (size_t i = 0; i < plan.order.size(); )
+	{
+		coalesced_read read;
+		read.offset = requests[plan.order[i]].offset;
+		uint64_t end = read.offset + requests[plan.order[i]].length;
+		read.first = i;
+
+		// Overlapping or close enough, and not growing past the limit
+		for (++i; i < plan.order.size(); ++i)
+		{
+			const read_req& next = requests[plan.order[i]];
+			const uint64_t newEnd = std::max(end, next.offset + next.length);
+			if (next.offset > end + options.max_gap || (newEnd > end && newEnd - read.offset > options.max_read_size))
+				break;
+
+			end = newEnd;
+		}
+
+		read.last = i;
+		read.length = end - read.offset;
+		if (read.last - read.first > 1)
+			read.buffer.resize(static_cast<size_t>(read.length));
+
+		plan.reads.push_back(std::move(read));
+	}
+
+	return plan;
+}
+
+[[nodiscard]] inline void* read_destination(std::span<read_req> requests, const batch_plan& plan, coalesced_read& read) noexcept
+{
+	return read.buffer.empty() ? requests[plan.order[read.first]].dest : read.buffer.data();
+}
+
+// Distributes the bytesRead bytes that were read into the read's destination, nothing on error
+inline void scatter(std::span<read_req> requests, const batch_plan& plan, const coalesced_read& read, std::optional<uint64_t> bytesRead) noexcept
+{
+	for (size_t i = read.first; i < read.last; ++i)
+	{
+		read_req& r = requests[plan.order[i]];
+		r.ok = bytesRead.has_value();
+		if (!r.ok)
+		{
+			r.bytes_read = 0;
+			continue;
+		}
+
+		const uint64_t start = r.offset - read.offset;
+		r.bytes_read = *bytesRead > start ? std::min(r.length, *bytesRead - start) : 0;
+		if (!read.buffer.empty() && r.bytes_read != 0)
+			::memcpy(r.dest, read.buffer.data() + start, static_cast<size_t>(r.bytes_read));
+	}
+}
+
+// Retries short reads, stops at EOF. Returns the total, nothing in case of an error.
+template <class File>
+std::optional<uint64_t> read_fully(File& f, void* dest, uint64_t size, uint64_t pos, uint64_t done = 0) noexcept
+{
+	auto* bytes = static_cast<std::byte*>(dest);
+	while (done < size)
+	{
+		const auto n = f.pread(bytes + done, size - done, pos + done);
+		if (!n)
+			return {};
+		if (*n == 0)
+			break;
+
+		done += *n;
+	}
+	return done;
+}
+
+inline batch_read_result summarize(std::span<const read_req> requests, const batch_plan& plan, uint64_t bytesRead) noexcept
+{
+	batch_read_result result;
+	result.reads = plan.reads.size();
+	result.bytes_read = bytesRead;
+	result.ok = std::all_of(requests.begin(), requests.end(), [](const read_req& r) { return r.ok; });
+	return result;
+}
+
+} // namespace detail
+
+// Reads a set of (offset, length) ranges: sorts them by offset, merges the ones that overlap or are within max_gap of each other
+// into single reads and copies the data back to each request's dest.
+// Fewer system calls and the device sees sequential reads in ascending order.
+template <class File>
+batch_read_result pread_batch(File& f, std::span<read_req> requests, const batch_read_options& options = {}) noexcept
+{
+	auto plan = detail::plan_batch(requests, options);
+
+	uint64_t bytesRead = 0;
+	for (auto& read : plan.reads)
+	{
+		const auto n = detail::read_fully(f, detail::read_destination(requests, plan, read), read.length, read.offset);
+		detail::scatter(requests, plan, read, n);
+		bytesRead += n.value_or(0);
+	}
+
+	return detail::summarize(requests, plan, bytesRead);
+}
+
+// Same as above, with all the coalesced reads in flight at once on the io_context.
+// Runs ctx until the batch is complete, so it must be called on the thread that runs ctx. Other requests' completion handlers may be called.
+inline batch_read_result pread_batch(io_context& ctx, file& f, std::span<read_req> requests, const batch_read_options& options = {}) noexcept
+{
+	auto plan = detail::plan_batch(requests, options);
+
+	struct batch_state {
+		size_t remaining;
+	} state{plan.reads.size()};
+
+	std::vector<io_request> ioRequests(plan.reads.size());
+	for (size_t i = 0; i < plan.reads.size(); ++i)
+	{
+		auto& read = plan.reads[i];
+		ioRequests[i] = io_request::pread(f, detail::read_destination(requests, plan, read), read.length, read.offset);
+		ioRequests[i].user_data = &state;
+		ioRequests[i].on_complete = [](io_request& r) noexcept {
+			--static_cast<batch_state*>(r.user_data)->remaining;
+		};
+		ctx.submit(ioRequests[i]);
+	}
+
+	while (state.remaining != 0)
+		ctx.run_one();
+
+	uint64_t bytesRead = 0;
+	for (size_t i = 0; i < plan.reads.size(); ++i)
+	{
+		auto& read = plan.reads[i];
+		const io_result& result = ioRequests[i].result;
+
+		// A short read that is not at EOF (e.g. interrupted) is finished synchronously
+		std::optional<uint64_t> n;
+		if (result.bytes() != 0 && result.bytes() < read.length)
+			n = detail::read_fully(f, detail::read_destination(requests, plan, read), read.length, read.offset, result.bytes());
+		else if (result.ok())
+			n = result.bytes();
+
+		detail::scatter(requests, plan, read, n);
+		bytesRead += n.value_or(0);
+	}
+
+	return detail::summarize(requests, plan, bytesRead);
+}
+
+} // namespace thin_io
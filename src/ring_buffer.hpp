@@ -0,0 +1,136 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+namespace thin_io {
+
+// Byte FIFO whose memory is mapped twice, back to back: the byte after the last one of the buffer is the first one again.
+// The readable and the writable parts are therefore always contiguous, whatever their position, and a record that wraps
+// around the end can be parsed in place, without copying it into a temporary buffer.
+//
+// Backed by an anonymous file (memfd on Linux, a pagefile-backed section on Windows). Not thread-safe.
+class ring_buffer {
+public:
+	ring_buffer() noexcept = default;
+	// The capacity is rounded up to the page size (the allocation granularity on Windows). Check valid().
+	inline explicit ring_buffer(size_t minCapacity) noexcept
+	{
+		const size_t g = granularity();
+		map((std::max<size_t>(minCapacity, 1) + g - 1) / g * g);
+	}
+
+	inline ~ring_buffer() noexcept { unmap(); }
+
+	inline ring_buffer(ring_buffer&& other) noexcept :
+		_data{std::exchange(other._data, nullptr)},
+		_capacity{std::exchange(other._capacity, 0)},
+		_head{std::exchange(other._head, 0)},
+		_tail{std::exchange(other._tail, 0)}
+	{}
+
+	inline ring_buffer& operator=(ring_buffer&& other) noexcept
+	{
+		if (this != &other)
+		{
+			unmap();
+			_data = std::exchange(other._data, nullptr);
+			_capacity = std::exchange(other._capacity, 0);
+			_head = std::exchange(other._head, 0);
+			_tail = std::exchange(other._tail, 0);
+		}
+		return *this;
+	}
+
+	[[nodiscard]] inline bool valid() const noexcept { return _data != nullptr; }
+	[[nodiscard]] inline size_t capacity() const noexcept { return _capacity; }
+
+	[[nodiscard]] inline size_t size() const noexcept { return static_cast<size_t>(_tail - _head); }
+	[[nodiscard]] inline size_t free_space() const noexcept { return _capacity - size(); }
+	[[nodiscard]] inline bool empty() const noexcept { return _tail == _head; }
+
+	// All the bytes that have been written and not consumed yet, in one piece
+	[[nodiscard]] inline std::span<const std::byte> readable() const noexcept
+	{
+		return {_data + offset(_head), size()};
+	}
+
+	// All the free space, in one piece. Call commit() after writing into it.
+	[[nodiscard]] inline std::span<std::byte> writable() noexcept
+	{
+		return {_data + offset(_tail), free_space()};
+	}
+
+	// Makes n bytes written into writable() readable
+	inline void commit(size_t n) noexcept { _tail += std::min(n, free_space()); }
+	// Drops n bytes from the front
+	inline void consume(size_t n) noexcept { _head += std::min(n, size()); }
+
+	inline void clear() noexcept { _head = _tail = 0; }
+
+	// Copies as much of src as there is space for, returns the number of bytes copied
+	inline size_t write(const void* src, size_t n) noexcept
+	{
+		n = std::min(n, free_space());
+		if (n == 0)
+			return 0;
+
+		::memcpy(writable().data(), src, n);
+		commit(n);
+		return n;
+	}
+
+	// Reads from the file's current position into the free space, at most maxBytes.
+	// Returns the number of bytes read, 0 at EOF or if the buffer is full, nothing on error.
+	template <class File>
+	inline std::optional<uint64_t> fill_from(File& f, uint64_t maxBytes = UINT64_MAX) noexcept
+	{
+		const auto space = writable();
+		const uint64_t n = std::min<uint64_t>(space.size(), maxBytes);
+		if (n == 0)
+			return uint64_t{0};
+
+		const auto bytesRead = f.read(space.data(), n);
+		if (bytesRead)
+			commit(static_cast<size_t>(*bytesRead));
+		return bytesRead;
+	}
+
+	// Same as above, from the given file offset
+	template <class File>
+	inline std::optional<uint64_t> fill_from(File& f, uint64_t fileOffset, uint64_t maxBytes) noexcept
+	{
+		const auto space = writable();
+		const uint64_t n = std::min<uint64_t>(space.size(), maxBytes);
+		if (n == 0)
+			return uint64_t{0};
+
+		const auto bytesRead = f.pread(space.data(), n, fileOffset);
+		if (bytesRead)
+			commit(static_cast<size_t>(*bytesRead));
+		return bytesRead;
+	}
+
+	// The unit the capacity is rounded up to
+	[[nodiscard]] static size_t granularity() noexcept;
+
+private:
+	// 0 without a mapping: the spans are then empty
+	[[nodiscard]] inline size_t offset(uint64_t index) const noexcept { return _capacity != 0 ? static_cast<size_t>(index % _capacity) : 0; }
+
+	// Platform-specific. unmap() also resets the capacity.
+	bool map(size_t capacity) noexcept;
+	void unmap() noexcept;
+
+private:
+	std::byte* _data = nullptr; // 2 * _capacity bytes of address space, the second half aliasing the first
+	size_t _capacity = 0;
+	uint64_t _head = 0; // Total bytes consumed
+	uint64_t _tail = 0; // Total bytes committed
+};
+
+} // namespace thin_io
@@ -0,0 +1,49 @@
+#include "ring_buffer.hpp"
+#include "file.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace thin_io;
+
+size_t ring_buffer::granularity() noexcept
+{
+	static const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGE_SIZE));
+	return pageSize;
+}
+
+bool ring_buffer::map(size_t capacity) noexcept
+{
+	// Only needed until both views are mapped
+	file backing = file::create_anonymous("ring_buffer", anonymous_file_options{.allow_sealing = false, .huge_pages = false});
+	if (!backing || !backing.truncate(capacity))
+		return false;
+
+	// Reserving the address space for both views, then replacing each half with a view of the file
+	void* base = ::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return false;
+
+	auto* bytes = static_cast<std::byte*>(base);
+	for (std::byte* view : {bytes, bytes + capacity})
+	{
+		if (::mmap(view, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, backing.native_handle(), 0) != view)
+		{
+			::munmap(base, 2 * capacity);
+			return false;
+		}
+	}
+
+	_data = bytes;
+	_capacity = capacity;
+	return true;
+}
+
+void ring_buffer::unmap() noexcept
+{
+	if (_data)
+		::munmap(_data, 2 * _capacity);
+
+	_data = nullptr;
+	_capacity = 0;
+}
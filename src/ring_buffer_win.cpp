@@ -0,0 +1,62 @@
+#include "ring_buffer.hpp"
+
+#include <Windows.h>
+
+using namespace thin_io;
+
+size_t ring_buffer::granularity() noexcept
+{
+	static const size_t allocationGranularity = [] {
+		SYSTEM_INFO info;
+		::GetSystemInfo(&info);
+		return static_cast<size_t>(info.dwAllocationGranularity);
+	}();
+	return allocationGranularity;
+}
+
+bool ring_buffer::map(size_t capacity) noexcept
+{
+	// A pagefile-backed section: the anonymous file. The views keep it alive after the handle is closed.
+	const uint64_t sectionSize = capacity;
+	HANDLE section = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(sectionSize >> 32), static_cast<DWORD>(sectionSize), nullptr);
+	if (section == nullptr)
+		return false;
+
+	// Finding a free range for both views, then mapping them into it. Another thread may take the range in between,
+	// hence the retries.
+	bool mapped = false;
+	for (int attempt = 0; attempt < 16 && !mapped; ++attempt)
+	{
+		void* base = ::VirtualAlloc(nullptr, 2 * capacity, MEM_RESERVE, PAGE_NOACCESS);
+		if (base == nullptr)
+			break;
+		::VirtualFree(base, 0, MEM_RELEASE);
+
+		auto* bytes = static_cast<std::byte*>(base);
+		void* first = ::MapViewOfFileEx(section, FILE_MAP_ALL_ACCESS, 0, 0, capacity, bytes);
+		void* second = first ? ::MapViewOfFileEx(section, FILE_MAP_ALL_ACCESS, 0, 0, capacity, bytes + capacity) : nullptr;
+		if (first && second)
+		{
+			_data = bytes;
+			_capacity = capacity;
+			mapped = true;
+		}
+		else if (first)
+			::UnmapViewOfFile(first);
+	}
+
+	::CloseHandle(section);
+	return mapped;
+}
+
+void ring_buffer::unmap() noexcept
+{
+	if (_data)
+	{
+		::UnmapViewOfFile(_data);
+		::UnmapViewOfFile(_data + _capacity);
+	}
+
+	_data = nullptr;
+	_capacity = 0;
+}
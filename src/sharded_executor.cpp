@@ -0,0 +1,326 @@
+#include "sharded_executor.hpp"
+#include "spsc_queue.hpp"
+
+#include <chrono>
+#include <latch>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace thin_io;
+
+namespace {
+
+// The CPUs this process may run on
+std::vector<unsigned> allowed_cpus() noexcept
+{
+	std::vector<unsigned> cpus;
+#ifdef _WIN32
+	DWORD_PTR processMask = 0, systemMask = 0;
+	if (::GetProcessAffinityMask(::GetCurrentProcess(), &processMask, &systemMask))
+	{
+		for (unsigned cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu)
+		{
+			if (processMask & (DWORD_PTR{1} << cpu))
+				cpus.push_back(cpu);
+		}
+	}
+#elif defined __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (::sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+		}
+	}
+#endif
+
+	if (cpus.empty())
+	{
+		for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); ++cpu)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+bool pin_current_thread(unsigned cpu) noexcept
+{
+#ifdef _WIN32
+	// Only the current processor group
+	if (cpu >= sizeof(DWORD_PTR) * 8)
+		return false;
+
+	return ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR{1} << cpu) != 0;
+#elif defined __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false; // macOS only has affinity hints
+#endif
+}
+
+thread_local const sharded_executor* tl_executor = nullptr;
+thread_local unsigned tl_shard = 0;
+
+} // namespace
+
+struct sharded_executor::shard {
+	inline shard(unsigned shardIndex, unsigned shardCount, size_t queueCapacity) noexcept :
+		index{shardIndex},
+		external{queueCapacity}
+	{
+		inboxes.reserve(shardCount);
+		for (unsigned i = 0; i < shardCount; ++i)
+			inboxes.push_back(std::make_unique<spsc_queue<io_request*>>(queueCapacity));
+	}
+
+	[[nodiscard]] inline bool queues_empty() const noexcept
+	{
+		for (const auto& inbox : inboxes)
+		{
+			if (!inbox->empty())
+				return false;
+		}
+		return external.empty();
+	}
+
+	const unsigned index;
+	std::unique_ptr<io_context> ctx; // Created by the shard's thread, so that the ring memory is local to its CPU
+
+	std::vector<std::unique_ptr<spsc_queue<io_request*>>> inboxes; // Indexed by the submitting shard
+	spsc_queue<io_request*> external;
+	std::mutex externalMutex; // Producer side of external
+
+	// For detecting when all the work is done, see quiescent()
+	std::atomic<size_t> submitted{0};
+	std::atomic<size_t> completed{0};
+
+	std::atomic<bool> sleeping{false};
+	std::atomic<uint32_t> signal{0};
+	std::atomic<bool> exit{false};
+
+	bool pinned = false;
+	std::thread thread;
+};
+
+sharded_executor::sharded_executor(const sharded_executor_options& options) noexcept
+{
+	const std::vector<unsigned> cpus = allowed_cpus();
+	const unsigned shardCount = options.shards != 0 ? options.shards : static_cast<unsigned>(cpus.size());
+
+	_shards.reserve(shardCount);
+	for (unsigned i = 0; i < shardCount; ++i)
+		_shards.push_back(std::make_unique<shard>(i, shardCount, options.queue_capacity));
+
+	std::latch ready{static_cast<std::ptrdiff_t>(shardCount)};
+	unsigned started = 0;
+	try
+	{
+		for (; started < shardCount; ++started)
+		{
+			auto& s = _shards[started];
+			s->thread = std::thread{[this, &self = *s, &options, &cpus, &ready] {
+				if (options.pin_threads)
+					self.pinned = pin_current_thread(cpus[self.index % cpus.size()]);
+
+				self.ctx = std::make_unique<io_context>(options.context);
+				ready.count_down();
+				run_shard(self);
+			}};
+		}
+	}
+	catch (const std::system_error&)
+	{
+		// Out of threads: running with the shards that did start
+		ready.count_down(static_cast<std::ptrdiff_t>(shardCount - started));
+	}
+
+	ready.wait();
+	_shards.resize(started);
+}
+
+sharded_executor::~sharded_executor() noexcept
+{
+	while (!quiescent())
+		std::this_thread::sleep_for(std::chrono::microseconds{100});
+
+	for (auto& s : _shards)
+	{
+		s->exit.store(true, std::memory_order_release);
+		s->signal.fetch_add(1, std::memory_order_release);
+		s->signal.notify_one();
+		s->ctx->wake();
+	}
+
+	for (auto& s : _shards)
+		s->thread.join();
+}
+
+void sharded_executor::submit(io_request& request) noexcept
+{
+	const auto current = current_shard();
+	submit(current ? *current : _nextShard.fetch_add(1, std::memory_order_relaxed), request); // Taken modulo the shard count
+}
+
+void sharded_executor::submit(unsigned shardIndex, io_request& request) noexcept
+{
+	if (_shards.empty()) [[unlikely]]
+	{
+		// Not a single thread could be started
+		request.result = io_result::cancelled_result();
+		if (request.on_complete)
+			request.on_complete(request);
+		return;
+	}
+
+	shard& target = *_shards[shardIndex % _shards.size()];
+	target.submitted.fetch_add(1, std::memory_order_release);
+
+	if (tl_executor == this)
+	{
+		auto& inbox = *target.inboxes[tl_shard];
+		while (!inbox.try_push(&request))
+		{
+			// Full: keep taking in our own requests meanwhile, so that two shards filling each other's queues cannot deadlock.
+			// Not reaping completions: this may be running inside a completion handler.
+			shard& self = *_shards[tl_shard];
+			for (auto& source : self.inboxes)
+			{
+				while (const auto r = source->try_pop())
+					self.ctx->submit(**r);
+			}
+			std::this_thread::yield();
+		}
+	}
+	else
+	{
+		std::unique_lock lock{target.externalMutex};
+		while (!target.external.try_push(&request))
+		{
+			lock.unlock();
+			std::this_thread::yield();
+			lock.lock();
+		}
+	}
+
+	// Pairs with the fence in run_shard(): either the shard sees the request, or we see that it's going to sleep
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (target.sleeping.load(std::memory_order_relaxed))
+	{
+		target.signal.fetch_add(1, std::memory_order_release);
+		target.signal.notify_one();
+		target.ctx->wake();
+	}
+}
+
+std::optional<unsigned> sharded_executor::current_shard() const noexcept
+{
+	if (tl_executor != this)
+		return {};
+
+	return tl_shard;
+}
+
+bool sharded_executor::pinned() const noexcept
+{
+	for (const auto& s : _shards)
+	{
+		if (!s->pinned)
+			return false;
+	}
+	return true;
+}
+
+void sharded_executor::run_shard(shard& self) noexcept
+{
+	tl_executor = this;
+	tl_shard = self.index;
+
+	while (!self.exit.load(std::memory_order_acquire))
+	{
+		if (step(self))
+			continue;
+
+		// Nothing to do: block until a request arrives or one in flight completes
+		const uint32_t signal = self.signal.load(std::memory_order_acquire);
+		self.sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (self.queues_empty() && !self.exit.load(std::memory_order_acquire))
+		{
+			if (self.ctx->pending() != 0)
+				self.completed.fetch_add(self.ctx->run_one(), std::memory_order_release);
+			else
+				self.signal.wait(signal, std::memory_order_acquire);
+		}
+		self.sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	tl_executor = nullptr;
+}
+
+bool sharded_executor::step(shard& self) noexcept
+{
+	size_t submitted = 0;
+	const auto drain = [&](spsc_queue<io_request*>& queue) {
+		// Bounded, so that one busy producer does not starve the others or the completions
+		for (size_t i = 0; i < queue.capacity(); ++i)
+		{
+			const auto r = queue.try_pop();
+			if (!r)
+				break;
+
+			self.ctx->submit(**r);
+			++submitted;
+		}
+	};
+
+	for (auto& inbox : self.inboxes)
+		drain(*inbox);
+	drain(self.external);
+
+	const size_t completed = self.ctx->poll();
+	if (completed != 0)
+		self.completed.fetch_add(completed, std::memory_order_release);
+
+	return submitted + completed != 0;
+}
+
+bool sharded_executor::quiescent() const noexcept
+{
+	// A completion handler may submit to another shard, which is counted before the handler's own completion.
+	// Two identical balanced snapshots in a row mean nothing happened in between.
+	const auto snapshot = [this] {
+		std::vector<size_t> counts;
+		counts.reserve(_shards.size() * 2);
+		for (const auto& s : _shards)
+		{
+			counts.push_back(s->submitted.load(std::memory_order_acquire));
+			counts.push_back(s->completed.load(std::memory_order_acquire));
+		}
+		return counts;
+	};
+
+	const auto first = snapshot();
+	size_t submitted = 0, completed = 0;
+	for (size_t i = 0; i < first.size(); i += 2)
+	{
+		submitted += first[i];
+		completed += first[i + 1];
+	}
+
+	return submitted == completed && snapshot() == first;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "async_io.hpp"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace thin_io {
+
+struct sharded_executor_options {
+	unsigned shards = 0; // 0 for one per CPU
+	bool pin_threads = true; // Shard i runs on CPU i (modulo the number of CPUs)
+	size_t queue_capacity = 256; // Of each of the shard-to-shard queues
+	io_context_options context; // For the io_context each shard owns
+};
+
+// Thread-per-core executor: every shard is a thread with its own io_context (its own io_uring ring), optionally pinned to a CPU.
+// Requests reach a shard through lock-free single-producer single-consumer queues, one for every (source shard, target shard) pair,
+// so a shard thread submitting to any shard takes no lock and no shared counter.
+// Threads that are not shards have one more queue per shard, serialized by a mutex on the producer side only.
+// Completion handlers run on the shard that executed the request.
+//
+// With the thread pool fallback, every shard gets its own pool of context.pool_threads threads.
+class sharded_executor {
+public:
+	explicit sharded_executor(const sharded_executor_options& options = {}) noexcept;
+	// Waits for all the submitted requests, including the ones submitted by completion handlers, to complete
+	~sharded_executor() noexcept;
+
+	sharded_executor(const sharded_executor&) = delete;
+	sharded_executor& operator=(const sharded_executor&) = delete;
+
+	// Executed by the current shard when called from a shard thread, otherwise by the shards in turn
+	void submit(io_request& request) noexcept;
+	void submit(unsigned shard, io_request& request) noexcept;
+
+	// Fewer than requested if not all the threads could be started. With none, the requests are cancelled by submit().
+	[[nodiscard]] unsigned shard_count() const noexcept { return static_cast<unsigned>(_shards.size()); }
+	// The shard the calling thread runs, nothing if it is not one of this executor's threads
+	[[nodiscard]] std::optional<unsigned> current_shard() const noexcept;
+	// true if every shard thread is pinned to a CPU
+	[[nodiscard]] bool pinned() const noexcept;
+
+private:
+	struct shard;
+
+	void run_shard(shard& self) noexcept;
+	// One non-blocking pass over the shard's queues and completions, returns true if anything was done
+	bool step(shard& self) noexcept;
+	[[nodiscard]] bool quiescent() const noexcept;
+
+private:
+	std::vector<std::unique_ptr<shard>> _shards;
+	std::atomic<unsigned> _nextShard{0};
+};
+
+} // namespace thin_io
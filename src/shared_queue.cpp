@@ -0,0 +1,287 @@
+#include "shared_queue.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+#ifndef _WIN32
+#include <errno.h>
+#endif
+
+using namespace thin_io;
+
+namespace {
+
+constexpr uint64_t min_capacity = 4096;
+constexpr uint64_t max_capacity = 512 * 1024 * 1024; // A gap must fit in the frame length bits
+
+// Never shrinks the file, in case it's an existing queue
+[[nodiscard]] bool grow(file& f, uint64_t size) noexcept
+{
+	const auto currentSize = f.size();
+	if (!currentSize)
+		return false;
+	if (*currentSize >= size || f.preallocate(*currentSize, size - *currentSize))
+		return true;
+
+#ifndef _WIN32
+	// Not supported by the filesystem or the kernel: leaving the file sparse
+	const int ec = file::error_code();
+	if (ec == EOPNOTSUPP || ec == ENOSYS)
+		return f.truncate(size);
+#endif
+	return false;
+}
+
+[[nodiscard]] std::chrono::milliseconds remaining(std::chrono::steady_clock::time_point deadline) noexcept
+{
+	return std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+}
+
+} // namespace
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free, "Required to share them between processes");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Used as a futex word");
+
+shared_queue::~shared_queue() noexcept
+{
+	close();
+}
+
+shared_queue::shared_queue(shared_queue&& other) noexcept :
+	_file{std::move(other._file)},
+	_header{std::exchange(other._header, nullptr)},
+	_data{std::exchange(other._data, nullptr)},
+	_mask{std::exchange(other._mask, 0)},
+	_cachedHead{std::exchange(other._cachedHead, 0)}
+{}
+
+shared_queue& shared_queue::operator=(shared_queue&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		_file = std::move(other._file);
+		_header = std::exchange(other._header, nullptr);
+		_data = std::exchange(other._data, nullptr);
+		_mask = std::exchange(other._mask, 0);
+		_cachedHead = std::exchange(other._cachedHead, 0);
+	}
+	return *this;
+}
+
+bool shared_queue::open(const char* path, uint64_t capacity) noexcept
+{
+	if (is_open())
+		close();
+
+	capacity = std::clamp(std::bit_ceil(capacity), min_capacity, max_capacity);
+
+	constexpr auto shared = static_cast<file::sharing_mode>(std::to_underlying(file::sharing_mode::ShareRead) | std::to_underlying(file::sharing_mode::ShareWrite));
+	file f = file::open_file(path, file::open_mode::ReadWrite, file::sys_cache_mode::CachingEnabled, shared);
+	if (!f || !lock_for_init(f))
+		return false;
+
+	const bool initialized = initialize(f, capacity);
+	unlock_for_init(f);
+	if (!initialized)
+		return false;
+
+	auto* mapped = static_cast<std::byte*>(f.mmap(file::mmap_access_mode::ReadWrite, 0, data_offset + capacity));
+	if (!mapped)
+		return false;
+
+	_file = std::move(f);
+	_header = reinterpret_cast<header*>(mapped);
+	_data = mapped + data_offset;
+	_mask = capacity - 1;
+	_cachedHead = _header->head.load(std::memory_order_acquire);
+	return true;
+}
+
+bool shared_queue::initialize(file& f, uint64_t& capacity) noexcept
+{
+	if (!grow(f, data_offset))
+		return false;
+
+	auto* h = static_cast<header*>(f.mmap(file::mmap_access_mode::ReadWrite, 0, data_offset));
+	if (!h)
+		return false;
+
+	bool ok = true;
+	if (h->state.load(std::memory_order_acquire) != header::Ready)
+	{
+		// New, or left Initializing by a creator that died since: the lock has been released with it
+		h->state.store(header::Initializing, std::memory_order_relaxed);
+		ok = grow(f, data_offset + capacity);
+		if (ok)
+		{
+			h->version = header::current_version;
+			h->magic = header::magic_value;
+			h->capacity = capacity;
+			h->state.store(header::Ready, std::memory_order_release);
+		}
+	}
+	else
+	{
+		const auto fileSize = f.size();
+		ok = h->magic == header::magic_value && h->version == header::current_version
+			&& std::has_single_bit(h->capacity) && h->capacity >= min_capacity && h->capacity <= max_capacity
+			&& fileSize && *fileSize >= data_offset + h->capacity;
+		if (ok)
+			capacity = h->capacity;
+	}
+
+	return f.unmap(h) && ok;
+}
+
+bool shared_queue::close() noexcept
+{
+	if (!is_open())
+		return false;
+
+	_header = nullptr;
+	_data = nullptr;
+	_mask = 0;
+	_cachedHead = 0;
+	return _file.close(); // Unmaps
+}
+
+bool shared_queue::try_push(const void* data, size_t size) noexcept
+{
+	if (size > max_message_size())
+		return false;
+
+	const uint64_t cap = capacity();
+	const uint64_t frameSize = frame_size(size);
+	uint64_t pos = _header->reserved.load(std::memory_order_relaxed);
+	uint64_t padding = 0;
+	do
+	{
+		// A frame doesn't wrap around: the rest of the lap becomes a gap if needed
+		const uint64_t offset = pos & _mask;
+		padding = cap - offset < frameSize ? cap - offset : 0;
+		const uint64_t end = pos + padding + frameSize;
+		if (end - _cachedHead > cap)
+		{
+			_cachedHead = _header->head.load(std::memory_order_acquire);
+			if (end - _cachedHead > cap)
+				return false;
+		}
+	} while (!_header->reserved.compare_exchange_weak(pos, pos + padding + frameSize, std::memory_order_relaxed));
+
+	std::byte* frame = _data + ((pos + padding) & _mask);
+	::memcpy(frame + frame_header_size, data, size);
+	if (padding != 0)
+		frame_word(_data + (pos & _mask)).store(committed_flag | padding_flag | static_cast<uint32_t>(padding), std::memory_order_release);
+	frame_word(frame).store(committed_flag | static_cast<uint32_t>(size), std::memory_order_release);
+
+	notify_data();
+	return true;
+}
+
+bool shared_queue::push(const void* data, size_t size, std::chrono::milliseconds timeout) noexcept
+{
+	if (size > max_message_size())
+		return false;
+
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	for (;;)
+	{
+		if (try_push(data, size))
+			return true;
+
+		// Registering as a waiter, then checking again: the consumer either sees the registration or made space before it
+		const uint32_t signal = _header->spaceSignal.load(std::memory_order_relaxed);
+		_header->producersWaiting.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		const bool pushed = try_push(data, size);
+		const auto left = remaining(deadline);
+		if (!pushed && left.count() > 0)
+			wait_on(_header->spaceSignal, signal, left);
+		_header->producersWaiting.fetch_sub(1, std::memory_order_relaxed);
+
+		if (pushed)
+			return true;
+		if (left.count() <= 0)
+			return false;
+	}
+}
+
+bool shared_queue::empty() const noexcept
+{
+	const uint64_t head = _header->head.load(std::memory_order_acquire);
+	return (frame_word(_data + (head & _mask)).load(std::memory_order_acquire) & committed_flag) == 0;
+}
+
+uint64_t shared_queue::used_bytes() const noexcept
+{
+	const uint64_t head = _header->head.load(std::memory_order_acquire);
+	return _header->reserved.load(std::memory_order_acquire) - head;
+}
+
+uint64_t shared_queue::recover() noexcept
+{
+	const uint64_t reserved = _header->reserved.load(std::memory_order_acquire);
+	uint64_t pos = _header->head.load(std::memory_order_relaxed);
+	while (pos < reserved)
+	{
+		const uint32_t word = frame_word(_data + (pos & _mask)).load(std::memory_order_acquire);
+		if ((word & committed_flag) == 0)
+			break;
+
+		pos += (word & padding_flag) != 0 ? (word & length_mask) : frame_size(word & length_mask);
+	}
+
+	// The rest becomes gaps, one per lap
+	const uint64_t skipped = reserved - pos;
+	while (pos < reserved)
+	{
+		std::byte* frame = _data + (pos & _mask);
+		const uint64_t n = std::min(reserved - pos, capacity() - (pos & _mask));
+		::memset(frame, 0, static_cast<size_t>(n));
+		frame_word(frame).store(committed_flag | padding_flag | static_cast<uint32_t>(n), std::memory_order_release);
+		pos += n;
+	}
+
+	_header->producersWaiting.store(0, std::memory_order_relaxed);
+	notify_data();
+	return skipped;
+}
+
+void shared_queue::notify_data() noexcept
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_header->consumerWaiting.load(std::memory_order_relaxed) != 0)
+	{
+		_header->dataSignal.fetch_add(1, std::memory_order_relaxed);
+		wake_all(_header->dataSignal);
+	}
+}
+
+void shared_queue::notify_space() noexcept
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_header->producersWaiting.load(std::memory_order_relaxed) != 0)
+	{
+		_header->spaceSignal.fetch_add(1, std::memory_order_relaxed);
+		wake_all(_header->spaceSignal);
+	}
+}
+
+bool shared_queue::wait_for_data(std::chrono::steady_clock::time_point deadline) noexcept
+{
+	// Same handshake as push()
+	const uint32_t signal = _header->dataSignal.load(std::memory_order_relaxed);
+	_header->consumerWaiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	const bool ready = !empty();
+	const auto left = remaining(deadline);
+	if (!ready && left.count() > 0)
+		wait_on(_header->dataSignal, signal, left);
+	_header->consumerWaiting.store(0, std::memory_order_relaxed);
+
+	return ready || left.count() > 0;
+}
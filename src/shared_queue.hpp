@@ -0,0 +1,168 @@
+#pragma once
+#include "file.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace thin_io {
+
+// Lock-free message queue between processes, living in a file that every side maps: any number of producers, one consumer.
+// Messages are variable-length byte strings, copied into the queue by the producer and handed to the consumer in place.
+//
+// The indexes live in the file too, so either side can be restarted and reopen the queue where it was: pending messages
+// are kept. A consumer killed while handling a message gets it again (at-least-once). A producer killed in the middle of
+// a push leaves a gap that blocks the consumer; call recover() once no producer is running.
+//
+// The blocking calls sleep on futexes in the shared mapping on Linux; elsewhere they poll.
+// A shared_queue object is used by one thread: every thread opens its own.
+class shared_queue {
+public:
+	shared_queue() noexcept = default;
+	~shared_queue() noexcept;
+
+	shared_queue(shared_queue&& other) noexcept;
+	shared_queue& operator=(shared_queue&& other) noexcept;
+
+	// Creates the queue file, or attaches to the existing one, in which case its capacity is kept.
+	// The capacity is in bytes, rounded up to a power of 2 between 4 KiB and 512 MiB.
+	bool open(const char* path, uint64_t capacity) noexcept;
+	bool close() noexcept;
+	[[nodiscard]] inline bool is_open() const noexcept { return _header != nullptr; }
+
+	[[nodiscard]] inline uint64_t capacity() const noexcept { return _mask + 1; }
+	// Larger messages are rejected
+	[[nodiscard]] inline size_t max_message_size() const noexcept { return static_cast<size_t>(capacity() / 2 - frame_header_size); }
+
+	// Producer side. false if the queue is full or the message too large.
+	[[nodiscard]] bool try_push(const void* data, size_t size) noexcept;
+	[[nodiscard]] inline bool try_push(std::span<const std::byte> message) noexcept { return try_push(message.data(), message.size()); }
+	// Waits up to timeout for space
+	[[nodiscard]] bool push(const void* data, size_t size, std::chrono::milliseconds timeout) noexcept;
+
+	// Consumer side. Calls f(std::span<const std::byte>) with the oldest message, which is released when f returns.
+	// false if there is none.
+	template <typename F>
+	[[nodiscard]] inline bool try_pop(F&& f) noexcept
+	{
+		for (;;)
+		{
+			const uint64_t head = _header->head.load(std::memory_order_relaxed);
+			std::byte* frame = _data + (head & _mask);
+			const uint32_t word = frame_word(frame).load(std::memory_order_acquire);
+			if ((word & committed_flag) == 0)
+				return false;
+
+			const bool padding = (word & padding_flag) != 0;
+			const uint32_t length = word & length_mask;
+			const uint64_t frameSize = padding ? length : frame_size(length);
+			if (!padding)
+				f(std::span<const std::byte>{frame + frame_header_size, length});
+
+			// The producers expect the frames they reserve to be zero
+			::memset(frame, 0, static_cast<size_t>(frameSize));
+			_header->head.store(head + frameSize, std::memory_order_release);
+			notify_space();
+
+			if (!padding)
+				return true;
+		}
+	}
+
+	// Waits up to timeout for a message
+	template <typename F>
+	[[nodiscard]] inline bool pop(F&& f, std::chrono::milliseconds timeout) noexcept
+	{
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (!try_pop(f))
+		{
+			if (!wait_for_data(deadline))
+				return false;
+		}
+		return true;
+	}
+
+	// Approximate unless called by the consumer
+	[[nodiscard]] bool empty() const noexcept;
+	// Bytes reserved by the producers and not released by the consumer yet, framing included
+	[[nodiscard]] uint64_t used_bytes() const noexcept;
+
+	// To be called by the consumer when no producer is running: turns the pushes that were interrupted into gaps it skips.
+	// Messages pushed after the first interrupted one are lost. Returns the number of bytes skipped.
+	uint64_t recover() noexcept;
+
+private:
+	// At the start of the file, followed by the data. The file starts zeroed, which is a valid state for every field.
+	struct header {
+		static constexpr uint64_t magic_value = 0x45'55'45'55'51'4F'49'54; // "TIOQUEUE"
+		static constexpr uint32_t current_version = 1;
+		enum : uint32_t {New = 0, Initializing = 1, Ready = 2};
+
+		std::atomic<uint32_t> state; // Written under the initialization lock, Ready once the queue is usable
+		uint32_t version;
+		uint64_t magic;
+		uint64_t capacity;
+
+		alignas(64) std::atomic<uint64_t> reserved; // Producers: end of the last reserved frame
+		alignas(64) std::atomic<uint64_t> head; // Consumer: start of the oldest frame not released
+
+		// Futex words, bumped when the other side may be waiting
+		alignas(64) std::atomic<uint32_t> dataSignal;
+		std::atomic<uint32_t> consumerWaiting;
+		alignas(64) std::atomic<uint32_t> spaceSignal;
+		std::atomic<uint32_t> producersWaiting;
+	};
+
+	static constexpr uint64_t data_offset = sizeof(header);
+
+public:
+	// Where the header fields are in the file, for the tools that inspect or repair a queue file
+	static constexpr uint64_t state_offset = offsetof(header, state);
+	static constexpr uint64_t reserved_offset = offsetof(header, reserved);
+
+private:
+
+	static constexpr uint32_t committed_flag = 1u << 31;
+	static constexpr uint32_t padding_flag = 1u << 30;
+	static constexpr uint32_t length_mask = padding_flag - 1;
+	static constexpr uint64_t frame_header_size = 8;
+
+	[[nodiscard]] static constexpr uint64_t frame_size(uint64_t length) noexcept
+	{
+		return (frame_header_size + length + 7) & ~uint64_t{7};
+	}
+
+	[[nodiscard]] static inline std::atomic_ref<uint32_t> frame_word(std::byte* frame) noexcept
+	{
+		return std::atomic_ref<uint32_t>{*reinterpret_cast<uint32_t*>(frame)};
+	}
+
+	// Called with the initialization lock held: sets the header up unless it is Ready, validates it otherwise.
+	// capacity is the one requested on input, the queue's on output. Leaves the file unmapped.
+	[[nodiscard]] static bool initialize(file& f, uint64_t& capacity) noexcept;
+
+	void notify_data() noexcept;
+	void notify_space() noexcept;
+	// false if the deadline has passed and there is still no data
+	bool wait_for_data(std::chrono::steady_clock::time_point deadline) noexcept;
+
+	// Platform-specific: sleeps while word == expected, for up to timeout; may return early
+	static void wait_on(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::milliseconds timeout) noexcept;
+	static void wake_all(std::atomic<uint32_t>& word) noexcept;
+	// Platform-specific: exclusive lock on the file between the processes opening the queue, waits for it.
+	// Released by the system if the holder dies, so that a creator that dies while initializing doesn't block the queue for good.
+	[[nodiscard]] static bool lock_for_init(file& f) noexcept;
+	static void unlock_for_init(file& f) noexcept;
+
+private:
+	file _file;
+	header* _header = nullptr;
+	std::byte* _data = nullptr;
+	uint64_t _mask = 0;
+	uint64_t _cachedHead = 0; // Producer's last view of header::head
+};
+
+} // namespace thin_io
@@ -0,0 +1,53 @@
+#include "shared_queue.hpp"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <algorithm>
+#include <thread>
+#endif
+
+#include <errno.h>
+#include <sys/file.h>
+
+using namespace thin_io;
+
+void shared_queue::wait_on(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::milliseconds timeout) noexcept
+{
+#ifdef __linux__
+	const timespec ts{.tv_sec = static_cast<time_t>(timeout.count() / 1000), .tv_nsec = static_cast<long>(timeout.count() % 1000 * 1'000'000)};
+	// Not FUTEX_PRIVATE_FLAG: the waker is in another process
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+	// No futex shared between processes here
+	if (word.load(std::memory_order_acquire) == expected)
+		std::this_thread::sleep_for(std::min(timeout, std::chrono::milliseconds{1}));
+#endif
+}
+
+void shared_queue::wake_all(std::atomic<uint32_t>& word) noexcept
+{
+#ifdef __linux__
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+	(void)word;
+#endif
+}
+
+// flock() rather than fcntl() locks: it's per open file, so that the threads of a process exclude each other too
+bool shared_queue::lock_for_init(file& f) noexcept
+{
+	int result = 0;
+	do
+		result = ::flock(f.native_handle(), LOCK_EX);
+	while (result != 0 && errno == EINTR);
+	return result == 0;
+}
+
+void shared_queue::unlock_for_init(file& f) noexcept
+{
+	::flock(f.native_handle(), LOCK_UN);
+}
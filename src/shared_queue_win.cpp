@@ -0,0 +1,44 @@
+#include "shared_queue.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include <Windows.h>
+
+using namespace thin_io;
+
+// WaitOnAddress() only works within a process: polling
+void shared_queue::wait_on(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::milliseconds timeout) noexcept
+{
+	if (word.load(std::memory_order_acquire) == expected)
+		std::this_thread::sleep_for(std::min(timeout, std::chrono::milliseconds{1}));
+}
+
+void shared_queue::wake_all(std::atomic<uint32_t>& /*word*/) noexcept
+{
+}
+
+namespace {
+
+// LockFileEx() locks are mandatory for ReadFile()/WriteFile(): the locked byte is far past the end of any queue
+constexpr DWORD init_lock_offset_high = 0x7FFF'FFFF;
+
+} // namespace
+
+bool shared_queue::lock_for_init(file& f) noexcept
+{
+	OVERLAPPED overlapped{};
+	overlapped.OffsetHigh = init_lock_offset_high;
+	if (::LockFileEx(f.native_handle(), LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+		return true;
+
+	DWORD unused = 0;
+	return ::GetLastError() == ERROR_IO_PENDING && ::GetOverlappedResult(f.native_handle(), &overlapped, &unused, TRUE);
+}
+
+void shared_queue::unlock_for_init(file& f) noexcept
+{
+	OVERLAPPED overlapped{};
+	overlapped.OffsetHigh = init_lock_offset_high;
+	::UnlockFileEx(f.native_handle(), 0, 1, 0, &overlapped);
+}
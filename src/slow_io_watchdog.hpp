@@ -0,0 +1,236 @@
+#pragma once
+#include "file_decorator.hpp"
+#include "io_stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace thin_io {
+
+struct slow_io_event {
+	file_op op = file_op::Read;
+	std::string path; // Empty for attached handles
+	uint64_t offset = ~uint64_t{0}; // ~0 for the calls that don't take one
+	uint64_t size = 0;
+	std::chrono::nanoseconds duration{0};
+	std::chrono::system_clock::time_point when; // Completion time
+	bool failed = false;
+};
+
+// Per-operation latency thresholds, a callback for the calls that exceed them and a log of the slowest ones.
+// Shared by any number of watched<Impl> files; the calls under the threshold cost two steady_clock reads and one relaxed load.
+class slow_io_watchdog {
+public:
+	using callback = std::function<void(const slow_io_event&)>;
+
+	inline explicit slow_io_watchdog(size_t worstEventsKept = 32) noexcept : _worstKept{worstEventsKept} {}
+
+	// 0 (the default) disables the check for op
+	inline void set_threshold(file_op op, std::chrono::nanoseconds threshold) noexcept
+	{
+		_thresholds[static_cast<size_t>(op)].store(threshold.count(), std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] inline std::chrono::nanoseconds threshold(file_op op) const noexcept
+	{
+		return std::chrono::nanoseconds{_thresholds[static_cast<size_t>(op)].load(std::memory_order_relaxed)};
+	}
+
+	// Called on the thread that made the slow call, after it has completed. Several may run at once.
+	// An exception thrown by the callback is ignored.
+	inline void set_callback(callback cb) noexcept
+	{
+		std::lock_guard lock{_mutex};
+		_callback = cb ? std::make_shared<const callback>(std::move(cb)) : nullptr;
+	}
+
+	// The offset is ~0 for calls that don't take one
+	inline void check(file_op op, const std::string& path, uint64_t offset, uint64_t size, std::chrono::nanoseconds duration, bool failed) noexcept
+	{
+		const int64_t limit = _thresholds[static_cast<size_t>(op)].load(std::memory_order_relaxed);
+		if (limit == 0 || duration.count() <= limit) [[likely]]
+			return;
+
+		slow_io_event e;
+		e.op = op;
+		e.path = path;
+		e.offset = offset;
+		e.size = size;
+		e.duration = duration;
+		e.when = std::chrono::system_clock::now();
+		e.failed = failed;
+
+		std::shared_ptr<const callback> cb;
+		{
+			std::lock_guard lock{_mutex};
+			++_breaches;
+			cb = _callback;
+			keep_if_among_worst(e);
+		}
+
+		if (!cb)
+			return;
+
+		// Called from noexcept file calls: an exception would terminate the program
+		try
+		{
+			(*cb)(e);
+		}
+		catch (...)
+		{
+		}
+	}
+
+	// The slowest events so far, slowest first
+	[[nodiscard]] inline std::vector<slow_io_event> worst_events() const noexcept
+	{
+		std::vector<slow_io_event> events;
+		{
+			std::lock_guard lock{_mutex};
+			events = _worst;
+		}
+		std::sort(events.begin(), events.end(), [](const slow_io_event& a, const slow_io_event& b) {
+			return a.duration > b.duration;
+		});
+		return events;
+	}
+
+	// Number of calls over the threshold, including the ones that did not make it into worst_events()
+	[[nodiscard]] inline uint64_t breaches() const noexcept
+	{
+		std::lock_guard lock{_mutex};
+		return _breaches;
+	}
+
+	inline void clear() noexcept
+	{
+		std::lock_guard lock{_mutex};
+		_worst.clear();
+		_breaches = 0;
+	}
+
+private:
+	// _worst is a min-heap on the duration: the fastest of the kept events is evicted first
+	inline void keep_if_among_worst(slow_io_event& e) noexcept
+	{
+		static constexpr auto faster = [](const slow_io_event& a, const slow_io_event& b) {
+			return a.duration > b.duration;
+		};
+
+		if (_worstKept == 0)
+			return;
+
+		if (_worst.size() == _worstKept)
+		{
+			if (_worst.front().duration >= e.duration)
+				return;
+
+			std::pop_heap(_worst.begin(), _worst.end(), faster);
+			_worst.pop_back();
+		}
+
+		_worst.push_back(e);
+		std::push_heap(_worst.begin(), _worst.end(), faster);
+	}
+
+private:
+	std::array<std::atomic<int64_t>, file_op_count> _thresholds {};
+
+	mutable std::mutex _mutex;
+	std::shared_ptr<const callback> _callback;
+	std::vector<slow_io_event> _worst;
+	const size_t _worstKept;
+	uint64_t _breaches = 0;
+};
+
+// file_impl decorator that times reads, writes and syncs and reports the slow ones to a slow_io_watchdog.
+// Remembers the path it was opened with for the reports.
+template <file_backend Impl>
+class [[nodiscard]] watched final : public file_decorator<Impl> {
+public:
+	inline void set_watchdog(std::shared_ptr<slow_io_watchdog> watchdog) noexcept { _watchdog = std::move(watchdog); }
+	[[nodiscard]] inline const std::shared_ptr<slow_io_watchdog>& watchdog() const noexcept { return _watchdog; }
+	[[nodiscard]] inline const std::string& path() const noexcept { return _path; }
+
+	inline bool open(const char* path, file_constants::open_mode openMode, file_constants::sys_cache_mode cacheMode, file_constants::sharing_mode sharingMode) noexcept {
+		const bool opened = this->_impl.open(path, openMode, cacheMode, sharingMode);
+		if (opened)
+			_path = path;
+		else
+			_path.clear();
+		return opened;
+	}
+
+	// Anonymous files are reported with no path
+	inline bool open_anonymous(const char* name, const anonymous_file_options& options) noexcept {
+		_path.clear();
+		return this->_impl.open_anonymous(name, options);
+	}
+
+	inline bool attach(typename Impl::native_handle_type h) noexcept {
+		_path.clear();
+		return this->_impl.attach(h);
+	}
+
+	inline bool close() noexcept {
+		const bool closed = this->_impl.close();
+		if (closed)
+			_path.clear();
+		return closed;
+	}
+
+	inline std::optional<uint64_t> read(void* dest, uint64_t size) noexcept {
+		return watch(file_op::Read, ~uint64_t{0}, size, [&] { return this->_impl.read(dest, size); });
+	}
+
+	inline std::optional<uint64_t> write(const void* src, uint64_t size) noexcept {
+		return watch(file_op::Write, ~uint64_t{0}, size, [&] { return this->_impl.write(src, size); });
+	}
+
+	inline std::optional<uint64_t> pread(void* dest, uint64_t size, uint64_t pos) noexcept {
+		return watch(file_op::Pread, pos, size, [&] { return this->_impl.pread(dest, size, pos); });
+	}
+
+	inline std::optional<uint64_t> pwrite(const void* src, uint64_t size, uint64_t pos) noexcept {
+		return watch(file_op::Pwrite, pos, size, [&] { return this->_impl.pwrite(src, size, pos); });
+	}
+
+	[[nodiscard]] inline bool fsync() noexcept {
+		return watch(file_op::Fsync, ~uint64_t{0}, 0, [this] { return this->_impl.fsync(); });
+	}
+
+	[[nodiscard]] inline bool fdatasync() noexcept {
+		return watch(file_op::Fdatasync, ~uint64_t{0}, 0, [this] { return this->_impl.fdatasync(); });
+	}
+
+private:
+	template <typename Op>
+	inline auto watch(file_op op, uint64_t offset, uint64_t size, Op&& call) noexcept
+	{
+		if (!_watchdog)
+			return call();
+
+		const auto start = std::chrono::steady_clock::now();
+		const auto result = call();
+		const auto duration = std::chrono::steady_clock::now() - start;
+
+		_watchdog->check(op, _path, offset, size, duration, !this->transferred(result));
+		return result;
+	}
+
+private:
+	std::shared_ptr<slow_io_watchdog> _watchdog;
+	std::string _path;
+};
+
+} // namespace thin_io
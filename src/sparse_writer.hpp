@@ -0,0 +1,240 @@
+#pragma once
+#include <optional>
+#include <cstddef>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+namespace thin_io {
+
+// true if all the bytes of the buffer are 0
+[[nodiscard]] inline bool is_zero_block(const void* data, size_t size) noexcept
+{
+	const auto* p = static_cast<const unsigned char*>(data);
+	const auto* const end = p + size;
+
+	// 64 bytes per iteration, exit as soon as a non-zero chunk is found
+#if defined(__AVX2__)
+	for (; end - p >= 64; p += 64)
+	{
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+		const __m256i v = _mm256_or_si256(a, b);
+		if (!_mm256_testz_si256(v, v))
+			return false;
+	}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	const __m128i zero = _mm_setzero_si128();
+	for (; end - p >= 64; p += 64)
+	{
+		const __m128i a = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)));
+		const __m128i b = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), zero)) != 0xFFFF)
+			return false;
+	}
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	for (; end - p >= 64; p += 64)
+	{
+		const uint8x16_t a = vorrq_u8(vld1q_u8(p), vld1q_u8(p + 16));
+		const uint8x16_t b = vorrq_u8(vld1q_u8(p + 32), vld1q_u8(p + 48));
+		if (vmaxvq_u8(vorrq_u8(a, b)) != 0)
+			return false;
+	}
+#else
+	for (; end - p >= 64; p += 64)
+	{
+		uint64_t words[8];
+		::memcpy(words, p, sizeof(words));
+		if ((words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7]) != 0)
+			return false;
+	}
+#endif
+
+	for (; p != end; ++p)
+	{
+		if (*p != 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Sequential writer that does not store blocks of zeros.
+// The output is split at file offsets that are multiples of blockSize (should match the filesystem block size, 0 is taken as 1),
+// partial blocks are buffered until complete. An all-zero block past the original end of the file is skipped over,
+// and one within the original file is punched out.
+// finish() must be called at the end to write the buffered tail and extend the file over the trailing holes.
+// The data past the written range is kept unless finish(true) cuts the file there.
+//
+// Writes are positional and do not use or change the file position (except on Win32, see file_interface::pwrite).
+template <class File>
+class [[nodiscard]] sparse_writer {
+public:
+	inline explicit sparse_writer(File& f, uint64_t startPos = 0, uint64_t blockSize = 4096) noexcept :
+		_file{f},
+		_originalSize{f.size().value_or(0)},
+		_blockSize{blockSize != 0 ? blockSize : 1},
+		_pos{startPos},
+		_pending(static_cast<size_t>(_blockSize))
+	{
+		_file.set_sparse();
+	}
+
+	// Returns size, or nothing in case of an error
+	inline std::optional<uint64_t> write(const void* src, const uint64_t size) noexcept
+	{
+		const auto* data = static_cast<const std::byte*>(src);
+		uint64_t remaining = size;
+		while (remaining != 0)
+		{
+			const uint64_t toBoundary = _blockSize - (_pos + _pendingSize) % _blockSize;
+			if (_pendingSize == 0 && remaining >= toBoundary)
+			{
+				// Straight from the source, up to the last block boundary
+				const uint64_t n = toBoundary + (remaining - toBoundary) / _blockSize * _blockSize;
+				if (!store(data, n))
+					return {};
+
+				data += n;
+				remaining -= n;
+			}
+			else
+			{
+				const uint64_t n = toBoundary < remaining ? toBoundary : remaining;
+				::memcpy(_pending.data() + _pendingSize, data, static_cast<size_t>(n));
+				_pendingSize += n;
+				data += n;
+				remaining -= n;
+
+				if (n == toBoundary)
+				{
+					if (!store(_pending.data(), _pendingSize))
+						return {};
+					_pendingSize = 0;
+				}
+			}
+		}
+
+		return size;
+	}
+
+	// Writes out the buffered partial block and extends the file to the end of the written data.
+	// truncateAtEnd: the file ends there, what was past it is dropped.
+	[[nodiscard]] inline bool finish(bool truncateAtEnd = false) noexcept
+	{
+		if (_pendingSize != 0)
+		{
+			// A trailing zero tail beyond the original EOF is covered by truncate
+			if (_pos < _originalSize || !is_zero_block(_pending.data(), static_cast<size_t>(_pendingSize)))
+			{
+				if (!write_all(_pending.data(), _pendingSize))
+					return false;
+			}
+			else
+				_bytesSkipped += _pendingSize;
+
+			_pos += _pendingSize;
+			_pendingSize = 0;
+		}
+
+		if (truncateAtEnd)
+			return _file.truncate(_pos);
+
+		const auto size = _file.size();
+		if (!size)
+			return false;
+		return *size >= _pos || _file.truncate(_pos);
+	}
+
+	// The logical position, including the buffered data
+	[[nodiscard]] inline uint64_t pos() const noexcept { return _pos + _pendingSize; }
+	[[nodiscard]] inline uint64_t bytes_written() const noexcept { return _bytesWritten; }
+	[[nodiscard]] inline uint64_t bytes_skipped() const noexcept { return _bytesSkipped; }
+
+private:
+	// Stores the data at _pos. Only whole aligned blocks can become holes.
+	inline bool store(const std::byte* data, const uint64_t length) noexcept
+	{
+		const uint64_t startPos = _pos;
+		const auto chunkLength = [&](uint64_t offset) {
+			const uint64_t toBlockEnd = _blockSize - (startPos + offset) % _blockSize;
+			return toBlockEnd < length - offset ? toBlockEnd : length - offset;
+		};
+		const auto isZeroChunk = [this](const std::byte* chunk, uint64_t chunkSize) {
+			return chunkSize == _blockSize && is_zero_block(chunk, static_cast<size_t>(chunkSize));
+		};
+
+		uint64_t done = 0;
+		uint64_t chunk = chunkLength(0);
+		bool zero = isZeroChunk(data, chunk);
+		while (done < length)
+		{
+			// Coalesce consecutive data or zero chunks into a single write / hole
+			const bool runIsZero = zero;
+			uint64_t runLength = 0;
+			do {
+				runLength += chunk;
+				if (done + runLength == length)
+					break;
+
+				chunk = chunkLength(done + runLength);
+				zero = isZeroChunk(data + done + runLength, chunk);
+			} while (zero == runIsZero);
+
+			if (!(runIsZero ? store_hole(data + done, runLength) : write_all(data + done, runLength)))
+				return false;
+
+			_pos += runLength;
+			done += runLength;
+		}
+
+		return true;
+	}
+
+	inline bool store_hole(const std::byte* zeros, uint64_t length) noexcept
+	{
+		// Past the original EOF nothing has been written yet, the range is already a hole
+		if (_pos < _originalSize)
+		{
+			const uint64_t overlap = _originalSize - _pos < length ? _originalSize - _pos : length;
+			if (!_file.punch_hole(_pos, overlap))
+				return write_all(zeros, length); // Not supported - store the zeros
+		}
+
+		_bytesSkipped += length;
+		return true;
+	}
+
+	// Writes at _pos, retrying short writes
+	inline bool write_all(const std::byte* data, uint64_t length) noexcept
+	{
+		for (uint64_t done = 0; done < length; )
+		{
+			const auto written = _file.pwrite(data + done, length - done, _pos + done);
+			if (!written || *written == 0) [[unlikely]]
+				return false;
+
+			done += *written;
+			_bytesWritten += *written;
+		}
+		return true;
+	}
+
+private:
+	File& _file;
+	const uint64_t _originalSize;
+	const uint64_t _blockSize;
+	uint64_t _pos; // Where the next store() goes, the buffered data is not included
+	std::vector<std::byte> _pending;
+	uint64_t _pendingSize = 0;
+	uint64_t _bytesWritten = 0;
+	uint64_t _bytesSkipped = 0;
+};
+
+} // namespace thin_io
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <optional>
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+
+namespace thin_io {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Each side keeps a cached copy of the other side's index and only reads the shared one when the cache says full / empty,
+// so in the steady state the two threads don't touch each other's cache lines.
+template <typename T>
+class spsc_queue {
+	static_assert(std::is_nothrow_copy_constructible_v<T> && std::is_nothrow_copy_assignable_v<T>);
+
+public:
+	// The capacity is rounded up to a power of 2
+	inline explicit spsc_queue(size_t capacity) noexcept :
+		_items(round_up_to_power_of_2(capacity)),
+		_mask{_items.size() - 1}
+	{}
+
+	spsc_queue(const spsc_queue&) = delete;
+	spsc_queue& operator=(const spsc_queue&) = delete;
+
+	// Producer only. false if the queue is full.
+	[[nodiscard]] inline bool try_push(const T& item) noexcept
+	{
+		const size_t tail = _producer.tail.load(std::memory_order_relaxed);
+		if (tail - _producer.cachedHead == _items.size())
+		{
+			_producer.cachedHead = _consumer.head.load(std::memory_order_acquire);
+			if (tail - _producer.cachedHead == _items.size())
+				return false;
+		}
+
+		_items[tail & _mask] = item;
+		_producer.tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only
+	[[nodiscard]] inline std::optional<T> try_pop() noexcept
+	{
+		const size_t head = _consumer.head.load(std::memory_order_relaxed);
+		if (head == _consumer.cachedTail)
+		{
+			_consumer.cachedTail = _producer.tail.load(std::memory_order_acquire);
+			if (head == _consumer.cachedTail)
+				return {};
+		}
+
+		T item = _items[head & _mask];
+		_consumer.head.store(head + 1, std::memory_order_release);
+		return item;
+	}
+
+	// Exact when called by the consumer, a snapshot otherwise
+	[[nodiscard]] inline bool empty() const noexcept
+	{
+		return _consumer.head.load(std::memory_order_acquire) == _producer.tail.load(std::memory_order_acquire);
+	}
+
+	[[nodiscard]] inline size_t capacity() const noexcept { return _items.size(); }
+
+private:
+	[[nodiscard]] static constexpr size_t round_up_to_power_of_2(size_t n) noexcept
+	{
+		size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+private:
+	// Not std::hardware_destructive_interference_size: its value is not stable across compiler flags
+	static constexpr size_t cache_line = 64;
+
+	struct alignas(cache_line) {
+		std::atomic<size_t> head{0};
+		size_t cachedTail = 0;
+	} _consumer;
+
+	struct alignas(cache_line) {
+		std::atomic<size_t> tail{0};
+		size_t cachedHead = 0;
+	} _producer;
+
+	std::vector<T> _items;
+	const size_t _mask;
+};
+
+} // namespace thin_io
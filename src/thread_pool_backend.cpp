@@ -0,0 +1,431 @@
+#include "thread_pool_backend.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+using namespace thin_io;
+using namespace thin_io::detail;
+
+namespace {
+
+// eventfd on Linux, a non-blocking self-pipe on other POSIX systems, a manual-reset event on Windows
+class completion_signal {
+public:
+	completion_signal() noexcept = default;
+	completion_signal(const completion_signal&) = delete;
+	completion_signal& operator=(const completion_signal&) = delete;
+	~completion_signal() noexcept;
+
+	bool open() noexcept;
+	void notify() noexcept;
+	void reset() noexcept;
+
+	[[nodiscard]] notification_handle_type handle() const noexcept;
+
+private:
+#ifdef _WIN32
+	HANDLE _event = nullptr;
+#elif defined __linux__
+	int _eventFd = -1;
+#else
+	int _pipe[2] = {-1, -1};
+#endif
+};
+
+completion_signal::~completion_signal() noexcept
+{
+#ifdef _WIN32
+	if (_event)
+		::CloseHandle(_event);
+#elif defined __linux__
+	if (_eventFd != -1)
+		::close(_eventFd);
+#else
+	for (const int fd : _pipe)
+	{
+		if (fd != -1)
+			::close(fd);
+	}
+#endif
+}
+
+bool completion_signal::open() noexcept
+{
+#ifdef _WIN32
+	_event = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	return _event != nullptr;
+#elif defined __linux__
+	_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return _eventFd != -1;
+#else
+	if (::pipe(_pipe) != 0)
+		return false;
+
+	for (const int fd : _pipe)
+	{
+		::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+		::fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return true;
+#endif
+}
+
+void completion_signal::notify() noexcept
+{
+#ifdef _WIN32
+	if (_event)
+		::SetEvent(_event);
+#elif defined __linux__
+	if (_eventFd != -1)
+		(void)::eventfd_write(_eventFd, 1);
+#else
+	const char c = 0;
+	if (_pipe[1] != -1)
+		(void)::write(_pipe[1], &c, 1); // A full pipe is readable already
+#endif
+}
+
+void completion_signal::reset() noexcept
+{
+#ifdef _WIN32
+	if (_event)
+		::ResetEvent(_event);
+#elif defined __linux__
+	eventfd_t value;
+	if (_eventFd != -1)
+		(void)::eventfd_read(_eventFd, &value);
+#else
+	char buffer[64];
+	if (_pipe[0] != -1)
+	{
+		while (::read(_pipe[0], buffer, sizeof(buffer)) > 0)
+			;
+	}
+#endif
+}
+
+notification_handle_type completion_signal::handle() const noexcept
+{
+#ifdef _WIN32
+	return _event;
+#elif defined __linux__
+	return _eventFd;
+#else
+	return _pipe[0];
+#endif
+}
+
+class thread_pool_backend final : public io_backend {
+public:
+	thread_pool_backend(unsigned threads, bool notification) noexcept;
+	~thread_pool_backend() noexcept override;
+
+	void submit(io_request& request) noexcept override;
+	void cancel(io_request& request) noexcept override;
+	void wake() noexcept override;
+	size_t reap(bool wait) noexcept override;
+
+	[[nodiscard]] notification_handle_type notification_handle() const noexcept override { return _signal.handle(); }
+
+private:
+	void worker() noexcept;
+	// With notification only: completes the queued requests when their deadline passes, so that the notification fires
+	// without anyone blocking in reap()
+	void deadline_watcher() noexcept;
+	void complete(io_request& request) noexcept;
+	// Moves the queued requests whose deadline has passed to `expired`, returns the earliest deadline of the remaining ones.
+	// Requires _queueMutex.
+	std::optional<std::chrono::steady_clock::time_point> expire_queued(std::vector<io_request*>& expired) noexcept;
+
+private:
+	std::vector<std::thread> _workers;
+
+	std::mutex _queueMutex;
+	std::condition_variable _queueCv;
+	std::deque<io_request*> _queue;
+	size_t _queuedWithDeadline = 0;
+	bool _shuttingDown = false;
+	std::condition_variable _deadlineCv;
+	std::thread _deadlineWatcher;
+
+	std::mutex _completedMutex;
+	std::condition_variable _completedCv;
+	std::vector<io_request*> _completed;
+	std::vector<io_request*> _dispatching;
+	bool _woken = false;
+
+	completion_signal _signal;
+};
+
+thread_pool_backend::thread_pool_backend(unsigned threads, bool notification) noexcept
+{
+	if (threads == 0)
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	try
+	{
+		if (notification && _signal.open())
+			_deadlineWatcher = std::thread{&thread_pool_backend::deadline_watcher, this};
+
+		_workers.reserve(threads);
+		for (unsigned i = 0; i < threads; ++i)
+			_workers.emplace_back(&thread_pool_backend::worker, this);
+	}
+	catch (const std::system_error&)
+	{
+		// Out of threads: running with the workers that did start, submit() executes the requests itself if none did.
+		// Without the deadline watcher, the queued requests only time out in reap().
+	}
+}
+
+thread_pool_backend::~thread_pool_backend() noexcept
+{
+	std::deque<io_request*> queued;
+	{
+		std::lock_guard lock{_queueMutex};
+		_shuttingDown = true;
+		queued.swap(_queue);
+		_queuedWithDeadline = 0;
+	}
+	_queueCv.notify_all();
+	_deadlineCv.notify_one();
+
+	for (auto& t : _workers)
+		t.join();
+	if (_deadlineWatcher.joinable())
+		_deadlineWatcher.join();
+
+	// Like cancel(): the owners of the requests nobody has picked up are released. The requests submitted by the
+	// completion handlers from now on are cancelled by submit(), and dispatched here too.
+	for (io_request* r : queued)
+	{
+		r->result = io_result::cancelled_result();
+		complete(*r);
+	}
+	while (reap(false) != 0)
+		;
+}
+
+void thread_pool_backend::worker() noexcept
+{
+	for (;;)
+	{
+		io_request* request = nullptr;
+		{
+			std::unique_lock lock{_queueMutex};
+			_queueCv.wait(lock, [this] { return _shuttingDown || !_queue.empty(); });
+			if (_shuttingDown)
+				return;
+
+			request = _queue.front();
+			_queue.pop_front();
+			if (request->timeout.count() > 0)
+				--_queuedWithDeadline;
+		}
+
+		if (request->timeout.count() > 0 && std::chrono::steady_clock::now() >= request->backend_state.deadline)
+			request->result = io_result::timed_out_result(); // Too late, skip it
+		else
+			execute_blocking(*request);
+		complete(*request);
+	}
+}
+
+void thread_pool_backend::deadline_watcher() noexcept
+{
+	std::vector<io_request*> expired;
+	std::unique_lock lock{_queueMutex};
+	while (!_shuttingDown)
+	{
+		const auto nextDeadline = expire_queued(expired);
+		if (!expired.empty())
+		{
+			lock.unlock();
+			for (io_request* r : expired)
+				complete(*r);
+			expired.clear();
+			lock.lock();
+		}
+		else if (nextDeadline)
+			_deadlineCv.wait_until(lock, *nextDeadline);
+		else
+			_deadlineCv.wait(lock);
+	}
+}
+
+void thread_pool_backend::complete(io_request& request) noexcept
+{
+	bool first;
+	{
+		std::lock_guard lock{_completedMutex};
+		first = _completed.empty();
+		_completed.push_back(&request);
+	}
+	_completedCv.notify_one();
+
+	// Once per batch, the signal is only reset when the batch is taken by reap()
+	if (first)
+		_signal.notify();
+}
+
+void thread_pool_backend::submit(io_request& request) noexcept
+{
+	const bool hasDeadline = request.timeout.count() > 0;
+	if (hasDeadline)
+		request.backend_state.deadline = std::chrono::steady_clock::now() + request.timeout;
+
+	if (_workers.empty()) [[unlikely]]
+	{
+		execute_blocking(request);
+		complete(request);
+		return;
+	}
+
+	bool shuttingDown = false;
+	{
+		std::lock_guard lock{_queueMutex};
+		shuttingDown = _shuttingDown;
+		if (!shuttingDown)
+		{
+			_queue.push_back(&request);
+			if (hasDeadline)
+				++_queuedWithDeadline;
+		}
+	}
+	if (shuttingDown)
+	{
+		request.result = io_result::cancelled_result();
+		complete(request);
+		return;
+	}
+	_queueCv.notify_one();
+	if (hasDeadline)
+		_deadlineCv.notify_one();
+
+	if (hasDeadline)
+	{
+		// A reaper blocked in reap() has to take the new deadline into account.
+		// Locking orders this with its check, so the notification cannot be missed.
+		{
+			std::lock_guard lock{_completedMutex};
+		}
+		_completedCv.notify_one();
+	}
+}
+
+void thread_pool_backend::cancel(io_request& request) noexcept
+{
+	{
+		std::lock_guard lock{_queueMutex};
+		const auto it = std::find(_queue.begin(), _queue.end(), &request);
+		if (it == _queue.end()) // Already running or done
+			return;
+
+		_queue.erase(it);
+		if (request.timeout.count() > 0)
+			--_queuedWithDeadline;
+	}
+
+	request.result = io_result::cancelled_result();
+	complete(request);
+}
+
+void thread_pool_backend::wake() noexcept
+{
+	{
+		std::lock_guard lock{_completedMutex};
+		_woken = true;
+	}
+	_completedCv.notify_one();
+}
+
+size_t thread_pool_backend::reap(bool wait) noexcept
+{
+	{
+		std::unique_lock lock{_completedMutex};
+		for (;;)
+		{
+			// Requests that are still queued when their deadline passes are completed here, the workers may all be stuck
+			std::optional<std::chrono::steady_clock::time_point> nextDeadline;
+			{
+				std::lock_guard queueLock{_queueMutex};
+				nextDeadline = expire_queued(_completed);
+			}
+			if (!wait || !_completed.empty() || _woken)
+				break;
+
+			if (nextDeadline)
+				_completedCv.wait_until(lock, *nextDeadline);
+			else
+				_completedCv.wait(lock);
+		}
+
+		_woken = false;
+		_dispatching.swap(_completed);
+		_signal.reset();
+	}
+
+	for (io_request* r : _dispatching)
+	{
+		if (r->on_complete)
+			r->on_complete(*r);
+	}
+
+	const size_t n = _dispatching.size();
+	_dispatching.clear();
+	return n;
+}
+
+std::optional<std::chrono::steady_clock::time_point> thread_pool_backend::expire_queued(std::vector<io_request*>& expired) noexcept
+{
+	if (_queuedWithDeadline == 0)
+		return {};
+
+	const auto now = std::chrono::steady_clock::now();
+	std::optional<std::chrono::steady_clock::time_point> nextDeadline;
+	for (auto it = _queue.begin(); it != _queue.end(); )
+	{
+		io_request* r = *it;
+		if (r->timeout.count() == 0)
+			++it;
+		else if (r->backend_state.deadline <= now)
+		{
+			r->result = io_result::timed_out_result();
+			expired.push_back(r);
+			it = _queue.erase(it);
+			--_queuedWithDeadline;
+		}
+		else
+		{
+			if (!nextDeadline || r->backend_state.deadline < *nextDeadline)
+				nextDeadline = r->backend_state.deadline;
+			++it;
+		}
+	}
+
+	return nextDeadline;
+}
+
+} // namespace
+
+std::unique_ptr<io_backend> detail::make_thread_pool_backend(unsigned threads, bool notification) noexcept
+{
+	return std::make_unique<thread_pool_backend>(threads, notification);
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "async_io.hpp"
+
+#include <memory>
+
+namespace thin_io::detail {
+
+// Portable io_context backend: the requests are executed with the regular blocking file calls on a fixed number of worker threads.
+// Used when io_uring is not available. Cancellation and timeouts are cooperative: a request is only cancelled or timed out if no worker has picked it up yet.
+// With notification, every batch of completions signals the backend's notification_handle(), and an extra thread completes
+// the queued requests whose timeout expires, which otherwise only happens in reap().
+// Destroying it cancels the requests still queued and runs the completion handlers of everything that has completed.
+[[nodiscard]] std::unique_ptr<io_backend> make_thread_pool_backend(unsigned threads, bool notification = false) noexcept;
+
+}
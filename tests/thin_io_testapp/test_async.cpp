@@ -0,0 +1,774 @@
+#include "catch2/catch.hpp"
+
+#include "async_io.hpp"
+#include "read_batch.hpp"
+#include "sharded_executor.hpp"
+#include "spsc_queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <filesystem>
+#include <memory.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace thin_io;
+
+static constexpr const char testFilePath[] = "test_async.file";
+static constexpr const char testString[] = "The quick brown fox jumps over the lazy dog";
+
+// Every test runs with both backends (where io_uring is available)
+static io_context_options backendOptions()
+{
+	io_context_options options;
+	options.allow_io_uring = GENERATE(true, false);
+	return options;
+}
+
+TEST_CASE("async open, write, fsync, read", "[async]")
+{
+	file::delete_file(testFilePath);
+
+	io_context ctx{backendOptions()};
+	INFO("Backend: " << static_cast<int>(ctx.backend()));
+
+	file f;
+	std::string readBack(sizeof(testString), '\0');
+	bool finished = false;
+
+	[&]() -> detached_task {
+		REQUIRE(!(co_await ctx.async_open(f, testFilePath, file::open_mode::Read)).ok()); // Does not exist yet
+		REQUIRE(!f);
+
+		REQUIRE((co_await ctx.async_open(f, testFilePath, file::open_mode::ReadWrite)).ok());
+		REQUIRE(f);
+
+		const auto written = co_await ctx.async_pwrite(f, testString, sizeof(testString), 0);
+		REQUIRE(written.ok());
+		REQUIRE(written.bytes() == sizeof(testString));
+		REQUIRE((co_await ctx.async_fsync(f)).ok());
+		REQUIRE((co_await ctx.async_fdatasync(f)).ok());
+
+		const auto read = co_await ctx.async_pread(f, readBack.data(), 5, 20);
+		REQUIRE(read.bytes() == 5);
+		const auto readAll = co_await ctx.async_pread(f, readBack.data() + 5, 1000, 5);
+		REQUIRE(readAll.bytes() == sizeof(testString) - 5);
+		finished = true;
+	}();
+
+	ctx.run();
+	REQUIRE(finished);
+	REQUIRE(ctx.pending() == 0);
+	REQUIRE(::memcmp(readBack.data(), "jumps", 5) == 0);
+	REQUIRE(::memcmp(readBack.data() + 5, testString + 5, sizeof(testString) - 5) == 0);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+#ifdef __linux__
+TEST_CASE("async open over an open file", "[async]")
+{
+	file::delete_file(testFilePath);
+	REQUIRE(file::open_file(testFilePath, file::open_mode::Write).close());
+
+	io_context ctx{backendOptions()};
+	INFO("Backend: " << static_cast<int>(ctx.backend()));
+
+	const auto openDescriptors = [] {
+		return std::distance(std::filesystem::directory_iterator{"/proc/self/fd"}, std::filesystem::directory_iterator{});
+	};
+
+	file f = file::open_file(testFilePath, file::open_mode::Read);
+	REQUIRE(f);
+	const auto before = openDescriptors();
+
+	bool finished = false;
+	[&]() -> detached_task {
+		// The file that was open in f is closed, not leaked
+		for (int i = 0; i < 10; ++i)
+			CHECK((co_await ctx.async_open(f, testFilePath, file::open_mode::ReadWrite)).ok());
+		finished = true;
+	}();
+
+	ctx.run();
+	REQUIRE(finished);
+	REQUIRE(f);
+	REQUIRE(openDescriptors() == before);
+	REQUIRE(f.pwrite(testString, sizeof(testString), 0) == sizeof(testString)); // The new one
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+#endif
+
+TEST_CASE("async - many concurrent requests", "[async]")
+{
+	file::delete_file(testFilePath);
+	REQUIRE(file::open_file(testFilePath, file::open_mode::Write).close());
+
+	auto options = backendOptions();
+	options.queue_depth = 8; // Fewer slots than requests
+	io_context ctx{options};
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	static constexpr size_t n = 100;
+	size_t completed = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		[&, i]() -> detached_task {
+			const char c = static_cast<char>('a' + i % 26);
+			const auto result = co_await ctx.async_pwrite(f, &c, 1, i);
+			REQUIRE(result.bytes() == 1);
+			++completed;
+		}();
+	}
+
+	ctx.run();
+	REQUIRE(completed == n);
+	REQUIRE(f.size() == n);
+
+	char buf[n];
+	REQUIRE(f.pread(buf, n, 0) == n);
+	for (size_t i = 0; i < n; ++i)
+		REQUIRE(buf[i] == static_cast<char>('a' + i % 26));
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("async - cancellation", "[async]")
+{
+	io_context ctx{backendOptions()};
+	file f;
+
+	std::stop_source stop;
+	stop.request_stop();
+
+	bool finished = false;
+	[&]() -> detached_task {
+		const auto result = co_await ctx.async_open(f, testFilePath, file::open_mode::Write, file::sys_cache_mode::CachingEnabled, stop.get_token());
+		REQUIRE(result.cancelled());
+		REQUIRE(!result.ok());
+		finished = true;
+	}();
+
+	REQUIRE(finished); // Completed without suspending
+	REQUIRE(ctx.pending() == 0);
+	REQUIRE(!f);
+	ctx.run();
+}
+
+TEST_CASE("async - callbacks and futures", "[async]")
+{
+	file::delete_file(testFilePath);
+
+	io_context ctx{backendOptions()};
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	io_result writeResult;
+	ctx.submit(io_request::pwrite(f, testString, sizeof(testString), 0), [&](io_result r) {
+		writeResult = r;
+	});
+	ctx.run();
+	REQUIRE(writeResult.bytes() == sizeof(testString));
+
+	char buf[sizeof(testString)] = {0};
+	auto future = ctx.submit_for_future(io_request::pread(f, buf, sizeof(buf), 0));
+	ctx.run();
+	REQUIRE(future.get().bytes() == sizeof(testString));
+	REQUIRE(::memcmp(buf, testString, sizeof(testString)) == 0);
+
+	auto syncFuture = ctx.submit_for_future(io_request::fsync(f));
+	ctx.run();
+	REQUIRE(syncFuture.get().ok());
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("async - thread pool backend cancels queued requests", "[async]")
+{
+	file::delete_file(testFilePath);
+
+	io_context_options options;
+	options.allow_io_uring = false;
+	options.pool_threads = 1;
+	io_context ctx{options};
+	REQUIRE(ctx.backend() == io_backend_type::ThreadPool);
+
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	static constexpr size_t n = 1000;
+	std::vector<io_request> requests(n);
+	size_t completed = 0, cancelled = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		requests[i] = io_request::pwrite(f, testString, sizeof(testString), i * sizeof(testString));
+		requests[i].user_data = &completed;
+		requests[i].on_complete = [](io_request& r) noexcept {
+			++*static_cast<size_t*>(r.user_data);
+		};
+		ctx.submit(requests[i]);
+	}
+
+	// The only worker cannot have gone through all of them yet
+	for (size_t i = n; i-- > 0; )
+		ctx.cancel(requests[i]);
+
+	ctx.run();
+	REQUIRE(completed == n);
+	for (const auto& r : requests)
+	{
+		REQUIRE((r.result.ok() || r.result.cancelled()));
+		cancelled += r.result.cancelled() ? 1 : 0;
+	}
+	REQUIRE(cancelled > 0);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("async - thread pool backend completes queued requests when destroyed", "[async]")
+{
+	file::delete_file(testFilePath);
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	static constexpr size_t n = 1000;
+	std::vector<io_request> requests(n);
+	size_t completed = 0;
+	{
+		io_context_options options;
+		options.allow_io_uring = false;
+		options.pool_threads = 1;
+		io_context ctx{options};
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			requests[i] = io_request::pwrite(f, testString, sizeof(testString), i * sizeof(testString));
+			requests[i].user_data = &completed;
+			requests[i].on_complete = [](io_request& r) noexcept {
+				++*static_cast<size_t*>(r.user_data);
+			};
+			ctx.submit(requests[i]);
+		}
+		// Destroyed without running: the only worker cannot have gone through all of them yet
+	}
+
+	REQUIRE(completed == n);
+	size_t cancelled = 0;
+	for (const auto& r : requests)
+	{
+		REQUIRE((r.result.ok() || r.result.cancelled()));
+		cancelled += r.result.cancelled() ? 1 : 0;
+	}
+	REQUIRE(cancelled > 0);
+
+	// A coroutine resumed with a cancelled request that submits another one still gets to its end
+	bool finished = false;
+	{
+		io_context ctx{io_context_options{.allow_io_uring = false, .pool_threads = 1}};
+		for (size_t i = 0; i < n; ++i)
+			ctx.submit(requests[i]);
+		[&]() -> detached_task {
+			(void)co_await ctx.async_fsync(f);
+			finished = (co_await ctx.async_fsync(f)).cancelled(); // Submitted while the context is being destroyed
+		}();
+	}
+	REQUIRE(finished);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("async - registered files and buffers", "[async]")
+{
+	file::delete_file(testFilePath);
+
+	io_context ctx{backendOptions()};
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	registered_file rf = ctx.register_file(f);
+	REQUIRE(rf);
+	REQUIRE(&rf.get() == &f);
+	if (ctx.backend() == io_backend_type::IoUring)
+		REQUIRE(rf.slot() >= 0);
+
+	REQUIRE(!ctx.acquire_buffer());
+	REQUIRE(ctx.register_buffers(2, 4096));
+	REQUIRE(!ctx.register_buffers(2, 4096)); // Only once
+
+	auto writeBuffer = ctx.acquire_buffer();
+	auto readBuffer = ctx.acquire_buffer();
+	REQUIRE(writeBuffer);
+	REQUIRE(readBuffer);
+	REQUIRE(!ctx.acquire_buffer()); // All in use
+	REQUIRE(writeBuffer->size() == 4096);
+	REQUIRE(reinterpret_cast<uintptr_t>(writeBuffer->data()) % 4096 == 0);
+
+	::memcpy(writeBuffer->data(), testString, sizeof(testString));
+	bool finished = false;
+	[&]() -> detached_task {
+		const auto written = co_await ctx.async(rf.pwrite(writeBuffer->data(), sizeof(testString), 100).with_buffer(*writeBuffer));
+		REQUIRE(written.bytes() == sizeof(testString));
+		REQUIRE((co_await ctx.async(rf.fdatasync())).ok());
+
+		const auto read = co_await ctx.async(rf.pread(readBuffer->data(), 4096, 100).with_buffer(*readBuffer));
+		REQUIRE(read.bytes() == sizeof(testString));
+		finished = true;
+	}();
+
+	ctx.run();
+	REQUIRE(finished);
+	REQUIRE(::memcmp(readBuffer->data(), testString, sizeof(testString)) == 0);
+
+	readBuffer.reset();
+	REQUIRE(ctx.acquire_buffer()); // Back in the pool
+
+	// The slot can be reused
+	registered_file moved = std::move(rf);
+	REQUIRE(!rf);
+	const int slot = moved.slot();
+	moved.reset();
+	REQUIRE(ctx.register_file(f).slot() == slot);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("async - SQPOLL", "[async]")
+{
+	file::delete_file(testFilePath);
+
+	// Falls back to regular submission if the kernel won't create the polling thread
+	io_context_options options;
+	options.sqpoll = true;
+	options.sqpoll_idle_ms = 10;
+	io_context ctx{options};
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	static constexpr size_t n = 50;
+	size_t completed = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		[&, i]() -> detached_task {
+			const auto result = co_await ctx.async_pwrite(f, testString, sizeof(testString), i * sizeof(testString));
+			REQUIRE(result.bytes() == sizeof(testString));
+			++completed;
+		}();
+	}
+
+	ctx.run();
+	REQUIRE(completed == n);
+	REQUIRE(f.size() == n * sizeof(testString));
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+#ifdef __linux__
+TEST_CASE("async - completion notification", "[async]")
+{
+	auto options = backendOptions();
+	{
+		io_context ctx{options};
+		REQUIRE(ctx.notification_handle() == -1); // Off by default
+	}
+
+	file::delete_file(testFilePath);
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	options.completion_notification = true;
+	io_context ctx{options};
+	const int notificationFd = ctx.notification_handle();
+	REQUIRE(notificationFd != -1);
+
+	// Dispatching from an epoll loop, without ever blocking in the io_context
+	const int epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+	REQUIRE(epollFd != -1);
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.fd = notificationFd;
+	REQUIRE(::epoll_ctl(epollFd, EPOLL_CTL_ADD, notificationFd, &event) == 0);
+
+	static constexpr size_t n = 20;
+	size_t completed = 0;
+	std::vector<io_request> requests(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		requests[i] = io_request::pwrite(f, testString, sizeof(testString), i * sizeof(testString));
+		requests[i].user_data = &completed;
+		requests[i].on_complete = [](io_request& r) noexcept {
+			++*static_cast<size_t*>(r.user_data);
+		};
+		ctx.submit(requests[i]);
+	}
+
+	while (completed < n)
+	{
+		epoll_event ready{};
+		int nReady;
+		do {
+			nReady = ::epoll_wait(epollFd, &ready, 1, 5000);
+		} while (nReady < 0 && errno == EINTR);
+		REQUIRE(nReady == 1);
+		REQUIRE(ready.data.fd == notificationFd);
+		ctx.poll();
+	}
+	REQUIRE(ctx.pending() == 0);
+
+	// Reset by poll(), nothing is left to report
+	epoll_event ready{};
+	ctx.poll();
+	REQUIRE(::epoll_wait(epollFd, &ready, 1, 0) == 0);
+
+	::close(epollFd);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("async - timeouts and cancel handles", "[async]")
+{
+	using namespace std::chrono_literals;
+
+	// Operations that never complete on their own: opening a FIFO for reading blocks until there is a writer,
+	// reading from an empty pipe blocks until there is data
+	static constexpr const char fifoPath[] = "test_async.fifo";
+	::unlink(fifoPath);
+	REQUIRE(::mkfifo(fifoPath, 0600) == 0);
+	file::delete_file(testFilePath);
+
+	auto options = backendOptions();
+	options.pool_threads = 1;
+	io_context ctx{options};
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	// Completes well within its timeout
+	auto write = io_request::pwrite(f, testString, sizeof(testString), 0).with_timeout(10s);
+	ctx.submit(write);
+	ctx.run();
+	REQUIRE(write.result.bytes() == sizeof(testString));
+
+	if (ctx.backend() == io_backend_type::IoUring)
+	{
+		// io_uring opens FIFOs without blocking, reading from an empty pipe does block
+		int pipeFds[2];
+		REQUIRE(::pipe(pipeFds) == 0);
+		file pipe;
+		REQUIRE(pipe.attach(pipeFds[0]));
+		char c = 0;
+
+		// Aborted in the kernel
+		auto read = io_request::pread(pipe, &c, 1, ~uint64_t{0}).with_timeout(50ms);
+		ctx.submit(read);
+		ctx.run();
+		REQUIRE(read.result.timed_out());
+
+		read.timeout = {};
+		const auto handle = ctx.submit(read);
+		ctx.poll();
+		handle.cancel();
+		ctx.run();
+		REQUIRE(read.result.cancelled());
+
+		REQUIRE(pipe.close());
+		::close(pipeFds[1]);
+	}
+	else
+	{
+		// The only worker is blocked: queued requests time out or get cancelled without running
+		file fifo;
+		auto stuck = io_request::open(fifo, fifoPath, file::open_mode::Read, file::sys_cache_mode::CachingEnabled);
+		ctx.submit(stuck);
+		auto timedOut = io_request::pwrite(f, testString, sizeof(testString), 0).with_timeout(50ms);
+		ctx.submit(timedOut);
+		auto cancelled = io_request::fsync(f);
+		const auto handle = ctx.submit(cancelled);
+		handle.cancel();
+
+		while (ctx.pending() > 1)
+			ctx.run_one();
+		REQUIRE(timedOut.result.timed_out());
+		REQUIRE(cancelled.result.cancelled());
+
+		// Unblock the worker
+		const int writeEnd = ::open(fifoPath, O_WRONLY | O_NONBLOCK);
+		REQUIRE(writeEnd != -1);
+		ctx.run();
+		REQUIRE(stuck.result.ok());
+		REQUIRE(fifo);
+		::close(writeEnd);
+	}
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+	REQUIRE(::unlink(fifoPath) == 0);
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("async - request priority", "[async]")
+{
+	// The ioprio of the threads of this process other than the calling one
+	const auto otherThreadIoprios = [] {
+		std::vector<long> values;
+		for (const auto& entry : std::filesystem::directory_iterator{"/proc/self/task"})
+		{
+			const long tid = std::stol(entry.path().filename().string());
+			if (tid != ::gettid())
+				values.push_back(::syscall(SYS_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, tid));
+		}
+		return values;
+	};
+	static constexpr long idleIoprio = 3 << 13;
+
+	file::delete_file(testFilePath);
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	auto options = backendOptions();
+	options.pool_threads = 1;
+	io_context ctx{options};
+
+	auto write = io_request::pwrite(f, testString, sizeof(testString), 0).with_priority(io_priority::idle());
+	REQUIRE(write.priority == io_priority::idle());
+	ctx.submit(write);
+	ctx.run();
+	REQUIRE(write.result.bytes() == sizeof(testString));
+
+	if (ctx.backend() == io_backend_type::ThreadPool)
+	{
+		// The worker only switches its ioprio when an operation needs another one: it keeps the idle class afterwards
+		const auto ioprios = otherThreadIoprios();
+		REQUIRE(std::find(ioprios.begin(), ioprios.end(), idleIoprio) != ioprios.end());
+	}
+
+	// Not applied to the thread that submits
+	REQUIRE(::syscall(SYS_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, 0) != idleIoprio);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("async - queued timeouts signal the notification handle", "[async]")
+{
+	using namespace std::chrono_literals;
+
+	static constexpr const char fifoPath[] = "test_async.fifo";
+	::unlink(fifoPath);
+	REQUIRE(::mkfifo(fifoPath, 0600) == 0);
+	file::delete_file(testFilePath);
+
+	// The thread pool backend, whose only worker gets blocked opening the FIFO
+	io_context ctx{io_context_options{.allow_io_uring = false, .pool_threads = 1, .completion_notification = true}};
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	file fifo;
+	auto stuck = io_request::open(fifo, fifoPath, file::open_mode::Read, file::sys_cache_mode::CachingEnabled);
+	ctx.submit(stuck);
+	auto timedOut = io_request::pwrite(f, testString, sizeof(testString), 0).with_timeout(50ms);
+	ctx.submit(timedOut);
+
+	// Nobody is in reap(): the handle alone has to report the expired request
+	pollfd pfd{.fd = ctx.notification_handle(), .events = POLLIN, .revents = 0};
+	int nReady;
+	do {
+		nReady = ::poll(&pfd, 1, 5000);
+	} while (nReady < 0 && errno == EINTR);
+	// CHECK: the worker has to be unblocked in any case
+	CHECK(nReady == 1);
+	CHECK(ctx.poll() == 1);
+	CHECK(timedOut.result.timed_out());
+
+	const int writeEnd = ::open(fifoPath, O_WRONLY | O_NONBLOCK);
+	REQUIRE(writeEnd != -1);
+	ctx.run();
+	REQUIRE(stuck.result.ok());
+	::close(writeEnd);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+	REQUIRE(::unlink(fifoPath) == 0);
+}
+#endif
+
+TEST_CASE("pread_batch", "[async]")
+{
+	file::delete_file(testFilePath);
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	std::vector<uint8_t> contents(100000);
+	for (size_t i = 0; i < contents.size(); ++i)
+		contents[i] = static_cast<uint8_t>(i * 7 + i / 251);
+	REQUIRE(f.pwrite(contents.data(), contents.size(), 0) == contents.size());
+
+	// Unsorted, overlapping, close together, far apart, past EOF
+	const std::vector<std::pair<uint64_t, uint64_t>> ranges{
+		{50000, 100}, {10, 20}, {0, 16}, {40, 8}, {50200, 300}, {99990, 100}, {200000, 10}, {70000, 0}, {25, 5}
+	};
+	std::vector<std::vector<uint8_t>> buffers(ranges.size());
+	std::vector<read_req> requests(ranges.size());
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		buffers[i].resize(ranges[i].second);
+		requests[i].offset = ranges[i].first;
+		requests[i].length = ranges[i].second;
+		requests[i].dest = buffers[i].data();
+	}
+
+	batch_read_options options;
+	options.max_gap = 128;
+
+	const bool async = GENERATE(false, true);
+	io_context ctx;
+	const auto result = async ? pread_batch(ctx, f, requests, options) : pread_batch(f, requests, options);
+
+	REQUIRE(result.ok);
+	// [0, 48), [50000, 50500), [70000, 70000), [99990, EOF), [200000, ...)
+	REQUIRE(result.reads == 5);
+	REQUIRE(result.bytes_read == 48 + 500 + 10);
+
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		const auto [offset, length] = ranges[i];
+		const uint64_t expected = offset < contents.size() ? std::min(length, contents.size() - offset) : 0;
+		REQUIRE(requests[i].ok);
+		REQUIRE(requests[i].bytes_read == expected);
+		if (expected != 0)
+			REQUIRE(::memcmp(buffers[i].data(), contents.data() + offset, static_cast<size_t>(expected)) == 0);
+	}
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("spsc_queue", "[async]")
+{
+	spsc_queue<int> q{5};
+	REQUIRE(q.capacity() == 8);
+	REQUIRE(q.empty());
+	REQUIRE(!q.try_pop());
+
+	for (int i = 0; i < 8; ++i)
+		REQUIRE(q.try_push(i));
+	REQUIRE(!q.try_push(8));
+
+	for (int i = 0; i < 8; ++i)
+		REQUIRE(q.try_pop() == i);
+	REQUIRE(q.empty());
+
+	// Across threads
+	static constexpr int n = 100000;
+	std::thread producer{[&] {
+		for (int i = 0; i < n; ++i)
+		{
+			while (!q.try_push(i))
+				std::this_thread::yield();
+		}
+	}};
+
+	bool inOrder = true;
+	for (int expected = 0; expected < n; )
+	{
+		if (const auto item = q.try_pop())
+			inOrder = inOrder && *item == expected++;
+		else
+			std::this_thread::yield();
+	}
+	producer.join();
+	REQUIRE(inOrder);
+}
+
+TEST_CASE("sharded_executor", "[async]")
+{
+	file::delete_file(testFilePath);
+	file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	static constexpr size_t n = 1000;
+	std::vector<io_request> requests(n * 2);
+	std::atomic<size_t> completed{0};
+	struct context {
+		sharded_executor* executor = nullptr;
+		io_request* followUp = nullptr;
+		std::atomic<size_t>* completed = nullptr;
+	};
+	std::vector<context> contexts(n * 2);
+
+	{
+		sharded_executor_options options;
+		options.shards = 4;
+		options.queue_capacity = 16; // Fewer slots than requests
+		options.context.allow_io_uring = GENERATE(true, false);
+		options.context.pool_threads = 1;
+		sharded_executor executor{options};
+		REQUIRE(executor.shard_count() == 4);
+		REQUIRE(!executor.current_shard());
+
+		// Every write re-submits its second half to another shard from the completion handler
+		for (size_t i = 0; i < n; ++i)
+		{
+			io_request& first = requests[i];
+			io_request& second = requests[n + i];
+			first = io_request::pwrite(f, testString, 10, i * sizeof(testString));
+			second = io_request::pwrite(f, testString + 10, sizeof(testString) - 10, i * sizeof(testString) + 10);
+
+			contexts[i] = context{&executor, &second, &completed};
+			contexts[n + i] = context{&executor, nullptr, &completed};
+			first.user_data = &contexts[i];
+			second.user_data = &contexts[n + i];
+
+			const auto onComplete = [](io_request& r) noexcept {
+				auto& ctx = *static_cast<context*>(r.user_data);
+				if (ctx.followUp && r.result.ok())
+				{
+					const auto shard = ctx.executor->current_shard();
+					ctx.executor->submit(shard ? *shard + 1 : 0, *ctx.followUp);
+				}
+				ctx.completed->fetch_add(1);
+			};
+			first.on_complete = onComplete;
+			second.on_complete = onComplete;
+
+			executor.submit(first);
+		}
+	} // Waits for everything, including the follow-ups
+
+	REQUIRE(completed == n * 2);
+	for (const auto& r : requests)
+		REQUIRE(r.result.ok());
+
+	std::vector<char> contents(n * sizeof(testString));
+	REQUIRE(f.pread(contents.data(), contents.size(), 0) == contents.size());
+	for (size_t i = 0; i < n; ++i)
+		REQUIRE(::memcmp(contents.data() + i * sizeof(testString), testString, sizeof(testString)) == 0);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
@@ -2,8 +2,31 @@
 #include "catch2/catch.hpp"
 
 #include "file.hpp"
-
+#include "file_arena.hpp"
+#include "growable_mapping.hpp"
+#include "io_stats.hpp"
+#include "io_trace.hpp"
+#include "mapped_vector.hpp"
+#include "parallel_io.hpp"
+#include "rate_limited.hpp"
+#include "shared_queue.hpp"
+#include "slow_io_watchdog.hpp"
+#include "sparse_writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace thin_io;
 
@@ -519,6 +542,40 @@ TEST_CASE("mmap - write", "[file]")
 	REQUIRE(file::delete_file(testFilePath));
 }
 
+TEST_CASE("mmap - flush and lock", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	file f;
+	REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+	REQUIRE(f.truncate(1024 * 1024));
+
+	auto* mapped = static_cast<char*>(f.mmap(file::mmap_access_mode::ReadWrite, 0, 1024 * 1024));
+	REQUIRE(mapped);
+
+	// Not page-aligned: widened to the pages that contain it
+	::memcpy(mapped + 5000, "flushed", 7);
+	REQUIRE(f.flush(mapped + 5000, 7));
+	REQUIRE(f.flush(mapped + 5000, 7, file::mmap_flush_mode::Async));
+	REQUIRE(f.flush(mapped, 1024 * 1024));
+
+	char buf[7];
+	REQUIRE(f.pread(buf, 7, 5000) == 7);
+	REQUIRE(::memcmp(buf, "flushed", 7) == 0);
+
+	// Small enough for the default RLIMIT_MEMLOCK
+	REQUIRE(f.lock(mapped + 100, 4096));
+	mapped[200] = 'x';
+	REQUIRE(f.unlock(mapped + 100, 4096));
+	REQUIRE(f.lock(mapped + 8192, 1));
+	REQUIRE(f.unlock(mapped + 8192, 1));
+
+	REQUIRE(f.unmap(mapped));
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
 TEST_CASE("Factory method", "[file]")
 {
 	static constexpr const char testFilePath[] = "test.file";
@@ -567,3 +624,1178 @@ TEST_CASE("Moving a file object", "[file]")
 
 	REQUIRE(file::delete_file(testFilePath));
 }
+
+TEST_CASE("Data and hole extents", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	static constexpr uint64_t fileSize = 4 * 1024 * 1024;
+	file::delete_file(testFilePath);
+
+	file f;
+	REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+	REQUIRE(!f.next_extent(0)); // Empty file - no extents
+
+	char block[4096];
+	::memset(block, 'x', sizeof(block));
+	REQUIRE(f.pwrite(block, sizeof(block), 0) == sizeof(block));
+	REQUIRE(f.pwrite(block, sizeof(block), 2 * 1024 * 1024) == sizeof(block));
+	REQUIRE(f.truncate(fileSize));
+
+	uint64_t expectedOffset = 0, dataBytes = 0, holeBytes = 0;
+	for (const file_extent& e : f.extents())
+	{
+		REQUIRE(e.offset == expectedOffset);
+		REQUIRE(e.length > 0);
+		expectedOffset += e.length;
+		(e.is_hole ? holeBytes : dataBytes) += e.length;
+	}
+
+	REQUIRE(expectedOffset == fileSize);
+	REQUIRE(f.next_extent(0)->is_hole == false);
+	REQUIRE(dataBytes >= 2 * sizeof(block));
+	REQUIRE_LINUX(holeBytes > 0);
+
+	const auto tail = f.next_extent(2 * 1024 * 1024 + 100);
+	REQUIRE(tail);
+	REQUIRE(tail->offset == 2 * 1024 * 1024 + 100);
+	REQUIRE(!f.next_extent(fileSize));
+
+	const auto layout = f.physical_layout();
+	if (layout) // Not all filesystems support the query
+	{
+		REQUIRE(layout->allocated_bytes() <= fileSize);
+		for (size_t i = 1; i < layout->extents.size(); ++i)
+			REQUIRE(layout->extents[i].logical > layout->extents[i - 1].logical);
+	}
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("Zero block detection", "[file]")
+{
+	std::vector<std::byte> buf(4096 + 7, std::byte{0});
+	REQUIRE(is_zero_block(buf.data(), 0));
+	REQUIRE(is_zero_block(buf.data(), buf.size()));
+	REQUIRE(is_zero_block(buf.data() + 1, buf.size() - 1));
+
+	for (size_t i : {size_t{0}, size_t{63}, size_t{64}, size_t{2000}, size_t{4095}, size_t{4096 + 6}})
+	{
+		buf[i] = std::byte{1};
+		REQUIRE(!is_zero_block(buf.data(), buf.size()));
+		buf[i] = std::byte{0};
+	}
+}
+
+TEST_CASE("Sparse writer", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	static constexpr size_t blockSize = 4096;
+	file::delete_file(testFilePath);
+
+	// 1 block of data, 14 zero blocks, 1 block of data, 8 trailing zero blocks
+	std::vector<char> image(24 * blockSize, 0);
+	::memset(image.data(), 'a', blockSize);
+	::memset(image.data() + 15 * blockSize, 'b', blockSize);
+	image[15 * blockSize + 5] = 0;
+
+	SECTION("New file")
+	{
+		file f;
+		REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+		sparse_writer w{f, 0, blockSize};
+		// Odd-sized pieces that are not block aligned
+		for (size_t offset = 0; offset < image.size(); offset += 3000)
+		{
+			const size_t n = std::min<size_t>(3000, image.size() - offset);
+			REQUIRE(w.write(image.data() + offset, n) == n);
+		}
+		REQUIRE(w.finish());
+		REQUIRE(w.pos() == image.size());
+		REQUIRE(w.bytes_skipped() >= 20 * blockSize);
+		REQUIRE(w.bytes_written() + w.bytes_skipped() == image.size());
+		REQUIRE(f.close());
+	}
+
+	SECTION("Overwriting existing data")
+	{
+		const std::vector<char> junk(image.size() + blockSize, 'x');
+		REQUIRE(createTestFile(testFilePath, junk.data(), junk.size()));
+
+		file f;
+		REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+		sparse_writer w{f, 0, blockSize};
+		REQUIRE(w.write(image.data(), image.size()) == image.size());
+		REQUIRE(w.bytes_skipped() == 22 * blockSize);
+		REQUIRE(w.finish(true)); // Drops the extra block
+		REQUIRE(f.close());
+	}
+
+	SECTION("Overwriting the start of a longer file")
+	{
+		file f;
+		REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+		{
+			std::vector<char> other = image;
+			::memset(other.data(), 'x', blockSize);
+			sparse_writer w{f, 0, blockSize};
+			REQUIRE(w.write(other.data(), other.size()) == other.size());
+			REQUIRE(w.finish());
+		}
+
+		// Shorter than the file: the rest of it is kept
+		sparse_writer w{f, 0, blockSize};
+		REQUIRE(w.write(image.data(), 1000) == 1000);
+		REQUIRE(w.finish());
+		REQUIRE(f.size() == image.size());
+		sparse_writer fromMiddle{f, 1000, blockSize};
+		REQUIRE(fromMiddle.write(image.data() + 1000, blockSize - 1000) == blockSize - 1000);
+		REQUIRE(fromMiddle.finish());
+		REQUIRE(f.close());
+	}
+
+	SECTION("Block size 0")
+	{
+		file f;
+		REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+		sparse_writer w{f, 0, 0};
+		REQUIRE(w.write(image.data(), image.size()) == image.size());
+		REQUIRE(w.finish());
+		REQUIRE(w.bytes_written() + w.bytes_skipped() == image.size());
+		REQUIRE(f.close());
+	}
+
+	file f;
+	REQUIRE(f.open(testFilePath, file::open_mode::Read));
+	REQUIRE(f.size() == image.size());
+	std::vector<char> readBack(image.size());
+	REQUIRE(f.read(readBack.data(), readBack.size()) == image.size());
+	REQUIRE(readBack == image);
+
+	uint64_t holeBytes = 0;
+	for (const auto& e : f.extents())
+		holeBytes += e.is_hole ? e.length : 0;
+	REQUIRE_LINUX(holeBytes >= 20 * blockSize);
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("Parallel read and write", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	static constexpr uint64_t header = 100;
+	file::delete_file(testFilePath);
+
+	std::vector<uint32_t> data(3 * 1024 * 1024 + 17);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<uint32_t>(i * 2654435761u);
+	const io_range range{.offset = header, .length = data.size() * sizeof(uint32_t)};
+
+	file f;
+	REQUIRE(f.open(testFilePath, file::open_mode::ReadWrite));
+	const auto written = parallel_write(f, data.data(), range, 4, 1024 * 1024);
+	REQUIRE(written.ok);
+	REQUIRE(written.bytes == range.length);
+	REQUIRE(written.workers.size() == 4);
+	uint64_t chunks = 0;
+	for (const auto& w : written.workers)
+		chunks += w.chunks;
+	REQUIRE(chunks == (range.length + 1024 * 1024 - 1) / (1024 * 1024));
+	REQUIRE(f.size() == header + range.length);
+
+	std::vector<uint32_t> readBack(data.size());
+	const auto read = parallel_read(f, readBack.data(), range, 3, 999'999);
+	REQUIRE(read.ok);
+	REQUIRE(read.workers.size() == 3);
+	REQUIRE(read.throughput() > 0.0);
+	REQUIRE(readBack == data);
+
+	// Past EOF
+	const auto tooLong = parallel_read(f, readBack.data(), io_range{.offset = header + 8, .length = range.length}, 2, 1024 * 1024);
+	REQUIRE(!tooLong.ok);
+	REQUIRE(tooLong.bytes == range.length - 8);
+	uint64_t completeChunks = 0;
+	for (const auto& w : tooLong.workers)
+		completeChunks += w.chunks;
+	REQUIRE(completeChunks < (range.length + 1024 * 1024 - 1) / (1024 * 1024));
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("I/O priority", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	file background = file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(background);
+	file foreground = file::open_file(testFilePath, file::open_mode::Read);
+	REQUIRE(foreground);
+
+	REQUIRE(!background.set_priority(io_priority::best_effort(8)));
+	REQUIRE(background.set_priority(io_priority::best_effort(7)));
+	REQUIRE_LINUX(background.priority() == io_priority::best_effort(7));
+
+	const char data[] = "data";
+	char buffer[sizeof(data)];
+	REQUIRE(background.pwrite(data, sizeof(data), 0) == sizeof(data));
+
+#ifdef __linux__
+	const auto threadIoprio = [] {
+		return ::syscall(SYS_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, 0);
+	};
+	const long inherited = [&] {
+		// The value the thread had before the first change, restored for files with no priority
+		REQUIRE(foreground.pread(buffer, sizeof(buffer), 0) == sizeof(data));
+		return threadIoprio();
+	}();
+
+	REQUIRE(background.pread(buffer, sizeof(buffer), 0) == sizeof(data));
+	REQUIRE(threadIoprio() == ((2 << 13) | 7));
+	REQUIRE(foreground.pread(buffer, sizeof(buffer), 0) == sizeof(data));
+	REQUIRE(threadIoprio() == inherited);
+
+	// The thread override beats the file's own priority
+	REQUIRE(file::override_thread_priority(io_priority::idle()).is_default());
+	REQUIRE(background.pread(buffer, sizeof(buffer), 0) == sizeof(data));
+	REQUIRE(threadIoprio() == (3 << 13));
+	REQUIRE(file::override_thread_priority({}) == io_priority::idle());
+
+	// The thread's default for files without a priority
+	REQUIRE(file::set_thread_priority(io_priority::best_effort(1)));
+	REQUIRE(foreground.pread(buffer, sizeof(buffer), 0) == sizeof(data));
+	REQUIRE(threadIoprio() == ((2 << 13) | 1));
+	REQUIRE(file::set_thread_priority({}));
+	REQUIRE(threadIoprio() == inherited);
+#endif
+
+	REQUIRE(background.close());
+	REQUIRE(foreground.close());
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("Rate limiting", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	using throttled_file = file_interface<rate_limited<file_impl>>;
+	using clock = std::chrono::steady_clock;
+
+	// 1 MiB/s with a 50 ms burst: at most 52428 bytes per call
+	token_bucket::limits limits;
+	limits.bytes_per_second = 1024 * 1024;
+	limits.burst = std::chrono::milliseconds{50};
+	auto bucket = std::make_shared<token_bucket>(limits);
+	REQUIRE(bucket->max_chunk() == 52428);
+
+	throttled_file f = throttled_file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+	f.impl().set_limiter(bucket);
+
+	// The burst goes through at once, the remaining 200 KiB take 200 ms
+	std::vector<uint8_t> data(250 * 1024);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<uint8_t>(i * 7);
+
+	auto start = clock::now();
+	REQUIRE(f.pwrite(data.data(), data.size(), 0) == data.size());
+	REQUIRE(clock::now() - start >= std::chrono::milliseconds{150});
+
+	std::vector<uint8_t> readBack(data.size() + 100);
+	REQUIRE(f.pread(readBack.data(), readBack.size(), 0) == data.size()); // Split into chunks, stops at EOF
+	REQUIRE(::memcmp(readBack.data(), data.data(), data.size()) == 0);
+
+	// IOPS: 100 per second, 5 in a burst
+	limits.bytes_per_second = 0;
+	limits.ops_per_second = 100;
+	bucket->set_limits(limits);
+	start = clock::now();
+	for (int i = 0; i < 25; ++i)
+		REQUIRE(f.pread(readBack.data(), 1, 0) == 1);
+	REQUIRE(clock::now() - start >= std::chrono::milliseconds{150});
+
+	// A call split into pieces is still one operation: 3 operations would put 570 ms of debt on top of the burst
+	limits.bytes_per_second = 10 * 1024 * 1024;
+	limits.ops_per_second = 10;
+	limits.burst = std::chrono::milliseconds{10};
+	bucket->set_limits(limits);
+	REQUIRE(bucket->max_chunk() < data.size() / 2);
+	start = clock::now();
+	REQUIRE(f.pread(readBack.data(), data.size(), 0) == data.size());
+	REQUIRE(clock::now() - start < std::chrono::milliseconds{400});
+
+	// Never split into pieces smaller than a page
+	limits.burst = std::chrono::milliseconds{0};
+	bucket->set_limits(limits);
+	REQUIRE(bucket->max_chunk() == token_bucket::min_chunk);
+
+	// Adaptive: the rate is cut while the latency is above the target and recovers when it isn't
+	token_bucket::limits adaptiveLimits;
+	adaptiveLimits.bytes_per_second = 1024 * 1024;
+	adaptiveLimits.target_latency = std::chrono::milliseconds{1};
+	adaptiveLimits.latency_window = 4;
+	bucket->set_limits(adaptiveLimits);
+	REQUIRE(bucket->adaptive());
+
+	for (int i = 0; i < 8; ++i)
+		bucket->record_latency(std::chrono::milliseconds{10});
+	REQUIRE(bucket->scale() == Approx(0.64));
+	REQUIRE(bucket->max_chunk() < 1024 * 1024 / 10);
+
+	for (int i = 0; i < 4 * 20; ++i)
+		bucket->record_latency(std::chrono::microseconds{100});
+	REQUIRE(bucket->scale() == 1.0);
+
+	for (int i = 0; i < 4 * 100; ++i)
+		bucket->record_latency(std::chrono::seconds{1});
+	REQUIRE(bucket->scale() == Approx(adaptiveLimits.min_fraction));
+
+	REQUIRE(f.close());
+	REQUIRE(throttled_file::delete_file(testFilePath));
+}
+
+TEST_CASE("I/O statistics", "[file]")
+{
+	static_assert(std::is_same_v<with_stats<file_impl, false>, file_impl>);
+	static_assert(std::is_same_v<with_stats<file_impl, true>, instrumented<file_impl>>);
+
+	// Exact up to 8, within 12.5% above
+	for (const uint64_t v : {0ull, 7ull, 8ull, 9ull, 100ull, 1000ull, 123456789ull, ~0ull})
+	{
+		const size_t i = histogram_buckets::index(v);
+		REQUIRE(i < histogram_buckets::count);
+		REQUIRE(histogram_buckets::upper_bound(i) >= v);
+		REQUIRE(histogram_buckets::upper_bound(i) - v <= v / 8);
+		if (i != 0)
+			REQUIRE(histogram_buckets::upper_bound(i - 1) < v);
+	}
+
+	latency_histogram histogram;
+	for (uint64_t v = 1; v <= 1000; ++v)
+		histogram.record(v);
+	const auto h = histogram.snapshot();
+	REQUIRE(h.total == 1000);
+	REQUIRE(h.mean() == Approx(500.5));
+	REQUIRE(h.percentile(0.5) >= 500);
+	REQUIRE(h.percentile(0.5) <= 500 + 500 / 8);
+	REQUIRE(h.percentile(0.99) >= 990);
+	REQUIRE(h.max() >= 1000);
+	REQUIRE(h.max() <= 1000 + 1000 / 8);
+
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	using measured_file = file_interface<instrumented<file_impl>>;
+	const auto globalBefore = global_io_stats().snapshot();
+
+	measured_file f = measured_file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	const char data[] = "0123456789";
+	char buffer[100];
+	REQUIRE(f.pwrite(data, 10, 0) == 10);
+	REQUIRE(f.pwrite(data, 10, 10) == 10);
+	REQUIRE(f.pread(buffer, 5, 0) == 5);
+	REQUIRE(f.pread(buffer, 100, 15) == 5); // Short at EOF
+	REQUIRE(f.fsync());
+
+	const auto stats = f.impl().stats();
+	REQUIRE(stats[file_op::Pwrite].ops == 2);
+	REQUIRE(stats[file_op::Pwrite].bytes == 20);
+	REQUIRE(stats[file_op::Pwrite].latency_ns.total == 2);
+	REQUIRE(stats[file_op::Pread].ops == 2);
+	REQUIRE(stats[file_op::Pread].bytes == 10);
+	REQUIRE(stats[file_op::Pread].short_transfers == 1);
+	REQUIRE(stats[file_op::Pread].errors == 0);
+	REQUIRE(stats[file_op::Fsync].ops == 1);
+	REQUIRE(stats[file_op::Read].ops == 0);
+
+	const auto globalAfter = global_io_stats().snapshot();
+	REQUIRE(globalAfter[file_op::Pwrite].ops - globalBefore[file_op::Pwrite].ops == 2);
+	REQUIRE(globalAfter[file_op::Pread].bytes - globalBefore[file_op::Pread].bytes == 10);
+
+	REQUIRE(f.close());
+	// Errors
+	REQUIRE(!f.pread(buffer, 5, 0));
+	REQUIRE(f.impl().stats()[file_op::Pread].errors == 1);
+
+	f.impl().reset_stats();
+	REQUIRE(f.impl().stats()[file_op::Pread].ops == 0);
+	REQUIRE(measured_file::delete_file(testFilePath));
+}
+
+TEST_CASE("I/O tracing", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	static constexpr const char tracePath[] = "test.trace";
+	file::delete_file(testFilePath);
+
+	using traced_file = file_interface<traced<file_impl>>;
+	traced_file f = traced_file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	const char data[] = "0123456789";
+	char buffer[100];
+	REQUIRE(f.pwrite(data, 10, 0) == 10); // Not tracing yet
+
+	io_trace::clear();
+	io_trace::start();
+	REQUIRE(f.pwrite(data, 10, 10) == 10);
+	REQUIRE(f.pread(buffer, 100, 5) == 15);
+	REQUIRE(f.fsync());
+	std::thread{[&] {
+		REQUIRE(f.pread(buffer, 4, 0) == 4);
+	}}.join();
+	io_trace::stop();
+	REQUIRE(f.pread(buffer, 4, 0) == 4); // Not traced
+
+	const auto events = io_trace::collect();
+	REQUIRE(events.size() == 4);
+	REQUIRE(events[0].op == file_op::Pwrite);
+	REQUIRE(events[0].offset == 10);
+	REQUIRE(events[0].size == 10);
+	REQUIRE(events[0].result == 10);
+	REQUIRE(events[0].handle == static_cast<uint64_t>(f.native_handle()));
+	REQUIRE(events[1].op == file_op::Pread);
+	REQUIRE(events[1].result == 15);
+	REQUIRE(events[2].op == file_op::Fsync);
+	REQUIRE(events[2].offset == ~uint64_t{0});
+	REQUIRE(events[3].thread != events[0].thread);
+	for (size_t i = 1; i < events.size(); ++i)
+		REQUIRE(events[i].start_ns >= events[i - 1].start_ns + events[i - 1].duration_ns);
+
+	REQUIRE(io_trace::write_binary(tracePath, events));
+	const auto readBack = io_trace::read_binary(tracePath);
+	REQUIRE(readBack);
+	REQUIRE(readBack->size() == events.size());
+	REQUIRE(::memcmp(readBack->data(), events.data(), events.size() * sizeof(trace_event)) == 0);
+
+	REQUIRE(io_trace::write_chrome_json(tracePath, events));
+	{
+		file json = file::open_file(tracePath, file::open_mode::Read);
+		std::string text(static_cast<size_t>(json.size().value()), '\0');
+		REQUIRE(json.read(text.data(), text.size()) == text.size());
+		REQUIRE(text.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+		REQUIRE(text.find("\"name\":\"fsync\"") != std::string::npos);
+		REQUIRE(text.find("\"offset\":-1") != std::string::npos);
+		REQUIRE(text.ends_with("]}\n"));
+		REQUIRE(!io_trace::read_binary(tracePath));
+	}
+
+	// A full ring keeps the latest events
+	io_trace::clear();
+	io_trace::start(4);
+	std::thread{[&] {
+		for (uint64_t i = 0; i < 10; ++i)
+			REQUIRE(f.pread(buffer, 1, i) == 1);
+	}}.join();
+	io_trace::stop();
+
+	const auto latest = io_trace::collect();
+	REQUIRE(latest.size() == 4);
+	for (size_t i = 0; i < latest.size(); ++i)
+		REQUIRE(latest[i].offset == 6 + i);
+
+	io_trace::clear();
+	REQUIRE(io_trace::collect().empty());
+
+	REQUIRE(f.close());
+	REQUIRE(file::delete_file(testFilePath));
+	REQUIRE(file::delete_file(tracePath));
+}
+
+TEST_CASE("I/O tracing - collecting while a full ring is written", "[file]")
+{
+	static constexpr uint64_t marker = 0x7E57;
+	static constexpr size_t ringSize = 8;
+
+	io_trace::clear();
+	io_trace::start(ringSize);
+	std::atomic<bool> started{false}, done{false};
+	// Every field of event #i is i, so a torn copy has fields that differ
+	std::thread writer{[&] {
+		for (uint64_t i = 0; !done.load(std::memory_order_relaxed); ++i)
+		{
+			io_trace::record(trace_event{.start_ns = i, .duration_ns = i, .offset = i, .size = i, .result = static_cast<int64_t>(i), .handle = marker});
+			started.store(true, std::memory_order_relaxed);
+		}
+	}};
+	// Registered: collect() below would otherwise keep the registry locked and starve the writer
+	while (!started.load(std::memory_order_relaxed))
+		std::this_thread::yield();
+
+	size_t collected = 0;
+	bool consistent = true;
+	for (int attempt = 0; attempt < 20'000; ++attempt)
+	{
+		for (const trace_event& e : io_trace::collect())
+		{
+			if (e.handle != marker)
+				continue;
+
+			++collected;
+			consistent = consistent && e.duration_ns == e.start_ns && e.offset == e.start_ns && e.size == e.start_ns
+				&& e.result == static_cast<int64_t>(e.start_ns);
+		}
+	}
+	done = true;
+	writer.join();
+	io_trace::stop();
+
+	REQUIRE(consistent);
+	REQUIRE(collected > 0);
+
+	const auto events = io_trace::collect();
+	REQUIRE(events.size() == ringSize);
+	for (size_t i = 1; i < events.size(); ++i)
+		REQUIRE(events[i].start_ns == events[i - 1].start_ns + 1);
+
+	io_trace::clear();
+}
+
+TEST_CASE("I/O tracing - threads that exit", "[file]")
+{
+	static constexpr uint64_t marker = 0x7E58;
+	static constexpr size_t ringSize = 8;
+
+	io_trace::clear();
+	io_trace::start(ringSize);
+	const auto recordFromThread = [](uint64_t first) {
+		std::thread{[first] {
+			for (uint64_t i = first; i < first + ringSize; ++i)
+				io_trace::record(trace_event{.start_ns = i, .handle = marker});
+		}}.join();
+	};
+
+	recordFromThread(0);
+	// The first thread's ring is handed to the second one: its events are overwritten rather than kept in a ring of their own
+	recordFromThread(ringSize);
+	std::vector<trace_event> events = io_trace::collect();
+	std::erase_if(events, [](const trace_event& e) { return e.handle != marker; });
+	REQUIRE(events.size() == ringSize);
+	REQUIRE(events.front().start_ns == ringSize);
+	REQUIRE(events.back().start_ns == 2 * ringSize - 1);
+	REQUIRE(std::all_of(events.begin(), events.end(), [&](const trace_event& e) { return e.thread == events.front().thread; }));
+
+	io_trace::stop();
+	io_trace::clear();
+	REQUIRE(io_trace::collect().empty());
+}
+
+TEST_CASE("Slow I/O watchdog", "[file]")
+{
+	using namespace std::chrono_literals;
+
+	auto watchdog = std::make_shared<slow_io_watchdog>(3);
+	watchdog->set_threshold(file_op::Fsync, 50ms);
+	watchdog->set_threshold(file_op::Pread, 1ns); // Every pread
+
+	std::vector<slow_io_event> reported;
+	watchdog->set_callback([&](const slow_io_event& e) {
+		reported.push_back(e);
+	});
+
+	// Only the worst 3 are kept
+	for (const auto d : {60ms, 10ms, 200ms, 70ms, 51ms})
+		watchdog->check(file_op::Fsync, "a", ~uint64_t{0}, 0, d, false);
+	watchdog->check(file_op::Fdatasync, "a", ~uint64_t{0}, 0, 1s, false); // No threshold
+
+	REQUIRE(reported.size() == 4);
+	REQUIRE(watchdog->breaches() == 4);
+	auto worst = watchdog->worst_events();
+	REQUIRE(worst.size() == 3);
+	REQUIRE(worst[0].duration == 200ms);
+	REQUIRE(worst[1].duration == 70ms);
+	REQUIRE(worst[2].duration == 60ms);
+
+	watchdog->clear();
+	reported.clear();
+	REQUIRE(watchdog->worst_events().empty());
+
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	using watched_file = file_interface<watched<file_impl>>;
+	watched_file f = watched_file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+	f.impl().set_watchdog(watchdog);
+
+	const char data[] = "0123456789";
+	char buffer[10];
+	REQUIRE(f.pwrite(data, 10, 0) == 10);
+	REQUIRE(f.pread(buffer, 4, 6) == 4);
+
+	REQUIRE(reported.size() == 1);
+	REQUIRE(reported[0].op == file_op::Pread);
+	REQUIRE(reported[0].path == testFilePath);
+	REQUIRE(reported[0].offset == 6);
+	REQUIRE(reported[0].size == 4);
+	REQUIRE(reported[0].duration > 0ns);
+	REQUIRE(!reported[0].failed);
+
+	REQUIRE(f.close());
+	REQUIRE(!f.pread(buffer, 4, 0));
+	REQUIRE(reported.size() == 2);
+	REQUIRE(reported[1].failed);
+	REQUIRE(watchdog->worst_events().size() == 2);
+
+	// The path is the one of the file currently open
+	REQUIRE(!f.open("no_such_dir/test.file", file::open_mode::Read));
+	REQUIRE(f.impl().path().empty());
+	REQUIRE(f.open(testFilePath, file::open_mode::Read));
+	REQUIRE(f.impl().path() == testFilePath);
+	REQUIRE(f.close());
+	REQUIRE(f.impl().path().empty());
+	REQUIRE(f.impl().open_anonymous("watched", {}));
+	REQUIRE(f.impl().path().empty());
+	REQUIRE(f.close());
+
+	// A callback that throws doesn't take the file call down with it
+	watchdog->set_callback([](const slow_io_event&) { throw std::runtime_error{"callback"}; });
+	REQUIRE(!f.pread(buffer, 4, 0));
+	REQUIRE(watchdog->breaches() == 3);
+
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("Stacked decorators", "[file]")
+{
+	static_assert(file_backend<file_impl>);
+	static_assert(file_backend<instrumented<traced<rate_limited<file_impl>>>>);
+	static_assert(!file_backend<int>);
+
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	using limiter_layer = rate_limited<file_impl>;
+	using watchdog_layer = watched<limiter_layer>;
+	using stacked_file = file_interface<instrumented<watchdog_layer>>;
+
+	stacked_file f = stacked_file::open_file(testFilePath, file::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	token_bucket::limits limits;
+	limits.ops_per_second = 1000;
+	auto bucket = std::make_shared<token_bucket>(limits);
+	layer<limiter_layer>(f.impl()).set_limiter(bucket);
+	REQUIRE(f.impl().inner().inner().limiter() == bucket);
+
+	auto watchdog = std::make_shared<slow_io_watchdog>();
+	watchdog->set_threshold(file_op::Pwrite, std::chrono::nanoseconds{1});
+	layer<watchdog_layer>(f.impl()).set_watchdog(watchdog);
+	REQUIRE(layer<watchdog_layer>(f.impl()).path() == testFilePath);
+
+	const char data[] = "0123456789";
+	REQUIRE(f.pwrite(data, 10, 0) == 10);
+	REQUIRE(f.size() == 10);
+
+	// Every layer saw the call
+	REQUIRE(f.impl().stats()[file_op::Pwrite].ops == 1);
+	REQUIRE(watchdog->breaches() == 1);
+
+	REQUIRE(f.close());
+	REQUIRE(stacked_file::delete_file(testFilePath));
+}
+
+TEST_CASE("Anonymous files", "[file]")
+{
+	// Any name will do
+	REQUIRE(file::create_anonymous(nullptr).close());
+	REQUIRE(file::create_anonymous("a/b").close());
+
+	file f = file::create_anonymous("scratch");
+	REQUIRE(f);
+	REQUIRE(f.size() == 0);
+
+	const char data[] = "0123456789";
+	REQUIRE(f.pwrite(data, 10, 0) == 10);
+	REQUIRE(f.truncate(4096));
+	REQUIRE(f.size() == 4096);
+
+	auto* mapped = static_cast<char*>(f.mmap(file::mmap_access_mode::ReadWrite, 0, 4096));
+	REQUIRE(mapped);
+	REQUIRE(::memcmp(mapped, data, 10) == 0);
+	mapped[0] = 'X';
+	char c = 0;
+	REQUIRE(f.pread(&c, 1, 0) == 1);
+	REQUIRE(c == 'X');
+
+#ifdef __linux__
+	// Another process would open the descriptor it received the same way
+	const std::string procPath = "/proc/self/fd/" + std::to_string(f.native_handle());
+	file other = file::open_file(procPath.c_str(), file::open_mode::ReadWrite);
+	REQUIRE(other);
+	REQUIRE(other.pread(&c, 1, 0) == 1);
+	REQUIRE(c == 'X');
+
+	REQUIRE(f.seals() == file_seal::None);
+	REQUIRE(f.add_seals(file_seal::Shrink | file_seal::Grow));
+	REQUIRE(!f.truncate(8192));
+	REQUIRE(!other.truncate(100));
+	REQUIRE(f.pwrite(data, 10, 100) == 10); // Within the size
+
+	// Not while writably mapped
+	REQUIRE(!f.add_seals(file_seal::Write));
+	REQUIRE(f.unmap(mapped));
+	REQUIRE(f.add_seals(file_seal::Write | file_seal::Seal));
+	REQUIRE(!other.pwrite(data, 1, 0));
+	REQUIRE(f.mmap(file::mmap_access_mode::ReadWrite, 0, 4096) == nullptr);
+	REQUIRE(f.mmap(file::mmap_access_mode::ReadOnly, 0, 4096) != nullptr);
+	REQUIRE(!f.add_seals(file_seal::FutureWrite));
+
+	const auto seals = f.seals();
+	REQUIRE(seals);
+	REQUIRE(has_seal(*seals, file_seal::Shrink | file_seal::Grow | file_seal::Write | file_seal::Seal));
+
+	file unsealable = file::create_anonymous("unsealable", {.allow_sealing = false, .huge_pages = false});
+	REQUIRE(unsealable);
+	REQUIRE(!unsealable.add_seals(file_seal::Grow));
+#else
+	REQUIRE(f.unmap(mapped));
+	REQUIRE(!f.add_seals(file_seal::Grow));
+#endif
+
+	REQUIRE(f.close());
+}
+
+TEST_CASE("Shared queue", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.queue";
+	file::delete_file(testFilePath);
+
+	using namespace std::chrono_literals;
+	const auto asString = [](std::span<const std::byte> message) {
+		return std::string{reinterpret_cast<const char*>(message.data()), message.size()};
+	};
+
+	{
+		shared_queue q;
+		REQUIRE(q.open(testFilePath, 5000));
+		REQUIRE(q.capacity() == 8192);
+		REQUIRE(q.empty());
+		REQUIRE(!q.try_pop([](auto) {}));
+		REQUIRE(!q.try_push(std::string(q.max_message_size() + 1, 'x').data(), q.max_message_size() + 1));
+
+		REQUIRE(q.try_push("first", 5));
+		REQUIRE(q.try_push("", 0));
+		REQUIRE(q.try_push("third", 5));
+		std::string popped;
+		REQUIRE(q.try_pop([&](std::span<const std::byte> m) { popped = asString(m); }));
+		REQUIRE(popped == "first");
+		REQUIRE(q.try_pop([&](std::span<const std::byte> m) { popped = asString(m); }));
+		REQUIRE(popped.empty());
+	}
+
+	{
+		// Reopened with its pending message and its capacity
+		shared_queue q;
+		REQUIRE(q.open(testFilePath, 64 * 1024));
+		REQUIRE(q.capacity() == 8192);
+		std::string popped;
+		REQUIRE(q.try_pop([&](std::span<const std::byte> m) { popped = asString(m); }));
+		REQUIRE(popped == "third");
+		REQUIRE(q.empty());
+		REQUIRE(!q.pop([](auto) {}, 10ms));
+
+		// Filling it, with messages wrapping around
+		const std::string message(1000, 'm');
+		size_t pushed = 0;
+		while (q.try_push(message.data(), message.size()))
+			++pushed;
+		REQUIRE(pushed == 8);
+		REQUIRE(!q.push(message.data(), message.size(), 10ms));
+
+		// A producer that died in the middle of a push: the consumer is stuck until recover()
+		shared_queue producer;
+		REQUIRE(producer.open(testFilePath, 0));
+		for (size_t i = 0; i < pushed; ++i)
+			REQUIRE(q.try_pop([](auto) {}));
+		REQUIRE(producer.try_push("kept", 4));
+		REQUIRE(q.used_bytes() == 16);
+	}
+
+	// Many producers in threads, one consumer blocking
+	{
+		shared_queue consumer;
+		REQUIRE(consumer.open(testFilePath, 0));
+
+		constexpr uint32_t producers = 4, perProducer = 20000;
+		std::vector<std::thread> threads;
+		for (uint32_t p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([p] {
+				shared_queue q;
+				if (!q.open(testFilePath, 0))
+					return;
+				for (uint32_t i = 0; i < perProducer; ++i)
+				{
+					const uint32_t message[2] = {p, i};
+					if (!q.push(message, (i % 2 + 1) * sizeof(uint32_t), 10s))
+						return;
+				}
+			});
+		}
+
+		std::string kept;
+		REQUIRE(consumer.pop([&](std::span<const std::byte> m) { kept = asString(m); }, 1s));
+		REQUIRE(kept == "kept");
+
+		std::vector<uint32_t> next(producers, 0);
+		bool inOrder = true;
+		uint32_t received = 0;
+		while (received < producers * perProducer && consumer.pop([&](std::span<const std::byte> m) {
+			uint32_t message[2] = {};
+			::memcpy(message, m.data(), m.size());
+			inOrder = inOrder && m.size() == (next[message[0]] % 2 + 1) * sizeof(uint32_t) && (m.size() == 4 || message[1] == next[message[0]]);
+			++next[message[0]];
+		}, 10s))
+		{
+			++received;
+		}
+		for (auto& t : threads)
+			t.join();
+
+		REQUIRE(inOrder);
+		REQUIRE(next == std::vector<uint32_t>(producers, perProducer));
+		REQUIRE(consumer.empty());
+		REQUIRE(consumer.used_bytes() == 0);
+	}
+
+#ifdef __linux__
+	// Another process
+	{
+		shared_queue consumer;
+		REQUIRE(consumer.open(testFilePath, 0));
+
+		const pid_t child = ::fork();
+		if (child == 0)
+		{
+			shared_queue q;
+			bool ok = q.open(testFilePath, 0);
+			for (uint32_t i = 0; ok && i < 100000; ++i)
+				ok = q.push(&i, sizeof(i), 10s);
+			::_exit(ok ? 0 : 1);
+		}
+		REQUIRE(child > 0);
+
+		uint32_t expected = 0;
+		bool inOrder = true;
+		while (expected < 100000 && consumer.pop([&](std::span<const std::byte> m) {
+			uint32_t value = 0;
+			::memcpy(&value, m.data(), sizeof(value));
+			inOrder = inOrder && value == expected++;
+		}, 10s))
+		{}
+
+		int status = -1;
+		REQUIRE(::waitpid(child, &status, 0) == child);
+		REQUIRE(WIFEXITED(status));
+		REQUIRE(WEXITSTATUS(status) == 0);
+		REQUIRE(expected == 100000);
+		REQUIRE(inOrder);
+	}
+#endif
+
+	// Recovering from a push interrupted after its reservation
+	{
+		shared_queue q;
+		REQUIRE(q.open(testFilePath, 0));
+		REQUIRE(q.try_push("before", 6));
+		REQUIRE(q.close());
+
+		// Simulating the dead producer: reserving 16 bytes without publishing them
+		file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+		REQUIRE(f);
+		uint64_t reserved = 0;
+		REQUIRE(f.pread(&reserved, sizeof(reserved), shared_queue::reserved_offset) == sizeof(reserved));
+		reserved += 16;
+		REQUIRE(f.pwrite(&reserved, sizeof(reserved), shared_queue::reserved_offset) == sizeof(reserved));
+		REQUIRE(f.close());
+
+		REQUIRE(q.open(testFilePath, 0));
+		REQUIRE(q.try_push("after", 5));
+		std::string popped;
+		REQUIRE(q.try_pop([&](std::span<const std::byte> m) { popped = asString(m); }));
+		REQUIRE(popped == "before");
+		REQUIRE(!q.try_pop([](auto) {})); // Stuck at the gap
+		REQUIRE(q.recover() == 32);
+		REQUIRE(!q.try_pop([](auto) {})); // The later message is lost too
+		REQUIRE(q.empty());
+		REQUIRE(q.used_bytes() == 0);
+	}
+
+	// A creator that died while initializing the queue: the next one to open it takes over
+	{
+		REQUIRE(file::delete_file(testFilePath));
+		file f = file::open_file(testFilePath, file::open_mode::Write);
+		REQUIRE(f);
+		const uint32_t initializing = 1;
+		REQUIRE(f.pwrite(&initializing, sizeof(initializing), shared_queue::state_offset) == sizeof(initializing));
+		REQUIRE(f.close());
+
+		const auto start = std::chrono::steady_clock::now();
+		shared_queue q;
+		REQUIRE(q.open(testFilePath, 5000));
+		REQUIRE(std::chrono::steady_clock::now() - start < 1s); // Not waiting for the dead creator
+		REQUIRE(q.capacity() == 8192);
+		REQUIRE(q.try_push("new", 3));
+		std::string popped;
+		REQUIRE(q.try_pop([&](std::span<const std::byte> m) { popped = asString(m); }));
+		REQUIRE(popped == "new");
+	}
+
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("Growable mapping", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	growable_mapping_options options;
+	options.reserve = 1024 * 1024;
+	options.preallocate = true;
+
+	growable_mapping m;
+	REQUIRE(m.open(testFilePath, options));
+	REQUIRE(m.size() == 0);
+	REQUIRE(m.capacity() >= 1024 * 1024);
+
+	// Appending records within the reservation: the mapping doesn't move
+	std::byte* const start = m.data();
+	for (uint32_t i = 0; i < 1000; ++i)
+	{
+		std::byte* record = m.extend(sizeof(i));
+		if (!record)
+			break;
+		::memcpy(record, &i, sizeof(i));
+	}
+	REQUIRE(m.size() == 4000);
+	REQUIRE(m.data() == start);
+	REQUIRE(m.moves() == 0);
+	REQUIRE_LINUX(m.backing_file().size() == 4000);
+
+	// Past it: the contents follow
+	REQUIRE(m.resize(5 * 1024 * 1024));
+	REQUIRE(m.capacity() >= 5 * 1024 * 1024);
+	REQUIRE(m.moves() <= 1);
+	REQUIRE(m.moves() == (m.data() == start ? 0u : 1u));
+	uint32_t value = 0;
+	::memcpy(&value, m.data() + 999 * sizeof(value), sizeof(value));
+	REQUIRE(value == 999);
+	m.data()[5 * 1024 * 1024 - 1] = std::byte{0x55};
+
+	// Shrinking then growing again exposes zeros
+	REQUIRE(m.resize(2000));
+	REQUIRE(m.resize(4000));
+	::memcpy(&value, m.data() + 2000, sizeof(value));
+	REQUIRE(value == 0);
+	::memcpy(&value, m.data() + 1996, sizeof(value));
+	REQUIRE(value == 499);
+
+	growable_mapping moved = std::move(m);
+	REQUIRE(!m.is_open());
+	REQUIRE(moved.is_open());
+	REQUIRE(moved.close());
+	REQUIRE(!moved.close());
+
+	{
+		file f = file::open_file(testFilePath, file::open_mode::Read);
+		REQUIRE(f.size() == 4000); // Trimmed on Windows
+		REQUIRE(f.pread(&value, sizeof(value), 400) == sizeof(value));
+		REQUIRE(value == 100);
+	}
+
+	// Reopened: mapped with its contents
+	options.preallocate = false;
+	REQUIRE(m.open(testFilePath, options));
+	REQUIRE(m.size() == 4000);
+	::memcpy(&value, m.data() + 400, sizeof(value));
+	REQUIRE(value == 100);
+	REQUIRE(m.extend(100));
+	REQUIRE(m.size() == 4100);
+	REQUIRE(m.close());
+
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("Mapped vector", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	struct sample {
+		uint64_t time;
+		double value;
+	};
+
+	{
+		mapped_vector<sample> v;
+		REQUIRE(v.open(testFilePath));
+		REQUIRE(v.empty());
+		REQUIRE(v.capacity() == 0);
+
+		bool pushed = true;
+		for (uint64_t i = 0; i < 100000; ++i)
+			pushed = pushed && v.push_back(sample{.time = i, .value = static_cast<double>(i) / 2});
+		REQUIRE(pushed);
+		REQUIRE(v.size() == 100000);
+		REQUIRE(v.capacity() >= 100000);
+		REQUIRE(v.capacity() < 200000 + 4096); // Geometric
+		REQUIRE(v[12345].time == 12345);
+		REQUIRE(v.span().back().value == 99999.0 / 2);
+
+		REQUIRE(v.committed_size() == 0);
+		REQUIRE(v.commit(true));
+		REQUIRE(v.committed_size() == 100000);
+
+		// Not committed: lost if the process dies, kept by close()
+		REQUIRE(v.resize(100010));
+		REQUIRE(v.back().time == 0);
+		REQUIRE(v.committed_size() == 100000);
+	}
+
+	{
+		mapped_vector<sample> v;
+		REQUIRE(v.open(testFilePath));
+		REQUIRE(v.size() == 100010);
+		uint64_t sum = 0;
+		for (const sample& s : v)
+			sum += s.time;
+		REQUIRE(sum == 99999ull * 100000 / 2);
+
+		v.pop_back();
+		REQUIRE(v.shrink_to_fit());
+		REQUIRE(v.capacity() == 100009);
+		REQUIRE(v.mapping().backing_file().size() == 64 + 100009 * sizeof(sample));
+		v.clear();
+		REQUIRE(v.push_back(sample{.time = 7, .value = 7}));
+		REQUIRE(v.commit());
+	}
+
+	// Another element type
+	mapped_vector<uint32_t> other;
+	REQUIRE(!other.open(testFilePath));
+	REQUIRE(!other.is_open());
+	REQUIRE(!other.push_back(1));
+
+	mapped_vector<sample> v;
+	REQUIRE(v.open(testFilePath));
+	REQUIRE(v.size() == 1);
+	REQUIRE(v[0].time == 7);
+	REQUIRE(v.close());
+
+	REQUIRE(file::delete_file(testFilePath));
+}
+
+TEST_CASE("File arena", "[file]")
+{
+	static constexpr const char testFilePath[] = "test.file";
+	file::delete_file(testFilePath);
+
+	struct node {
+		uint64_t value;
+		arena_ptr<node> next;
+	};
+
+	file_arena_options options;
+	options.segment_size = 64 * 1024;
+	options.mapping.reserve = 256 * 1024; // Small, to make the mapping move
+
+	{
+		file_arena arena;
+		REQUIRE(arena.open(testFilePath, options));
+		REQUIRE(arena.segment_size() == 64 * 1024);
+		REQUIRE(arena.allocate_bytes(16, 128) == 0); // Alignment too large
+
+		// A list spanning many segments, built from its tail
+		arena_ptr<node> head;
+		bool zeroed = true;
+		for (uint64_t i = 0; i < 20000; ++i)
+		{
+			const auto n = arena.allocate<node>();
+			node* p = arena.get(n);
+			if (!p)
+				break;
+			zeroed = zeroed && p->value == 0 && !p->next;
+			*p = node{.value = i, .next = head};
+			head = n;
+		}
+		REQUIRE(zeroed);
+		REQUIRE(arena.mapping().moves() > 0);
+		REQUIRE(arena.live_bytes() == 20000 * sizeof(node));
+		REQUIRE(arena.segment_count() >= 20000 * sizeof(node) / (64 * 1024));
+		REQUIRE(arena.to_ptr(arena.get(head)) == head);
+		arena.set_root(head);
+		REQUIRE(arena.flush());
+	}
+
+	file_arena arena;
+	REQUIRE(arena.open(testFilePath, options));
+	auto head = arena.root_as<node>();
+	uint64_t count = 0, expected = 19999;
+	bool inOrder = true;
+	for (auto n = head; n; n = arena.get(n)->next, ++count)
+		inOrder = inOrder && arena.get(n)->value == expected--;
+	REQUIRE(inOrder);
+	REQUIRE(count == 20000);
+
+	// Freeing the oldest half of the list releases its segments
+	const uint64_t segments = arena.segment_count();
+	node* middle = arena.get(head);
+	for (uint64_t i = 0; i < 9999 && middle; ++i)
+		middle = arena.get(middle->next);
+	REQUIRE(middle);
+	auto oldest = std::exchange(middle->next, arena_ptr<node>{});
+	while (const node* p = arena.get(oldest))
+	{
+		const auto next = p->next;
+		arena.deallocate(oldest);
+		oldest = next;
+	}
+	REQUIRE(arena.live_bytes() == 10000 * sizeof(node));
+	REQUIRE(arena.free_segment_count() >= 10000 * sizeof(node) / (64 * 1024) - 1);
+
+	// Reused, zeroed, without growing the file
+	const auto reused = arena.allocate<node>(4096 / sizeof(node) * 8);
+	REQUIRE(reused);
+	REQUIRE(arena.segment_count() == segments);
+	const node* block = arena.get(reused);
+	REQUIRE(std::all_of(block, block + 4096 / sizeof(node) * 8, [](const node& x) { return x.value == 0 && !x.next; }));
+
+	// Larger than a segment: a run of its own, released at once
+	const uint64_t bigSegments = (100000 * 8 + 64 + 65535) / 65536;
+	const auto big = arena.allocate<uint64_t>(100000);
+	uint64_t* values = arena.get(big);
+	REQUIRE(values);
+	REQUIRE(arena.segment_count() > segments);
+	std::fill(values, values + 100000, 1);
+	const uint64_t freeBefore = arena.free_segment_count();
+	arena.deallocate(big, 100000);
+	REQUIRE(arena.free_segment_count() == freeBefore + bigSegments);
+
+	// Reused by the next run that fits, zeroed
+	const uint64_t grown = arena.segment_count();
+	const auto again = arena.allocate<uint64_t>(100000);
+	values = arena.get(again);
+	REQUIRE(values);
+	REQUIRE(arena.segment_count() == grown);
+	REQUIRE(arena.free_segment_count() == freeBefore);
+	REQUIRE(std::all_of(values, values + 100000, [](uint64_t x) { return x == 0; }));
+	arena.deallocate(again, 100000);
+	REQUIRE(arena.close());
+
+	// Not an arena
+	REQUIRE(arena.open(testFilePath, options));
+	REQUIRE(arena.close());
+	{
+		file f = file::open_file(testFilePath, file::open_mode::ReadWrite);
+		REQUIRE(f.pwrite("garbage!", 8, 0) == 8);
+	}
+	REQUIRE(!arena.open(testFilePath, options));
+
+	REQUIRE(file::delete_file(testFilePath));
+}
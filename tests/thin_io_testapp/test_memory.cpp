@@ -0,0 +1,317 @@
+#include "catch2/catch.hpp"
+
+#include "memory_file.hpp"
+#include "ring_buffer.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <memory.h>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace thin_io;
+
+TEST_CASE("Memory file - basics", "[memory]")
+{
+	static_assert(file_backend<memory_file_impl>);
+	static constexpr const char path[] = "memory/basics";
+	memory_file::delete_file(path);
+
+	memory_file f;
+	REQUIRE(!f.open(path, file_constants::open_mode::Read));
+	REQUIRE(memory_file::error_code() == ENOENT);
+	REQUIRE(f.open(path, file_constants::open_mode::Write));
+	REQUIRE(f.size() == 0);
+	REQUIRE(f.at_end());
+
+	const char text[] = "The quick brown fox jumps over the lazy dog";
+	REQUIRE(f.write(text, sizeof(text)) == sizeof(text));
+	REQUIRE(f.pos() == sizeof(text));
+	REQUIRE(f.at_end());
+	REQUIRE(f.pwrite("cat", 3, 40) == 3);
+	REQUIRE(f.pos() == sizeof(text)); // Positional calls don't move it
+	char unread[4];
+	REQUIRE(!f.pread(unread, 3, 0)); // Write-only handle
+	REQUIRE(memory_file::error_code() == EBADF);
+	REQUIRE(f.set_pos(0));
+	REQUIRE(!f.read(unread, 3));
+	REQUIRE(f.pos() == 0);
+	REQUIRE(f.close());
+
+	// Shared by name
+	memory_file reader = memory_file::open_file(path, file_constants::open_mode::Read);
+	REQUIRE(reader);
+	REQUIRE(reader.size() == sizeof(text));
+	char buffer[100];
+	REQUIRE(reader.read(buffer, sizeof(buffer)) == sizeof(text));
+	REQUIRE(::memcmp(buffer, "The quick brown fox jumps over the lazy cat", sizeof(text)) == 0);
+	REQUIRE(reader.read(buffer, sizeof(buffer)) == 0);
+	REQUIRE(reader.pread(buffer, 5, 20) == 5);
+	REQUIRE(::memcmp(buffer, "jumps", 5) == 0);
+	REQUIRE(!reader.pwrite(buffer, 1, 0)); // Read-only handle
+	REQUIRE(memory_file::error_code() == EBADF);
+
+	// Deleting the name keeps the contents for the open handles
+	REQUIRE(memory_file::delete_file(path));
+	REQUIRE(!memory_file::delete_file(path));
+	REQUIRE(reader.pread(buffer, 3, 0) == 3);
+	REQUIRE(!memory_file{}.open(path, file_constants::open_mode::Read));
+
+	// Another handle to the same contents
+	memory_file other;
+	REQUIRE(other.attach(reader.native_handle()));
+	REQUIRE(other.pwrite("A", 1, 0) == 1);
+	REQUIRE(reader.pread(buffer, 1, 0) == 1);
+	REQUIRE(buffer[0] == 'A');
+
+	// Unnamed files are private
+	memory_file scratch = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(scratch);
+	REQUIRE(scratch.size() == 0);
+}
+
+TEST_CASE("Memory file - growth, truncate and holes", "[memory]")
+{
+	memory_file f = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	// Spans many chunks
+	std::vector<uint32_t> data(3 * 1024 * 1024);
+	std::iota(data.begin(), data.end(), 0u);
+	const uint64_t bytes = data.size() * sizeof(uint32_t);
+	REQUIRE(f.pwrite(data.data(), 0, 1000) == 0); // Writing nothing past the end doesn't extend the file
+	REQUIRE(f.size() == 0);
+	REQUIRE(f.pwrite(data.data(), bytes, 1000) == bytes);
+	REQUIRE(f.size() == bytes + 1000);
+
+	std::vector<uint32_t> readBack(data.size());
+	REQUIRE(f.pread(readBack.data(), bytes, 1000) == bytes);
+	REQUIRE(readBack == data);
+
+	// The gap before the write reads as zeros
+	std::vector<char> head(1000, 'x');
+	REQUIRE(f.pread(head.data(), head.size(), 0) == head.size());
+	REQUIRE(std::all_of(head.begin(), head.end(), [](char c) { return c == 0; }));
+
+	REQUIRE(f.punch_hole(1000, 4 * 10));
+	REQUIRE(f.pread(readBack.data(), 4 * 11, 1000) == 4 * 11);
+	REQUIRE(readBack[9] == 0);
+	REQUIRE(readBack[10] == 10);
+
+	// Shrinking then growing again exposes zeros, not the old data
+	REQUIRE(f.truncate(2000));
+	REQUIRE(f.size() == 2000);
+	REQUIRE(f.truncate(1024 * 1024));
+	std::vector<char> tail(1024 * 1024 - 2000, 'x');
+	REQUIRE(f.pread(tail.data(), tail.size(), 2000) == tail.size());
+	REQUIRE(std::all_of(tail.begin(), tail.end(), [](char c) { return c == 0; }));
+
+	REQUIRE(f.preallocate(0, 5 * 1024 * 1024));
+	REQUIRE(f.size() == 5 * 1024 * 1024);
+	REQUIRE(f.fsync());
+}
+
+TEST_CASE("Memory file - mmap", "[memory]")
+{
+	memory_file f = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	std::vector<uint8_t> data(1024 * 1024);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<uint8_t>(i * 13);
+	REQUIRE(f.write(data.data(), data.size()) == data.size());
+
+	REQUIRE(f.mmap(file_constants::mmap_access_mode::ReadOnly, 0, data.size() + 1) == nullptr); // Past the end
+	REQUIRE(memory_file::error_code() == EINVAL);
+
+	// Within one chunk: no copy
+	auto* small = static_cast<uint8_t*>(f.mmap(file_constants::mmap_access_mode::ReadWrite, 100, 1000));
+	REQUIRE(small);
+	REQUIRE(::memcmp(small, data.data() + 100, 1000) == 0);
+	small[0] = 0xFF;
+	uint8_t b = 0;
+	REQUIRE(f.pread(&b, 1, 100) == 1);
+	REQUIRE(b == 0xFF);
+
+	// Spans chunks, one of which is mapped
+	REQUIRE(f.mmap(file_constants::mmap_access_mode::ReadOnly, 0, data.size()) == nullptr);
+	REQUIRE(memory_file::error_code() == EBUSY);
+	REQUIRE(f.unmap(small));
+	REQUIRE(!f.unmap(small));
+
+	auto* whole = static_cast<uint8_t*>(f.mmap(file_constants::mmap_access_mode::ReadWrite, 0, data.size()));
+	REQUIRE(whole);
+	data[100] = 0xFF;
+	REQUIRE(::memcmp(whole, data.data(), data.size()) == 0);
+
+	// Growing the file does not move the mapped memory
+	REQUIRE(f.pwrite(data.data(), data.size(), data.size()) == data.size());
+	whole[5] = 5;
+	REQUIRE(f.pread(&b, 1, 5) == 1);
+	REQUIRE(b == 5);
+	REQUIRE(f.unmap(whole));
+}
+
+TEST_CASE("Memory file - flush and lock", "[memory]")
+{
+	memory_file f = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(f);
+	REQUIRE(f.truncate(64 * 1024));
+
+	// No-ops on a mapped range, like on a real file
+	auto* mapped = static_cast<uint8_t*>(f.mmap(file_constants::mmap_access_mode::ReadWrite, 0, 64 * 1024));
+	REQUIRE(mapped);
+	mapped[0] = 1;
+	REQUIRE(f.flush(mapped, 64 * 1024));
+	REQUIRE(f.lock(mapped, 64 * 1024));
+	REQUIRE(f.unlock(mapped, 64 * 1024));
+	uint8_t b = 0;
+	REQUIRE(f.pread(&b, 1, 0) == 1);
+	REQUIRE(b == 1);
+	REQUIRE(f.unmap(mapped));
+
+	REQUIRE(f.close());
+	REQUIRE(!f.flush(mapped, 64 * 1024));
+	REQUIRE(!f.lock(mapped, 64 * 1024));
+	REQUIRE(!f.unlock(mapped, 64 * 1024));
+}
+
+TEST_CASE("Memory file - concurrent access", "[memory]")
+{
+	memory_file f = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	constexpr size_t threads = 4, blocks = 256, blockSize = 4096;
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t)
+	{
+		workers.emplace_back([&f, t] {
+			std::vector<uint8_t> block(blockSize, static_cast<uint8_t>(t + 1));
+			for (size_t i = t; i < blocks; i += threads)
+				(void)f.pwrite(block.data(), blockSize, i * blockSize);
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+
+	REQUIRE(f.size() == blocks * blockSize);
+	std::vector<uint8_t> block(blockSize);
+	for (size_t i = 0; i < blocks; ++i)
+	{
+		REQUIRE(f.pread(block.data(), blockSize, i * blockSize) == blockSize);
+		REQUIRE(std::all_of(block.begin(), block.end(), [&](uint8_t v) { return v == i % threads + 1; }));
+	}
+}
+
+TEST_CASE("Ring buffer", "[memory]")
+{
+	ring_buffer ring{1};
+	REQUIRE(ring.valid());
+	REQUIRE(ring.capacity() == ring_buffer::granularity());
+	REQUIRE(ring.empty());
+	REQUIRE(ring.writable().size() == ring.capacity());
+
+	const size_t capacity = ring.capacity();
+	std::vector<uint8_t> data(capacity);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<uint8_t>(i * 7);
+
+	// Moving the head close to the end, then writing across it
+	REQUIRE(ring.write(data.data(), capacity - 10) == capacity - 10);
+	ring.consume(capacity - 10);
+	REQUIRE(ring.empty());
+	REQUIRE(ring.write(data.data(), 100) == 100);
+
+	// Contiguous across the wrap-around
+	auto readable = ring.readable();
+	REQUIRE(readable.size() == 100);
+	REQUIRE(::memcmp(readable.data(), data.data(), 100) == 0);
+
+	// Both views are the same memory
+	auto writable = ring.writable();
+	REQUIRE(writable.size() == capacity - 100);
+	writable[0] = std::byte{0xAB};
+	REQUIRE(*(writable.data() + capacity) == std::byte{0xAB});
+
+	REQUIRE(ring.write(data.data(), capacity) == capacity - 100); // Only as much as fits
+	REQUIRE(ring.size() == capacity);
+	REQUIRE(ring.free_space() == 0);
+	REQUIRE(::memcmp(ring.readable().data() + 100, data.data(), capacity - 100) == 0);
+
+	ring_buffer moved = std::move(ring);
+	REQUIRE(!ring.valid());
+	REQUIRE(moved.size() == capacity);
+	moved.clear();
+	REQUIRE(moved.empty());
+
+	// Without a mapping (moved from or default-constructed), everything is empty
+	ring_buffer unmapped;
+	memory_file source = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(source.write(data.data(), 10) == 10);
+	for (ring_buffer* r : {&ring, &unmapped})
+	{
+		REQUIRE(r->readable().empty());
+		REQUIRE(r->writable().empty());
+		REQUIRE(r->write(data.data(), 10) == 0);
+		REQUIRE(r->fill_from(source, 0, 10) == 0);
+	}
+}
+
+TEST_CASE("Ring buffer - filling from a file", "[memory]")
+{
+	// Length-prefixed records, parsed in place from the ring even when they wrap around
+	memory_file f = memory_file::open_file("", file_constants::open_mode::ReadWrite);
+	REQUIRE(f);
+
+	ring_buffer ring{1};
+	REQUIRE(ring.valid());
+
+	std::vector<uint32_t> lengths;
+	for (uint32_t i = 0; lengths.size() < 1000; ++i)
+		lengths.push_back(i * 37 % 1000 + 1);
+
+	for (const uint32_t length : lengths)
+	{
+		std::vector<uint8_t> record(length, static_cast<uint8_t>(length));
+		REQUIRE(f.write(&length, sizeof(length)) == sizeof(length));
+		REQUIRE(f.write(record.data(), length) == length);
+	}
+	REQUIRE(f.set_pos(0));
+
+	size_t parsed = 0;
+	for (;;)
+	{
+		const auto n = ring.fill_from(f, 3000);
+		REQUIRE(n);
+
+		for (;;)
+		{
+			const auto bytes = ring.readable();
+			uint32_t length = 0;
+			if (bytes.size() < sizeof(length))
+				break;
+			::memcpy(&length, bytes.data(), sizeof(length));
+			if (bytes.size() < sizeof(length) + length)
+				break;
+
+			REQUIRE(length == lengths[parsed]);
+			const auto* payload = reinterpret_cast<const uint8_t*>(bytes.data() + sizeof(length));
+			REQUIRE(std::all_of(payload, payload + length, [length](uint8_t b) { return b == static_cast<uint8_t>(length); }));
+			ring.consume(sizeof(length) + length);
+			++parsed;
+		}
+
+		if (*n == 0)
+			break;
+	}
+
+	REQUIRE(parsed == lengths.size());
+	REQUIRE(ring.empty());
+
+	// Positional variant
+	REQUIRE(ring.fill_from(f, 4, 10) == 10);
+	REQUIRE(ring.size() == 10);
+	REQUIRE(static_cast<uint8_t>(ring.readable()[0]) == static_cast<uint8_t>(lengths[0]));
+}
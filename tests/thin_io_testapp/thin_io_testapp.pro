@@ -71,5 +71,7 @@ INCLUDEPATH += \
 	$${PWD}/../../src
 
 SOURCES += \
+	test_async.cpp \
 	test_file.cpp \
+	test_memory.cpp \
 	tests_main.cpp
@@ -34,9 +34,37 @@ mac*|linux*{
 }
 
 HEADERS += \
+	src/async_io.hpp \
 	src/enum_helpers.hpp \
 	src/file.hpp \
-	src/file_interface.hpp
+	src/file_arena.hpp \
+	src/file_decorator.hpp \
+	src/file_interface.hpp \
+	src/growable_mapping.hpp \
+	src/io_stats.hpp \
+	src/io_trace.hpp \
+	src/mapped_vector.hpp \
+	src/memory_file.hpp \
+	src/parallel_io.hpp \
+	src/rate_limited.hpp \
+	src/read_batch.hpp \
+	src/ring_buffer.hpp \
+	src/sharded_executor.hpp \
+	src/shared_queue.hpp \
+	src/slow_io_watchdog.hpp \
+	src/sparse_writer.hpp \
+	src/spsc_queue.hpp \
+	src/thread_pool_backend.hpp
+
+SOURCES += \
+	src/async_io.cpp \
+	src/file_arena.cpp \
+	src/growable_mapping.cpp \
+	src/io_trace.cpp \
+	src/memory_file.cpp \
+	src/sharded_executor.cpp \
+	src/shared_queue.cpp \
+	src/thread_pool_backend.cpp
 
 win*{
 	HEADERS += $$files(src/*_win.hpp, true)